@@ -28,6 +28,9 @@ while [ $# -gt 0 ] ; do
     --without-regex)        WITHOUT_REGEX=1 ;;
     --with-included-regex)  WITH_INCLUDED_REGEX=1 ;;
     --with-pcre)            WITH_PCRE=1 ;;
+    --without-pthreads)     WITHOUT_PTHREADS=1 ;;
+    --without-ucontext)     WITHOUT_UCONTEXT=1 ;;
+    --without-simd)         WITHOUT_SIMD=1 ;;
     --help)                 CONFIG_HELP=1 ;;
 
     --mingw32-prefix=*)     MINGW32_PREFIX=`echo $1 | sed -e 's/--mingw32-prefix=//'`
@@ -55,6 +58,9 @@ if [ "$CONFIG_HELP" = "1" ] ; then
     echo "--without-unix-glob   Disable glob.h usage (use workaround)."
     echo "--with-included-regex Use included regex code (gnu_regex.c)."
     echo "--with-pcre           Enable PCRE library detection."
+    echo "--without-pthreads    Disable POSIX threads (parallel commands run serially)."
+    echo "--without-ucontext    Disable ucontext coroutines (generators run eagerly)."
+    echo "--without-simd        Disable SSE2/AVX2 vector kernels."
     echo "--mingw32             Build using the mingw32 compiler."
 
     echo
@@ -239,6 +245,19 @@ else
     echo "No"
 fi
 
+# test for getline()
+echo -n "Testing for getline()... "
+echo "#include <stdio.h>" > .tmp.c
+echo "int main(void) { char *p = NULL; size_t n = 0; getline(&p, &n, stdin); return 0; }" >> .tmp.c
+
+$CC .tmp.c -o .tmp.o 2>> .config.log
+if [ $? = 0 ] ; then
+    echo "#define CONFOPT_GETLINE 1" >> config.h
+    echo "OK"
+else
+    echo "No"
+fi
+
 
 # test for termios.h
 echo -n "Testing for termios.h... "
@@ -272,6 +291,82 @@ else
     echo "No"
 fi
 
+# test for POSIX threads
+echo -n "Testing for POSIX threads... "
+
+if [ "$WITHOUT_PTHREADS" = "1" ] ; then
+    echo "Disabled by user"
+else
+    echo "#include <pthread.h>" > .tmp.c
+    echo "static void *f(void *a) { return a; }" >> .tmp.c
+    echo "int main(void) { pthread_t t; pthread_create(&t, NULL, f, NULL); pthread_join(t, NULL); return 0; }" >> .tmp.c
+
+    $CC .tmp.c -lpthread -o .tmp.o 2>> .config.log
+
+    if [ $? = 0 ] ; then
+        echo "#define CONFOPT_PTHREADS 1" >> config.h
+        echo "-lpthread" >> config.ldflags
+        echo "OK"
+    else
+        echo "No"
+    fi
+fi
+
+# test for atomic builtins
+echo -n "Testing for atomic builtins... "
+
+echo "int main(void) { unsigned long v = 0, o = 0; __atomic_compare_exchange_n(&v, &o, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED); return (int) __atomic_load_n(&v, __ATOMIC_ACQUIRE) - 1; }" > .tmp.c
+
+$CC .tmp.c -o .tmp.o 2>> .config.log
+
+if [ $? = 0 ] ; then
+    echo "#define CONFOPT_ATOMIC_BUILTINS 1" >> config.h
+    echo "OK"
+else
+    echo "No"
+fi
+
+# test for ucontext
+echo -n "Testing for ucontext... "
+
+if [ "$WITHOUT_UCONTEXT" = "1" ] ; then
+    echo "Disabled by user"
+else
+    echo "#include <ucontext.h>" > .tmp.c
+    echo "static ucontext_t m, c; static char s[16384];" >> .tmp.c
+    echo "static void f(void) { swapcontext(&c, &m); }" >> .tmp.c
+    echo "int main(void) { getcontext(&c); c.uc_stack.ss_sp = s; c.uc_stack.ss_size = sizeof(s); c.uc_link = &m; makecontext(&c, f, 0); swapcontext(&m, &c); return 0; }" >> .tmp.c
+
+    $CC .tmp.c -o .tmp.o 2>> .config.log
+
+    if [ $? = 0 ] ; then
+        echo "#define CONFOPT_UCONTEXT 1" >> config.h
+        echo "OK"
+    else
+        echo "No"
+    fi
+fi
+
+# test for x86 SIMD intrinsics
+echo -n "Testing for x86 SIMD intrinsics... "
+
+if [ "$WITHOUT_SIMD" = "1" ] ; then
+    echo "Disabled by user"
+else
+    echo "#include <immintrin.h>" > .tmp.c
+    echo "__attribute__ ((target(\"avx2\"))) static void f(long long *a) { __m256i x = _mm256_loadu_si256((__m256i *) a); _mm256_storeu_si256((__m256i *) a, _mm256_add_epi64(x, x)); }" >> .tmp.c
+    echo "int main(void) { long long a[4] = { 0 }; __builtin_cpu_init(); if (__builtin_cpu_supports(\"avx2\")) f(a); return (int) a[0]; }" >> .tmp.c
+
+    $CC .tmp.c -o .tmp.o 2>> .config.log
+
+    if [ $? = 0 ] ; then
+        echo "#define CONFOPT_X86_SIMD 1" >> config.h
+        echo "OK"
+    else
+        echo "No"
+    fi
+fi
+
 # test for Grutatxt
 echo -n "Testing if Grutatxt is installed... "
 
@@ -11,6 +11,18 @@
 
 #include <stdio.h>
 
+/* interpreter state is thread-local, so each thread can run its own
+   filp instance (see filp_thread.c) */
+#if defined(__GNUC__)
+#define FILP_TLS __thread
+#elif defined(_MSC_VER)
+#define FILP_TLS __declspec(thread)
+#else
+/* no thread-local storage: the worker pool is disabled */
+#define FILP_TLS
+#define FILP_NO_TLS
+#endif
+
 /* data types */
 
 typedef enum {
@@ -22,9 +34,44 @@ typedef enum {
     FILP_EXT_STRING,    /* external string */
     FILP_NULL,          /* NULL value */
     FILP_FILE,          /* file descriptor (FILE *) */
-    FILP_ARRAY          /* array */
+    FILP_ARRAY,         /* array */
+    FILP_TASK,          /* task (struct filp_task *) */
+    FILP_CHANNEL,       /* channel (struct filp_channel *) */
+    FILP_GENERATOR,     /* generator (struct filp_gen *) */
+    FILP_VECTOR,        /* numeric vector (struct filp_vector *) */
+    FILP_OMAP,          /* ordered map (struct filp_omap *) */
+    FILP_BUILDER        /* string builder */
 } filp_type;
 
+/* numeric vector element types */
+
+#define FILP_VEC_REAL   0       /* double */
+#define FILP_VEC_INT    1       /* filp_int64 */
+
+/* numeric vector operations */
+
+#define FILP_VOP_ADD    0
+#define FILP_VOP_SUB    1
+#define FILP_VOP_MUL    2
+#define FILP_VOP_DIV    3
+#define FILP_VOP_LT     4       /* comparisons give masks */
+#define FILP_VOP_GT     5
+#define FILP_VOP_EQ     6
+
+/* numeric reductions */
+
+#define FILP_VRED_SUM   0
+#define FILP_VRED_MIN   1
+#define FILP_VRED_MAX   2
+#define FILP_VRED_MEAN  3
+#define FILP_VRED_COUNT 4
+
+#if defined(_MSC_VER) || defined(__BORLANDC__)
+typedef __int64 filp_int64;
+#else
+typedef long long filp_int64;
+#endif
+
 /* errors */
 
 typedef enum {
@@ -38,7 +85,13 @@ typedef enum {
     FILPERR_FILE_NOT_FOUND,
     FILPERR_PERMISSION_DENIED,
     FILPERR_NOT_IMPLEMENTED,
-    FILPERR_SYNTAX_ERROR
+    FILPERR_SYNTAX_ERROR,
+    FILPERR_TASK_EXPECTED,
+    FILPERR_CHANNEL_EXPECTED,
+    FILPERR_GENERATOR_EXPECTED,
+    FILPERR_VECTOR_EXPECTED,
+    FILPERR_OMAP_EXPECTED,
+    FILPERR_BUILDER_EXPECTED
 } filp_error;
 
 /* status codes */
@@ -59,11 +112,21 @@ struct filp_val {
     struct filp_val **array;    /* array (if type == FILP_ARRAY) */
     struct filp_val *next;      /* next in values chain */
     int pipe:1;                 /* 1 if file is a pipe */
+    int interned:1;             /* 1 if value is an interned string */
+    int own:1;                  /* 1 if a scalar view doesn't share its bytes */
+    int grow:1;                 /* 1 if a scalar's bytes can grow in place */
+    int hash:1;                 /* 1 if an array is a hash */
+    void *cache;                /* cached data (e.g. compiled code) */
+    void (*cache_free) (void *);        /* cached data destructor */
 };
 
 struct filp_stack {
-    struct filp_val *value;     /* value */
-    struct filp_stack *next;    /* next in chain */
+    struct filp_val **values;   /* values (bottom first) */
+    int elems;                  /* number of values */
+    int alloc;                  /* allocated values */
+    int *marks;                 /* offsets of the list markers */
+    int nmarks;                 /* number of list markers */
+    int amarks;                 /* allocated list markers */
 };
 
 struct filp_sym {
@@ -76,20 +139,24 @@ struct filp_sym {
 
 /* externals */
 
-extern int _filp_stack_size;
-extern int _filp_stack_elems;
-extern int _filp_val_account;
-extern int _filp_sym_account;
+extern FILP_TLS int _filp_stack_size;
+extern FILP_TLS int _filp_stack_elems;
+extern FILP_TLS int _filp_val_account;
+extern FILP_TLS int _filp_sym_account;
 extern char _filp_version[];
-extern int _filp_real;
-extern int _filp_bareword;
-extern int _filp_error;
-extern char _filp_error_info[80];
-extern int _filp_isolate;
+extern FILP_TLS int _filp_real;
+extern FILP_TLS int _filp_bareword;
+extern FILP_TLS int _filp_error;
+extern FILP_TLS char _filp_error_info[80];
+extern FILP_TLS int _filp_isolate;
 extern char *_filp_license;
-extern int _in_filp;
-extern struct filp_val *_filp_null_value;
-extern struct filp_val *_filp_true_value;
+extern FILP_TLS int _in_filp;
+extern FILP_TLS int _filp_dict_serial;
+extern FILP_TLS char *_filp_cstack_limit;
+extern FILP_TLS struct filp_val *_filp_null_value;
+extern FILP_TLS struct filp_val *_filp_true_value;
+extern int _filp_threads;
+extern int _filp_chunk_size;
 
 /* macros */
 
@@ -99,20 +166,38 @@ extern struct filp_val *_filp_true_value;
 /* exports a C constant into Filp */
 #define FILP_C_CONSTANT(c) filp_execf("/%s { %d } set", #c, c)
 
+/* compiled program (opaque) */
+struct filp_prog;
+
 /* protos */
 
 char *filp_poke(char *ptr, int *size, int offset, int c);
+char *filp_append(char *ptr, int *size, int *offset, void *data, int len);
 char *filp_splice(char *src, int offset, int size, char *new);
 int filp_hashfunc(unsigned char *string, int mod);
 
+char *filp_intern(char *str);
+char *filp_intern_lookup(char *str);
+unsigned int filp_intern_hash(char *istr);
+void filp_intern_unref(char *istr);
+struct filp_val *filp_new_interned_value(char *str);
+
 struct filp_val *filp_new_value(filp_type type, void *value, int size);
+struct filp_val *filp_new_scalar_view(struct filp_val *v, char *str, int len);
+struct filp_val *filp_new_builder(void);
+int filp_builder_append(struct filp_val *v, char *data, int len);
+struct filp_val *filp_builder_str(struct filp_val *v);
 void filp_ref_value(struct filp_val *v);
 void filp_unref_value(struct filp_val *v);
+int filp_val_len(struct filp_val *v);
 int filp_cmp(struct filp_val *v1, struct filp_val *v2);
 int filp_is_true(struct filp_val *v);
 
+struct filp_val *filp_new_scalar_len(char *str, int len);
+int filp_itoa(char *buf, int value);
 struct filp_val *filp_new_int_value(int value);
 int filp_val_to_int(struct filp_val *v);
+struct filp_val *filp_new_int64_value(filp_int64 value);
 struct filp_val *filp_new_real_value(double value);
 double filp_val_to_real(struct filp_val *v);
 struct filp_val *filp_new_bin_code_value(int (*func) (void));
@@ -131,8 +216,10 @@ double filp_real_pop(void);
 struct filp_val *filp_stack_value(int pos);
 void filp_rot(int pos);
 void filp_swap_stack(void);
+void filp_exchange_stack(struct filp_stack *stack);
 
 struct filp_sym *filp_find_symbol(char *name);
+struct filp_sym *filp_find_bin_code(struct filp_val *v);
 struct filp_sym *filp_new_symbol(filp_type type, char *name);
 struct filp_val *filp_get_symbol(struct filp_sym *s);
 void filp_set_symbol(struct filp_sym *s, struct filp_val *v);
@@ -142,6 +229,10 @@ int filp_ext_int(char *name, int *val);
 int filp_ext_real(char *name, double *val);
 int filp_ext_string(char *name, char *val, int size);
 int filp_ext_file(char *name, FILE * f);
+int filp_bind_value(char *name, struct filp_val *v);
+int filp_bind_int(char *name, int value);
+int filp_bind_real(char *name, double value);
+int filp_bind_string(char *name, char *value);
 
 int filp_push_dict(char *mask);
 
@@ -150,6 +241,8 @@ extern FILE *(*filp_external_fopen) (char *filename, char *mode);
 FILE *filp_fopen(char *filename, char *mode);
 char *filp_load_file(char *filename);
 int filp_list_size(void);
+void filp_list_reverse(void);
+void filp_list_drop(void);
 
 struct filp_val **filp_array_dim(int asize);
 void filp_array_destroy(struct filp_val *array);
@@ -158,36 +251,99 @@ int filp_array_size(struct filp_val *array);
 struct filp_val *filp_array_get(struct filp_val *a, int e);
 struct filp_val *filp_array_set(struct filp_val *a, struct filp_val *v, int e);
 struct filp_val *filp_array_dup(struct filp_val *a);
+struct filp_val *filp_array_slice(struct filp_val *a, int offset, int num);
 struct filp_val *filp_array_del(struct filp_val *array, int e);
 int filp_array_seek(struct filp_val *array, char *str, int inc);
 int filp_array_binary_seek(struct filp_val *a, char *str, int inc);
 void filp_array_sort(struct filp_val *value, int inc);
+void filp_array_nsort(struct filp_val *value, int inc);
+void filp_array_sort_by(struct filp_val *value, struct filp_val *keys);
+
+struct filp_val *filp_new_vector(int kind, void *data, int num);
+void *filp_vector_data(struct filp_val *v, int *kind, int *num);
+int filp_vector_size(struct filp_val *v);
+struct filp_val *filp_vector_get(struct filp_val *v, int i);
+int filp_vector_set(struct filp_val *v, struct filp_val *e, int i);
+void filp_vector_destroy(void *vector);
+int filp_simd_level(void);
+char *filp_memmem(char *h, int hl, char *n, int nl);
+int filp_memcspn(char *s, int l, char *set, int nset);
+int filp_memspn(char *s, int l, char *set, int nset);
+struct filp_val *filp_vector_op(int op, struct filp_val *a, struct filp_val *b);
+double filp_vector_dot(struct filp_val *a, struct filp_val *b);
+struct filp_val *filp_vector_reduce(int op, struct filp_val *v);
 
 struct filp_val *filp_new_hash(int slots);
 struct filp_val *filp_hash_get(struct filp_val *h, char *key);
 struct filp_val *filp_hash_set(struct filp_val *h, char *key, struct filp_val *value);
+struct filp_val *filp_hash_set_value(struct filp_val *h, struct filp_val *k,
+                                     char *key, struct filp_val *value);
 struct filp_val *filp_hash_del(struct filp_val *h, char *key);
 int filp_hash_size(struct filp_val *h);
 int filp_hash_get_pair(struct filp_val *h, int i,
                struct filp_val **key, struct filp_val **value);
 
+struct filp_val *filp_new_omap(void);
+int filp_omap_size(struct filp_val *v);
+struct filp_val *filp_omap_get(struct filp_val *v, char *key);
+struct filp_val *filp_omap_set(struct filp_val *v, char *key, struct filp_val *value);
+struct filp_val *filp_omap_del(struct filp_val *v, char *key);
+struct filp_val *filp_omap_floor(struct filp_val *v, char *key);
+struct filp_val *filp_omap_ceil(struct filp_val *v, char *key);
+int filp_omap_range(struct filp_val *v, char *from, char *to,
+                    int (*func) (struct filp_val *, struct filp_val *, void *),
+                    void *arg);
+void filp_omap_destroy(void *omap);
+
 void filp_push_symbol_value(char *symbol);
+struct filp_prog *filp_compile(const char *code);
+int filp_run(struct filp_prog *p);
+void filp_prog_ref(struct filp_prog *p);
+void filp_prog_unref(struct filp_prog *p);
 int filp_exec(char *code);
 int filp_execf(char *code, ...);
+int filp_callv(char *word, char *fmt, ...);
 int filp_execv(struct filp_val *v);
 int filp_load_exec(char *filename);
 char *filp_dumper(struct filp_val *v, int max);
 int filp_array_to_doubles(struct filp_val *v, double *d, int max);
 struct filp_val *filp_doubles_to_array(double *d, int num);
+char *filp_marshal(struct filp_val *v, char *ptr, int *size, int *offset);
+struct filp_val *filp_unmarshal(char *ptr, int size, int *offset);
+void filp_marshal_free(char *ptr, int size);
+char *filp_freeze(struct filp_val *v, int *len);
+struct filp_val *filp_thaw(char *ptr, int len);
+char *filp_json_encode(struct filp_val *v, int *len);
+struct filp_val *filp_json_decode(char *str, int len, int *err);
 
 char *filp_readline(char *prompt);
 void filp_console(void);
+int filp_sscanf(struct filp_val *fmt, char *str, int len);
 
 int filp_sweep_head(void);
 void filp_sweeper(int full);
 
+struct filp_val *filp_array_pop(int *imm, int create);
+
+int filp_pool_start(int num);
+int filp_pool_submit(void (*func) (void *), void *arg);
+int filp_pool_workers(void);
+int filp_pool_run(void (*func) (void *, int), void *arg, int num);
+char *filp_dict_snapshot(int *size);
+void filp_task_unref(void *task);
+int filp_task_join(struct filp_val *c);
+void *filp_channel_new(int capacity);
+void filp_channel_ref(void *channel);
+void filp_channel_unref(void *channel);
+int filp_channel_send(void *channel, char *data, int size);
+char *filp_channel_recv(void *channel, int *size);
+void filp_gen_destroy(void *gen);
+int filp_gen_next(struct filp_val *v);
+void filp_dict_install(char *ptr, int size);
+
 void filp_lib_startup(void);
 void filp_slib_startup(void);
+void filp_thread_startup(void);
 
 int filp_startup(void);
 void filp_shutdown(void);
@@ -21,6 +21,18 @@
 
 /* arrays */
 
+/* Arrays can share their storage: a view is a FILP_ARRAY value
+   whose cache field points to a hidden FILP_ARRAY value (the base)
+   owning the elements, its array and size fields addressing a slice
+   of them. Views are created by filp_array_slice() and, for not
+   too small arrays, by filp_array_dup(); they are copied
+   (or take the base storage, if unshared) before being modified. */
+
+/* arrays smaller than this are duplicated by copying them */
+#define FILP_ARRAY_COW_MIN 16
+
+#define _filp_array_is_view(v) ((v)->cache != NULL)
+
 /**
  * filp_array_dim - Gives dimension to an array.
  * @asize: the new size of the array
@@ -41,6 +53,68 @@ struct filp_val **filp_array_dim(int asize)
 }
 
 
+static void _filp_array_own(struct filp_val *v)
+/* gives private storage to a view, so it can be modified */
+{
+    struct filp_val *b;
+    struct filp_val **a;
+    int n;
+
+    if (!_filp_array_is_view(v))
+        return;
+
+    b = (struct filp_val *) v->cache;
+
+    if (b->count == 1 && v->array == b->array && v->size == b->size) {
+        /* the only view of all the base: take its storage */
+        a = b->array;
+        b->array = NULL;
+        b->size = 0;
+    }
+    else {
+        a = filp_array_dim(v->size);
+
+        for (n = 0; n < v->size; n++) {
+            if ((a[n] = v->array[n]) != NULL)
+                filp_ref_value(a[n]);
+        }
+    }
+
+    v->array = a;
+    v->cache = NULL;
+
+    filp_unref_value(b);
+}
+
+
+static struct filp_val *_filp_array_view(struct filp_val *v, int offset, int num)
+/* creates a view of num elements of v, starting at offset (from 0) */
+{
+    struct filp_val *b;
+    struct filp_val *r;
+
+    if (_filp_array_is_view(v))
+        b = (struct filp_val *) v->cache;
+    else {
+        /* move the storage to a new base, and make v a view of it */
+        b = filp_new_value(FILP_ARRAY, NULL, 0);
+        b->array = v->array;
+        b->size = v->size;
+
+        v->cache = b;
+        filp_ref_value(b);
+    }
+
+    r = filp_new_value(FILP_ARRAY, NULL, 0);
+    r->array = v->array + offset;
+    r->size = num;
+    r->cache = b;
+    filp_ref_value(b);
+
+    return r;
+}
+
+
 /**
  * filp_array_expand - Inserts room in an array.
  * @a: the array
@@ -58,6 +132,8 @@ void filp_array_expand(struct filp_val *a, int offset, int num)
     if (offset < 0)
         return;
 
+    _filp_array_own(a);
+
     /* offset 0: the end of the array */
     if (offset == 0)
         offset = a->size;
@@ -100,6 +176,8 @@ void filp_array_collapse(struct filp_val *a, int offset, int num)
     if (offset + num > a->size)
         num = a->size - offset;
 
+    _filp_array_own(a);
+
     /* array is shorter */
     a->size -= num;
 
@@ -152,6 +230,8 @@ struct filp_val *filp_array_set(struct filp_val *value, struct filp_val *e, int
     if (i < 0 || i >= value->size)
         return NULL;
 
+    _filp_array_own(value);
+
     v = value->array[i];
     value->array[i] = e;
 
@@ -174,6 +254,15 @@ void filp_array_destroy(struct filp_val *value)
 {
     int n;
 
+    /* a view only drops its base */
+    if (_filp_array_is_view(value)) {
+        filp_unref_value((struct filp_val *) value->cache);
+        value->cache = NULL;
+        value->array = NULL;
+        value->size = 0;
+        return;
+    }
+
     /* sets all elements to NULL (unreferencing them) */
     for (n = 1; n <= filp_array_size(value); n++)
         filp_array_set(value, NULL, n);
@@ -227,24 +316,60 @@ void filp_array_ins(struct filp_val *value, struct filp_val *e, int i)
  * @value: the array
  *
  * Duplicates the @value array. A new value containing the
- * same elements is returned.
+ * same elements is returned. Unless the array is small, the
+ * elements are not copied but shared until any of them
+ * is modified.
  */
 struct filp_val *filp_array_dup(struct filp_val *value)
 {
     int n;
     struct filp_val *v;
 
-    /* creates a new array with the same size */
-    v = filp_new_value(FILP_ARRAY, NULL, value->size);
+    if (value->size >= FILP_ARRAY_COW_MIN || _filp_array_is_view(value))
+        v = _filp_array_view(value, 0, value->size);
+    else {
+        /* creates a new array with the same size */
+        v = filp_new_value(FILP_ARRAY, NULL, value->size);
 
-    /* copies the elements */
-    for (n = 1; n <= filp_array_size(value); n++)
-        filp_array_set(v, filp_array_get(value, n), n);
+        /* copies the elements */
+        for (n = 1; n <= filp_array_size(value); n++)
+            filp_array_set(v, filp_array_get(value, n), n);
+    }
+
+    v->hash = value->hash;
 
     return v;
 }
 
 
+/**
+ * filp_array_slice - Creates a slice of an array.
+ * @value: the array
+ * @offset: subscript of the first element
+ * @num: number of elements
+ *
+ * Returns a new array containing @num elements of @value, starting
+ * from the @offset subscript. The elements are not copied; both
+ * arrays share them until any of them is modified. The range is
+ * clipped to the bounds of @value.
+ */
+struct filp_val *filp_array_slice(struct filp_val *value, int offset, int num)
+{
+    offset--;
+
+    if (offset < 0)
+        offset = 0;
+    if (offset > value->size)
+        offset = value->size;
+    if (num < 0)
+        num = 0;
+    if (num > value->size - offset)
+        num = value->size - offset;
+
+    return _filp_array_view(value, offset, num);
+}
+
+
 /**
  * filp_array_del - Deletes an element of an array.
  * @value: the value
@@ -341,9 +466,273 @@ int filp_array_binary_seek(struct filp_val *a, char *str, int inc)
 }
 
 
-static int _filp_sort_cmp(const void *s1, const void *s2)
+/* sorting: the elements (or groups of @inc elements) are not moved
+   while sorting, but a permutation of their indexes, using a stable
+   merge sort, or a radix sort for big sets of numeric keys. Big sets
+   are split in runs that are sorted and then merged by the worker
+   threads; as the sort is stable, the result is the same. */
+
+/* numeric sets bigger than this are radix sorted */
+#define FILP_SORT_RADIX_MIN 256
+
+/* sets bigger than this are sorted in parallel */
+#define FILP_SORT_PARALLEL_MIN 65536
+
+#if defined(_MSC_VER) || defined(__BORLANDC__)
+typedef unsigned __int64 _filp_u64;
+#else
+typedef unsigned long long _filp_u64;
+#endif
+
+struct _filp_sort {
+    _filp_u64 *num;             /* numeric keys (or NULL) */
+    struct filp_val **key;      /* string keys */
+    int *idx;                   /* the permutation */
+    int *tmp;                   /* scratch space */
+    int *run;                   /* start of each run, for parallel sorts */
+    int width;                  /* runs already merged together */
+};
+
+
+static _filp_u64 _filp_sort_u64(double d)
+/* maps a double to an unsigned integer with the same order */
+{
+    _filp_u64 k;
+
+    if (d == 0)
+        d = 0;                  /* -0 == +0 */
+
+    memcpy(&k, &d, sizeof(d));
+
+    if (k >> 63)
+        return ~k;
+
+    return k | (_filp_u64) 1 << 63;
+}
+
+
+static int _filp_sort_cmp(struct _filp_sort *s, int a, int b)
+{
+    if (s->num != NULL)
+        return (s->num[a] > s->num[b]) - (s->num[a] < s->num[b]);
+
+    return filp_cmp(s->key[a], s->key[b]);
+}
+
+
+static void _filp_merge(struct _filp_sort *s, int *idx, int *tmp, int m, int n)
+/* merges the sorted idx[0..m) and idx[m..n), using tmp as scratch */
+{
+    int i, j, k;
+
+    if (m == 0 || m == n || _filp_sort_cmp(s, idx[m - 1], idx[m]) <= 0)
+        return;
+
+    memcpy(tmp, idx, m * sizeof(int));
+
+    for (i = 0, j = m, k = 0; i < m && j < n; k++) {
+        if (_filp_sort_cmp(s, idx[j], tmp[i]) < 0)
+            idx[k] = idx[j++];
+        else
+            idx[k] = tmp[i++];
+    }
+
+    while (i < m)
+        idx[k++] = tmp[i++];
+}
+
+
+static void _filp_merge_sort(struct _filp_sort *s, int *idx, int *tmp, int n)
+/* sorts the n indexes in idx, using tmp as scratch */
+{
+    int i, j, k;
+
+    if (n <= 16) {
+        /* insertion sort */
+        for (i = 1; i < n; i++) {
+            k = idx[i];
+
+            for (j = i; j > 0 && _filp_sort_cmp(s, idx[j - 1], k) > 0; j--)
+                idx[j] = idx[j - 1];
+
+            idx[j] = k;
+        }
+
+        return;
+    }
+
+    _filp_merge_sort(s, idx, tmp, n / 2);
+    _filp_merge_sort(s, idx + n / 2, tmp, n - n / 2);
+    _filp_merge(s, idx, tmp, n / 2, n);
+}
+
+
+static int _filp_radix_sort(_filp_u64 *num, int *idx, int *tmp, int n)
+/* sorts the n indexes in idx by their numeric keys */
+{
+    _filp_u64 *k;
+    _filp_u64 *kt;
+    _filp_u64 *kx;
+    _filp_u64 *base;
+    int count[256];
+    int i, b, p, t;
+
+    if ((k = (_filp_u64 *) malloc(n * 2 * sizeof(_filp_u64))) == NULL)
+        return 0;
+
+    base = k;
+    kt = k + n;
+
+    for (i = 0; i < n; i++)
+        k[i] = num[idx[i]];
+
+    for (b = 0; b < 64; b += 8) {
+        memset(count, '\0', sizeof(count));
+
+        for (i = 0; i < n; i++)
+            count[(k[i] >> b) & 0xff]++;
+
+        /* all in the same bucket? nothing to do */
+        if (count[(k[0] >> b) & 0xff] == n)
+            continue;
+
+        for (i = p = 0; i < 256; i++) {
+            t = count[i];
+            count[i] = p;
+            p += t;
+        }
+
+        for (i = 0; i < n; i++) {
+            p = count[(k[i] >> b) & 0xff]++;
+            kt[p] = k[i];
+            tmp[p] = idx[i];
+        }
+
+        memcpy(idx, tmp, n * sizeof(int));
+
+        kx = k;
+        k = kt;
+        kt = kx;
+    }
+
+    free(base);
+
+    return 1;
+}
+
+
+static void _filp_sort_range(struct _filp_sort *s, int o, int n)
+/* sorts the n indexes starting at offset o */
+{
+    if (s->num == NULL || n < FILP_SORT_RADIX_MIN ||
+        !_filp_radix_sort(s->num, s->idx + o, s->tmp + o, n))
+        _filp_merge_sort(s, s->idx + o, s->tmp + o, n);
+}
+
+
+static void _filp_psort_run(void *arg, int i)
+/* parallel sort: sorts run i */
+{
+    struct _filp_sort *s = (struct _filp_sort *) arg;
+
+    _filp_sort_range(s, s->run[i], s->run[i + 1] - s->run[i]);
+}
+
+
+static void _filp_psort_merge(void *arg, int i)
+/* parallel sort: merges the i-th pair of groups of s->width runs */
+{
+    struct _filp_sort *s = (struct _filp_sort *) arg;
+    int o, m, n;
+
+    o = s->run[i * 2 * s->width];
+    m = s->run[(i * 2 + 1) * s->width];
+    n = s->run[(i * 2 + 2) * s->width];
+
+    _filp_merge(s, s->idx + o, s->tmp + o, m - o, n - o);
+}
+
+
+static void _filp_sort(struct _filp_sort *s, int n)
+/* sorts the n indexes, in parallel if they are many */
+{
+    int i, w, runs;
+
+    w = n < FILP_SORT_PARALLEL_MIN ? 0 : filp_pool_workers();
+
+    if (w < 2 || (s->run = (int *) malloc((w * 2 + 1) * sizeof(int))) == NULL) {
+        _filp_sort_range(s, 0, n);
+        return;
+    }
+
+    /* the number of runs is rounded up to a power of 2, so
+       they can be merged by pairs; extra ones are empty */
+    for (runs = 1; runs < w; runs *= 2);
+
+    for (i = 0; i <= runs; i++)
+        s->run[i] = (int) ((double) n * (i < w ? i : w) / w);
+
+    if (!filp_pool_run(_filp_psort_run, s, runs)) {
+        _filp_sort_range(s, 0, n);
+        free(s->run);
+        return;
+    }
+
+    for (s->width = 1; s->width < runs; s->width *= 2)
+        filp_pool_run(_filp_psort_merge, s, runs / (s->width * 2));
+
+    free(s->run);
+}
+
+
+static void _filp_array_sort_keys(struct filp_val *value, int inc,
+                                  _filp_u64 *num, struct filp_val **key)
+/* sorts the groups of inc elements of the array by their keys */
+{
+    struct _filp_sort s;
+    struct filp_val **na;
+    int i, n;
+
+    n = value->size / inc;
+
+    if ((s.idx = (int *) malloc(n * 2 * sizeof(int))) == NULL)
+        return;
+
+    for (i = 0; i < n; i++)
+        s.idx[i] = i;
+
+    s.tmp = s.idx + n;
+    s.num = num;
+    s.key = key;
+
+    _filp_sort(&s, n);
+
+    if ((na = filp_array_dim(value->size)) != NULL) {
+        _filp_array_own(value);
+
+        for (i = 0; i < n; i++)
+            memcpy(&na[i * inc], &value->array[s.idx[i] * inc],
+                   inc * sizeof(struct filp_val *));
+
+        /* the elements not filling a group stay at the end */
+        for (i = n * inc; i < value->size; i++)
+            na[i] = value->array[i];
+
+        free(value->array);
+        value->array = na;
+    }
+
+    free(s.idx);
+}
+
+
+static _filp_u64 _filp_sort_num(struct filp_val *v)
+/* numeric sorting key of a value */
 {
-    return filp_cmp(*(struct filp_val **) s1, *(struct filp_val **) s2);
+    if (v == NULL || v->type != FILP_SCALAR)
+        return _filp_sort_u64(0);
+
+    return _filp_sort_u64(strtod(v->value, NULL));
 }
 
 
@@ -353,142 +742,447 @@ static int _filp_sort_cmp(const void *s1, const void *s2)
  * @inc: increment
  *
  * Sorts alphabetically the elements of the array. If @inc is greater than 1,
- * the elements are ordered in groups of that quantity.
+ * the elements are ordered in groups of that quantity, by the first one.
+ * The sort is stable.
  */
 void filp_array_sort(struct filp_val *value, int inc)
 {
-    if (inc == 0)
+    struct filp_val **key;
+    int n;
+
+    if (inc <= 0 || value->size < 2)
         return;
 
-    qsort(value->array, value->size / inc,
-          sizeof(struct filp_val *) * inc, _filp_sort_cmp);
-}
+    if ((key = (struct filp_val **) malloc((value->size / inc + 1) *
+                                           sizeof(struct filp_val *))) == NULL)
+        return;
 
+    for (n = 0; n < value->size / inc; n++)
+        key[n] = value->array[n * inc];
 
+    _filp_array_sort_keys(value, inc, NULL, key);
 
-/* hashes */
+    free(key);
+}
 
 
 /**
- * filp_new_hash - Creates a new hash.
- * @buckets: number of buckets in the hash
+ * filp_array_nsort - Sorts an array numerically.
+ * @value: the value
+ * @inc: increment
  *
- * Creates a new hash. A filp hash is, internally, a filp array of @buckets arrays.
+ * Sorts numerically the elements of the array, as filp_array_sort()
+ * does alphabetically. Each element is converted to a number only
+ * once; non-numeric ones are taken as 0. The sort is stable.
  */
-struct filp_val *filp_new_hash(int buckets)
+void filp_array_nsort(struct filp_val *value, int inc)
 {
-    struct filp_val *h;
+    _filp_u64 *num;
     int n;
 
-    h = filp_new_value(FILP_ARRAY, NULL, buckets);
+    if (inc <= 0 || value->size < 2)
+        return;
 
-    for (n = 1; n <= buckets; n++)
-        filp_array_set(h, filp_new_value(FILP_ARRAY, NULL, 0), n);
+    if ((num = (_filp_u64 *) malloc((value->size / inc + 1) * sizeof(_filp_u64))) == NULL)
+        return;
 
-    return h;
+    for (n = 0; n < value->size / inc; n++)
+        num[n] = _filp_sort_num(value->array[n * inc]);
+
+    _filp_array_sort_keys(value, inc, num, NULL);
+
+    free(num);
 }
 
 
 /**
- * filp_hash_size - Returns the number of pairs of a hash.
- * @h: the hash
+ * filp_array_sort_by - Sorts an array by a set of keys.
+ * @value: the value
+ * @keys: an array with the sorting key of each element
  *
- * Returns the number of key-value pairs stored in the hash.
+ * Sorts the elements of the array by the values in the same
+ * subscripts of the @keys array. If all keys are numbers, they
+ * are compared numerically; otherwise, alphabetically. The sort
+ * is stable. @keys is not changed.
  */
-int filp_hash_size(struct filp_val *h)
+void filp_array_sort_by(struct filp_val *value, struct filp_val *keys)
 {
-    int n, s;
-    struct filp_val *v;
+    struct filp_val *k;
+    _filp_u64 *num;
+    double d;
+    char *p;
+    int n;
 
-    for (s = 0, n = 1; n <= filp_array_size(h); n++) {
-        if ((v = filp_array_get(h, n)) != NULL)
-            s += filp_array_size(v);
+    if (value->size < 2 || keys->size < value->size)
+        return;
+
+    if ((num = (_filp_u64 *) malloc(value->size * sizeof(_filp_u64))) == NULL)
+        return;
+
+    for (n = 0; n < value->size; n++) {
+        if ((k = keys->array[n]) == NULL || k->type != FILP_SCALAR)
+            break;
+
+        d = strtod(k->value, &p);
+
+        if (p == k->value || *p != '\0')
+            break;
+
+        num[n] = _filp_sort_u64(d);
     }
 
-    return s / 2;
+    if (n == value->size)
+        _filp_array_sort_keys(value, 1, num, NULL);
+    else
+        _filp_array_sort_keys(value, 1, NULL, keys->array);
+
+    free(num);
 }
 
 
-#define HASH_BUCKET(h, key) (filp_hashfunc((unsigned char *)key, filp_array_size(h)) + 1)
+
+/* numeric vectors */
+
+struct filp_vector {
+    int kind;                   /* FILP_VEC_* */
+    int num;                    /* number of elements */
+    void *data;                 /* the elements */
+    int owned;                  /* 1 if data must be freed with the vector */
+};
+
 
 /**
- * filp_hash_get - Gets an element from a hash.
- * @h: the hash
- * @key: the key which value is wanted
+ * filp_new_vector - Creates a numeric vector.
+ * @kind: type of the elements (FILP_VEC_REAL or FILP_VEC_INT)
+ * @data: the elements (can be NULL)
+ * @num: number of elements
  *
- * Returns the value associated with @key form the hash @h, or NULL
- * if no one exists.
+ * Creates a new FILP_VECTOR value wrapping @num elements of type
+ * double (if @kind is FILP_VEC_REAL) or filp_int64 (if @kind is
+ * FILP_VEC_INT) stored in @data. The elements are not copied, so
+ * changes made from C are seen from filp code and vice versa; @data
+ * belongs to the caller and must be valid while the vector is
+ * in use. If @data is NULL, a zero-filled block is allocated and
+ * freed when the vector is destroyed. Unlike arrays, vectors are
+ * not duplicated when pushed to the stack.
+ * Returns the new value, or NULL if out of memory.
  */
-struct filp_val *filp_hash_get(struct filp_val *h, char *key)
+struct filp_val *filp_new_vector(int kind, void *data, int num)
 {
-    int e;
-    struct filp_val *v;
+    struct filp_vector *vec;
 
-    /* takes the bucket */
-    e = HASH_BUCKET(h, key);
-    v = filp_array_get(h, e);
+    if (num < 0)
+        num = 0;
 
-    /* seeks in the bucket */
-    if ((e = filp_array_binary_seek(v, key, 2)) > 0)
-        v = filp_array_get(v, e + 1);
-    else
-        v = NULL;
+    if ((vec = (struct filp_vector *) malloc(sizeof(struct filp_vector))) == NULL)
+        return NULL;
 
-    return v;
+    vec->kind = kind;
+    vec->num = num;
+    vec->data = data;
+    vec->owned = 0;
+
+    if (data == NULL) {
+        /* both element types have the same size */
+        if ((vec->data = calloc(num ? num : 1, sizeof(double))) == NULL) {
+            free(vec);
+            return NULL;
+        }
+
+        vec->owned = 1;
+    }
+
+    return filp_new_value(FILP_VECTOR, vec, num);
 }
 
 
 /**
- * filp_hash_set - Stores a key-value pair into a hash.
- * @h: the hash
- * @key: the key
- * @value: the value
+ * filp_vector_data - Gets the elements of a numeric vector.
+ * @v: the vector
+ * @kind: pointer to store the type of the elements (can be NULL)
+ * @num: pointer to store the number of elements (can be NULL)
  *
- * Stores a key-value pair into the hash. Returns the previously
- * stored value under that key if one exists, or NULL otherwise.
+ * Returns a pointer to the elements of the @v vector, that can
+ * be read and written directly. Returns NULL if @v is not a vector.
  */
-struct filp_val *filp_hash_set(struct filp_val *h, char *key, struct filp_val *value)
+void *filp_vector_data(struct filp_val *v, int *kind, int *num)
 {
-    int e;
-    struct filp_val *s;
-    struct filp_val *v;
+    struct filp_vector *vec;
 
-    /* takes the bucket */
-    e = HASH_BUCKET(h, key);
-    s = filp_array_get(h, e);
+    if (v == NULL || v->type != FILP_VECTOR)
+        return NULL;
 
-    /* seeks in the bucket */
-    if ((e = filp_array_binary_seek(s, key, 2)) < 0) {
-        e *= -1;
-        filp_array_expand(s, e, 2);
-        filp_array_set(s, filp_new_value(FILP_SCALAR, key, -1), e);
-    }
+    vec = (struct filp_vector *) v->value;
 
-    v = filp_array_set(s, value, e + 1);
-    return v;
+    if (kind != NULL)
+        *kind = vec->kind;
+    if (num != NULL)
+        *num = vec->num;
+
+    return vec->data;
 }
 
 
 /**
- * filp_hash_del - Deletes a key-value pair from a hash.
- * @h: the hash
- * @key: the key
+ * filp_vector_size - Gets the size of a numeric vector.
+ * @v: the vector
  *
- * Deletes a key-value pair from the hash given its @key. If the
- * pair exists, the value is returned, or NULL otherwise.
+ * Returns the number of elements of the @v vector.
  */
-struct filp_val *filp_hash_del(struct filp_val *h, char *key)
+int filp_vector_size(struct filp_val *v)
 {
-    int e;
-    struct filp_val *s;
-    struct filp_val *v = NULL;
+    return ((struct filp_vector *) v->value)->num;
+}
+
+
+/**
+ * filp_vector_get - Gets an element of a numeric vector.
+ * @v: the vector
+ * @i: the subscript of the element
+ *
+ * Returns a new scalar value holding the element number @i
+ * of the @v vector, or NULL if @i is out of range.
+ */
+struct filp_val *filp_vector_get(struct filp_val *v, int i)
+{
+    struct filp_vector *vec = (struct filp_vector *) v->value;
+
+    if (--i < 0 || i >= vec->num)
+        return NULL;
+
+    if (vec->kind == FILP_VEC_INT)
+        return filp_new_int64_value(((filp_int64 *) vec->data)[i]);
+
+    return filp_new_real_value(((double *) vec->data)[i]);
+}
+
+
+/**
+ * filp_vector_set - Sets an element of a numeric vector.
+ * @v: the vector
+ * @e: the value to be assigned
+ * @i: the subscript of the element
+ *
+ * Converts @e to a number and stores it as the element @i of
+ * the @v vector. If @i is 0, the element set is the last one.
+ * Returns 0 if @i is out of range.
+ */
+int filp_vector_set(struct filp_val *v, struct filp_val *e, int i)
+{
+    struct filp_vector *vec = (struct filp_vector *) v->value;
+    char *ptr;
+
+    if (i == 0)
+        i = vec->num;
+
+    if (--i < 0 || i >= vec->num)
+        return 0;
+
+    ptr = e != NULL && e->type == FILP_SCALAR ? e->value : "0";
+
+    if (vec->kind == FILP_VEC_INT)
+        ((filp_int64 *) vec->data)[i] = strtoll(ptr, NULL, 0);
+    else
+        ((double *) vec->data)[i] = strtod(ptr, NULL);
+
+    return 1;
+}
+
+
+/**
+ * filp_vector_destroy - Destroys a numeric vector.
+ * @vector: the vector
+ *
+ * Frees a vector and, if it was allocated by filp_new_vector(),
+ * its elements. It's called by the garbage collector when a
+ * FILP_VECTOR value is destroyed.
+ */
+void filp_vector_destroy(void *vector)
+{
+    struct filp_vector *vec = (struct filp_vector *) vector;
+
+    if (vec->owned)
+        free(vec->data);
+
+    free(vec);
+}
+
+
+
+/* hashes */
+
+
+/**
+ * filp_new_hash - Creates a new hash.
+ * @buckets: number of buckets in the hash
+ *
+ * Creates a new hash. A filp hash is, internally, a filp array of @buckets arrays.
+ */
+struct filp_val *filp_new_hash(int buckets)
+{
+    struct filp_val *h;
+    int n;
+
+    h = filp_new_value(FILP_ARRAY, NULL, buckets);
+    h->hash = 1;
+
+    for (n = 1; n <= buckets; n++)
+        filp_array_set(h, filp_new_value(FILP_ARRAY, NULL, 0), n);
+
+    return h;
+}
+
+
+/**
+ * filp_hash_size - Returns the number of pairs of a hash.
+ * @h: the hash
+ *
+ * Returns the number of key-value pairs stored in the hash.
+ */
+int filp_hash_size(struct filp_val *h)
+{
+    int n, s;
+    struct filp_val *v;
+
+    for (s = 0, n = 1; n <= filp_array_size(h); n++) {
+        if ((v = filp_array_get(h, n)) != NULL)
+            s += filp_array_size(v);
+    }
+
+    return s / 2;
+}
+
+
+#define HASH_BUCKET(h, key) (filp_hashfunc((unsigned char *)key, filp_array_size(h)) + 1)
+
+static int _filp_hash_seek(struct filp_val *b, char *key)
+/* like filp_array_binary_seek(b, key, 2), but without allocating
+   a value for the key; interned keys are matched by pointer */
+{
+    int l, t, n, c;
+    struct filp_val *k;
+
+    l = n = 0;
+    t = (filp_array_size(b) - 1) / 2;
+
+    while (t >= l) {
+        n = (l + t) / 2;
+        if ((k = filp_array_get(b, (n * 2) + 1)) == NULL)
+            break;
+
+        c = k->value == key ? 0 : strcmp(key, k->value);
+
+        if (c == 0)
+            return (n * 2) + 1;
+        else if (c < 0)
+            t = n - 1;
+        else
+            l = n + 1;
+    }
+
+    return -((l * 2) + 1);
+}
+
+/**
+ * filp_hash_get - Gets an element from a hash.
+ * @h: the hash
+ * @key: the key which value is wanted
+ *
+ * Returns the value associated with @key form the hash @h, or NULL
+ * if no one exists.
+ */
+struct filp_val *filp_hash_get(struct filp_val *h, char *key)
+{
+    int e;
+    struct filp_val *v;
+
+    /* takes the bucket */
+    e = HASH_BUCKET(h, key);
+    v = filp_array_get(h, e);
+
+    /* seeks in the bucket */
+    if ((e = _filp_hash_seek(v, key)) > 0)
+        v = filp_array_get(v, e + 1);
+    else
+        v = NULL;
+
+    return v;
+}
+
+
+/**
+ * filp_hash_set - Stores a key-value pair into a hash.
+ * @h: the hash
+ * @key: the key
+ * @value: the value
+ *
+ * Stores a key-value pair into the hash. Returns the previously
+ * stored value under that key if one exists, or NULL otherwise.
+ */
+struct filp_val *filp_hash_set(struct filp_val *h, char *key, struct filp_val *value)
+{
+    return filp_hash_set_value(h, NULL, key, value);
+}
+
+
+/**
+ * filp_hash_set_value - Stores a key-value pair, reusing the key.
+ * @h: the hash
+ * @k: the key, as a scalar value (can be NULL)
+ * @key: the key, if @k is NULL
+ * @value: the value
+ *
+ * As filp_hash_set(), but if the key is new and @k is given,
+ * @k itself is stored as the key instead of a new interned
+ * value, so it must not be modified afterwards. Loaders that
+ * already create their keys as values use it.
+ */
+struct filp_val *filp_hash_set_value(struct filp_val *h, struct filp_val *k,
+                                     char *key, struct filp_val *value)
+{
+    int e;
+    struct filp_val *s;
+    struct filp_val *v;
+
+    if (k != NULL)
+        key = k->value;
 
     /* takes the bucket */
     e = HASH_BUCKET(h, key);
     s = filp_array_get(h, e);
 
     /* seeks in the bucket */
-    if ((e = filp_array_binary_seek(s, key, 2)) > 0) {
+    if ((e = _filp_hash_seek(s, key)) < 0) {
+        e *= -1;
+        filp_array_expand(s, e, 2);
+        filp_array_set(s, k != NULL ? k : filp_new_interned_value(key), e);
+    }
+
+    v = filp_array_set(s, value, e + 1);
+    return v;
+}
+
+
+/**
+ * filp_hash_del - Deletes a key-value pair from a hash.
+ * @h: the hash
+ * @key: the key
+ *
+ * Deletes a key-value pair from the hash given its @key. If the
+ * pair exists, the value is returned, or NULL otherwise.
+ */
+struct filp_val *filp_hash_del(struct filp_val *h, char *key)
+{
+    int e;
+    struct filp_val *s;
+    struct filp_val *v = NULL;
+
+    /* takes the bucket */
+    e = HASH_BUCKET(h, key);
+    s = filp_array_get(h, e);
+
+    /* seeks in the bucket */
+    if ((e = _filp_hash_seek(s, key)) > 0) {
         /* sets key and value to NULL */
         filp_array_set(s, NULL, e);
         v = filp_array_set(s, NULL, e + 1);
@@ -538,3 +1232,566 @@ int filp_hash_get_pair(struct filp_val *h, int i,
 
     return 0;
 }
+
+
+/* ordered maps */
+
+/* An ordered map is a B+ tree of string keys. Inner nodes hold
+   separator keys and children; leaves hold the key-value pairs and
+   are chained in both directions, so sorted iteration and range
+   scans just walk them. Nodes are wide, to keep the tree shallow.
+   Deleting frees the nodes left empty and merges underfull ones
+   with a sibling when both fit in one, so the tree does not grow
+   with the number of deletions; only the root leaf can be empty. */
+
+#define FILP_OMAP_ORDER 64      /* maximum number of keys per node */
+
+struct filp_onode {
+    int n;                      /* number of keys */
+    int leaf;                   /* 1 if it's a leaf */
+    struct filp_val *key[FILP_OMAP_ORDER];
+    struct filp_onode *child[FILP_OMAP_ORDER + 1];      /* inner nodes */
+    struct filp_val *val[FILP_OMAP_ORDER];      /* leaves */
+    struct filp_onode *prev;    /* previous leaf */
+    struct filp_onode *next;    /* next leaf */
+};
+
+struct filp_omap {
+    struct filp_onode *root;    /* the tree */
+    int count;                  /* number of pairs */
+};
+
+
+static struct filp_onode *_filp_onode_new(int leaf)
+{
+    struct filp_onode *n;
+
+    if ((n = (struct filp_onode *) calloc(1, sizeof(struct filp_onode))) != NULL)
+        n->leaf = leaf;
+
+    return n;
+}
+
+
+static int _filp_onode_search(struct filp_onode *n, char *key, int *found)
+/* returns the subscript of the first key >= key in the node */
+{
+    int b, t, m, c;
+
+    *found = 0;
+
+    for (b = 0, t = n->n; b < t;) {
+        m = (b + t) / 2;
+
+        if ((c = strcmp(n->key[m]->value, key)) < 0)
+            b = m + 1;
+        else {
+            if (c == 0)
+                *found = 1;
+            t = m;
+        }
+    }
+
+    return b;
+}
+
+
+static struct filp_onode *_filp_omap_leaf(struct filp_omap *m, char *key, int *i, int *found)
+/* finds the leaf where key is (or should be) */
+{
+    struct filp_onode *n = m->root;
+
+    while (!n->leaf) {
+        *i = _filp_onode_search(n, key, found);
+        n = n->child[*i + *found];
+    }
+
+    *i = _filp_onode_search(n, key, found);
+
+    return n;
+}
+
+
+static struct filp_omap *_filp_omap(struct filp_val *v)
+{
+    if (v == NULL || v->type != FILP_OMAP)
+        return NULL;
+
+    return (struct filp_omap *) v->value;
+}
+
+
+/**
+ * filp_new_omap - Creates an ordered map.
+ *
+ * Creates a new, empty FILP_OMAP value, a map of string keys to
+ * values that keeps its keys sorted (alphabetically). Like
+ * numeric vectors, ordered maps are not duplicated when pushed
+ * to the stack. Returns the new value, or NULL if out of memory.
+ */
+struct filp_val *filp_new_omap(void)
+{
+    struct filp_omap *m;
+
+    if ((m = (struct filp_omap *) malloc(sizeof(struct filp_omap))) == NULL)
+        return NULL;
+
+    if ((m->root = _filp_onode_new(1)) == NULL) {
+        free(m);
+        return NULL;
+    }
+
+    m->count = 0;
+
+    return filp_new_value(FILP_OMAP, m, 0);
+}
+
+
+/**
+ * filp_omap_size - Returns the number of pairs of an ordered map.
+ * @v: the ordered map
+ *
+ * Returns the number of key-value pairs stored in the ordered map,
+ * or -1 if @v is not an ordered map.
+ */
+int filp_omap_size(struct filp_val *v)
+{
+    struct filp_omap *m;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return -1;
+
+    return m->count;
+}
+
+
+/**
+ * filp_omap_get - Gets an element from an ordered map.
+ * @v: the ordered map
+ * @key: the key which value is wanted
+ *
+ * Returns the value associated with @key in the ordered map @v,
+ * or NULL if no one exists.
+ */
+struct filp_val *filp_omap_get(struct filp_val *v, char *key)
+{
+    struct filp_omap *m;
+    struct filp_onode *n;
+    int i, found;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return NULL;
+
+    n = _filp_omap_leaf(m, key, &i, &found);
+
+    return found ? n->val[i] : NULL;
+}
+
+
+static struct filp_onode *_filp_onode_split(struct filp_onode *n, struct filp_val **sep)
+/* splits a full node, returning the new right one and its separator */
+{
+    struct filp_onode *r;
+    int h = n->n / 2;
+
+    if ((r = _filp_onode_new(n->leaf)) == NULL)
+        return NULL;
+
+    if (n->leaf) {
+        /* the right half is moved; its first key is copied up */
+        r->n = n->n - h;
+        memcpy(r->key, &n->key[h], r->n * sizeof(struct filp_val *));
+        memcpy(r->val, &n->val[h], r->n * sizeof(struct filp_val *));
+
+        *sep = r->key[0];
+        filp_ref_value(*sep);
+
+        if ((r->next = n->next) != NULL)
+            r->next->prev = r;
+
+        r->prev = n;
+        n->next = r;
+    }
+    else {
+        /* the middle key is moved up */
+        r->n = n->n - h - 1;
+        memcpy(r->key, &n->key[h + 1], r->n * sizeof(struct filp_val *));
+        memcpy(r->child, &n->child[h + 1], (r->n + 1) * sizeof(struct filp_onode *));
+
+        *sep = n->key[h];
+    }
+
+    n->n = h;
+
+    return r;
+}
+
+
+static struct filp_onode *_filp_onode_set(struct filp_omap *m, struct filp_onode *n,
+                                          char *key, struct filp_val *value,
+                                          struct filp_val **sep, struct filp_val **old)
+/* sets key in the subtree of n; returns a new sibling if n was split */
+{
+    struct filp_onode *r;
+    struct filp_val *s;
+    int i, found;
+
+    i = _filp_onode_search(n, key, &found);
+
+    if (n->leaf) {
+        if (found) {
+            *old = n->val[i];
+            n->val[i] = value;
+            filp_ref_value(value);
+
+            if (*old != NULL)
+                filp_unref_value(*old);
+
+            return NULL;
+        }
+
+        memmove(&n->key[i + 1], &n->key[i], (n->n - i) * sizeof(struct filp_val *));
+        memmove(&n->val[i + 1], &n->val[i], (n->n - i) * sizeof(struct filp_val *));
+
+        n->key[i] = filp_new_value(FILP_SCALAR, key, -1);
+        n->val[i] = value;
+        filp_ref_value(n->key[i]);
+        filp_ref_value(value);
+
+        n->n++;
+        m->count++;
+    }
+    else {
+        if ((r = _filp_onode_set(m, n->child[i + found], key, value, &s, old)) == NULL)
+            return NULL;
+
+        /* the child was split */
+        i += found;
+
+        memmove(&n->key[i + 1], &n->key[i], (n->n - i) * sizeof(struct filp_val *));
+        memmove(&n->child[i + 2], &n->child[i + 1],
+                (n->n - i) * sizeof(struct filp_onode *));
+
+        n->key[i] = s;
+        n->child[i + 1] = r;
+        n->n++;
+    }
+
+    return n->n == FILP_OMAP_ORDER ? _filp_onode_split(n, sep) : NULL;
+}
+
+
+/**
+ * filp_omap_set - Stores a key-value pair into an ordered map.
+ * @v: the ordered map
+ * @key: the key
+ * @value: the value
+ *
+ * Stores a key-value pair into the ordered map. Returns the previously
+ * stored value under that key if one exists, or NULL otherwise.
+ */
+struct filp_val *filp_omap_set(struct filp_val *v, char *key, struct filp_val *value)
+{
+    struct filp_omap *m;
+    struct filp_onode *r;
+    struct filp_onode *t;
+    struct filp_val *sep;
+    struct filp_val *old = NULL;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return NULL;
+
+    if ((r = _filp_onode_set(m, m->root, key, value, &sep, &old)) != NULL) {
+        /* the root was split: the tree grows */
+        if ((t = _filp_onode_new(0)) != NULL) {
+            t->n = 1;
+            t->key[0] = sep;
+            t->child[0] = m->root;
+            t->child[1] = r;
+
+            m->root = t;
+        }
+    }
+
+    return old;
+}
+
+
+static int _filp_onode_fits(struct filp_onode *l, struct filp_onode *r)
+/* tests if two sibling nodes can be merged with room to spare */
+{
+    return l->n + r->n + !l->leaf <= FILP_OMAP_ORDER / 2;
+}
+
+
+static void _filp_onode_merge(struct filp_onode *n, int i)
+/* merges the child i + 1 of n into the child i */
+{
+    struct filp_onode *l = n->child[i];
+    struct filp_onode *r = n->child[i + 1];
+
+    if (l->leaf) {
+        memcpy(&l->key[l->n], r->key, r->n * sizeof(struct filp_val *));
+        memcpy(&l->val[l->n], r->val, r->n * sizeof(struct filp_val *));
+        l->n += r->n;
+
+        if ((l->next = r->next) != NULL)
+            l->next->prev = l;
+
+        /* the separator is a copy of a key of r */
+        filp_unref_value(n->key[i]);
+    }
+    else {
+        /* the separator is moved down */
+        l->key[l->n++] = n->key[i];
+
+        memcpy(&l->key[l->n], r->key, r->n * sizeof(struct filp_val *));
+        memcpy(&l->child[l->n], r->child, (r->n + 1) * sizeof(struct filp_onode *));
+        l->n += r->n;
+    }
+
+    free(r);
+
+    n->n--;
+    memmove(&n->key[i], &n->key[i + 1], (n->n - i) * sizeof(struct filp_val *));
+    memmove(&n->child[i + 1], &n->child[i + 2], (n->n - i) * sizeof(struct filp_onode *));
+}
+
+
+static int _filp_onode_del(struct filp_omap *m, struct filp_onode *n,
+                           char *key, struct filp_val **r)
+/* deletes key from the subtree of n; returns 1 if n was left empty */
+{
+    struct filp_onode *c;
+    int i, j, found;
+
+    i = _filp_onode_search(n, key, &found);
+
+    if (n->leaf) {
+        if (!found)
+            return 0;
+
+        *r = n->val[i];
+
+        filp_unref_value(n->key[i]);
+        filp_unref_value(*r);
+
+        n->n--;
+        memmove(&n->key[i], &n->key[i + 1], (n->n - i) * sizeof(struct filp_val *));
+        memmove(&n->val[i], &n->val[i + 1], (n->n - i) * sizeof(struct filp_val *));
+
+        m->count--;
+
+        return n->n == 0;
+    }
+
+    i += found;
+
+    if (_filp_onode_del(m, n->child[i], key, r)) {
+        /* drop the empty child */
+        c = n->child[i];
+
+        if (c->leaf) {
+            if (c->prev != NULL)
+                c->prev->next = c->next;
+            if (c->next != NULL)
+                c->next->prev = c->prev;
+        }
+
+        free(c);
+
+        /* it was the only one */
+        if (n->n == 0)
+            return 1;
+
+        /* and one of the separators beside it */
+        j = i > 0 ? i - 1 : 0;
+        filp_unref_value(n->key[j]);
+
+        n->n--;
+        memmove(&n->key[j], &n->key[j + 1], (n->n - j) * sizeof(struct filp_val *));
+        memmove(&n->child[i], &n->child[i + 1], (n->n + 1 - i) * sizeof(struct filp_onode *));
+    }
+    else
+    if (n->child[i]->n < FILP_OMAP_ORDER / 4) {
+        /* underfull: merge it with a sibling, if they fit */
+        if (i > 0 && _filp_onode_fits(n->child[i - 1], n->child[i]))
+            _filp_onode_merge(n, i - 1);
+        else
+        if (i < n->n && _filp_onode_fits(n->child[i], n->child[i + 1]))
+            _filp_onode_merge(n, i);
+    }
+
+    return 0;
+}
+
+
+/**
+ * filp_omap_del - Deletes a key-value pair from an ordered map.
+ * @v: the ordered map
+ * @key: the key
+ *
+ * Deletes a key-value pair from the ordered map given its @key.
+ * If the pair exists, the value is returned, or NULL otherwise.
+ */
+struct filp_val *filp_omap_del(struct filp_val *v, char *key)
+{
+    struct filp_omap *m;
+    struct filp_onode *n;
+    struct filp_val *r = NULL;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return NULL;
+
+    _filp_onode_del(m, m->root, key, &r);
+
+    /* a root with a single child is not needed: the tree shrinks */
+    while (!m->root->leaf && m->root->n == 0) {
+        n = m->root;
+        m->root = n->child[0];
+        free(n);
+    }
+
+    return r;
+}
+
+
+/**
+ * filp_omap_floor - Finds the greatest key not above another one.
+ * @v: the ordered map
+ * @key: the key
+ *
+ * Returns the greatest key of the ordered map that is less than
+ * or equal to @key, or NULL if there is none.
+ */
+struct filp_val *filp_omap_floor(struct filp_val *v, char *key)
+{
+    struct filp_omap *m;
+    struct filp_onode *n;
+    int i, found;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return NULL;
+
+    n = _filp_omap_leaf(m, key, &i, &found);
+
+    if (found)
+        return n->key[i];
+
+    if (i > 0)
+        return n->key[i - 1];
+
+    /* in the previous leaf */
+    return (n = n->prev) != NULL ? n->key[n->n - 1] : NULL;
+}
+
+
+/**
+ * filp_omap_ceil - Finds the smallest key not below another one.
+ * @v: the ordered map
+ * @key: the key
+ *
+ * Returns the smallest key of the ordered map that is greater than
+ * or equal to @key, or NULL if there is none.
+ */
+struct filp_val *filp_omap_ceil(struct filp_val *v, char *key)
+{
+    struct filp_omap *m;
+    struct filp_onode *n;
+    int i, found;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return NULL;
+
+    n = _filp_omap_leaf(m, key, &i, &found);
+
+    if (i < n->n)
+        return n->key[i];
+
+    /* in the next leaf */
+    return (n = n->next) != NULL ? n->key[0] : NULL;
+}
+
+
+/**
+ * filp_omap_range - Walks a range of an ordered map.
+ * @v: the ordered map
+ * @from: the first key (NULL, from the beginning)
+ * @to: the key where to stop (NULL, up to the end)
+ * @func: function to be called for each pair
+ * @arg: extra argument for @func
+ *
+ * Calls @func for each key-value pair of the ordered map with a
+ * key greater or equal than @from and less than @to, in order.
+ * If @func returns non-zero, the walk stops there. The map must
+ * not be modified from @func.
+ * Returns the number of pairs given to @func.
+ */
+int filp_omap_range(struct filp_val *v, char *from, char *to,
+                    int (*func) (struct filp_val *, struct filp_val *, void *),
+                    void *arg)
+{
+    struct filp_omap *m;
+    struct filp_onode *n;
+    int i, found, c = 0;
+
+    if ((m = _filp_omap(v)) == NULL)
+        return 0;
+
+    if (from != NULL)
+        n = _filp_omap_leaf(m, from, &i, &found);
+    else {
+        for (n = m->root; !n->leaf; n = n->child[0]);
+        i = 0;
+    }
+
+    for (; n != NULL; n = n->next, i = 0) {
+        for (; i < n->n; i++) {
+            if (to != NULL && strcmp(n->key[i]->value, to) >= 0)
+                return c;
+
+            c++;
+
+            if (func(n->key[i], n->val[i], arg))
+                return c;
+        }
+    }
+
+    return c;
+}
+
+
+static void _filp_onode_destroy(struct filp_onode *n)
+{
+    int i;
+
+    for (i = 0; i < n->n; i++) {
+        filp_unref_value(n->key[i]);
+
+        if (n->leaf)
+            filp_unref_value(n->val[i]);
+    }
+
+    if (!n->leaf) {
+        for (i = 0; i <= n->n; i++)
+            _filp_onode_destroy(n->child[i]);
+    }
+
+    free(n);
+}
+
+
+/**
+ * filp_omap_destroy - Destroys an ordered map.
+ * @omap: the ordered map
+ *
+ * Frees an ordered map, releasing its keys and values. It's called
+ * by the garbage collector when a FILP_OMAP value is destroyed.
+ */
+void filp_omap_destroy(void *omap)
+{
+    struct filp_omap *m = (struct filp_omap *) omap;
+
+    _filp_onode_destroy(m->root);
+    free(m);
+}
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "filp.h"
@@ -22,24 +23,27 @@
 ********************/
 
 /* queue of values (needed for the garbage collector) */
-static struct filp_val *_filp_val_head = NULL;
-static struct filp_val *_filp_val_tail = NULL;
+static FILP_TLS struct filp_val *_filp_val_head = NULL;
+static FILP_TLS struct filp_val *_filp_val_tail = NULL;
 
 /**
- * _filp_stack - Pointer to the stack.
+ * _filp_stack - The stack.
  *
- * This variable stores the stack in use.
+ * This variable stores the stack in use, as a contiguous
+ * array of values (the top of stack is the last one) and
+ * the offsets of the FILP_NULL list markers it contains.
+ * The number of elements is kept in _filp_stack_elems.
  */
-static struct filp_stack *_filp_stack = NULL;
+static FILP_TLS struct filp_stack _filp_stack;
 
 /**
- * _filp_swap_stack - Pointer to the swapped stack.
+ * _filp_swap_stack - The swapped stack.
  *
- * This variable points to the alternative (swapped) stack.
+ * This variable holds the alternative (swapped) stack.
  * The content of this variable is swapped with _filp_stack
  * by the filp_swap_stack() function.
  */
-static struct filp_stack *_filp_swap_stack = NULL;
+static FILP_TLS struct filp_stack _filp_swap_stack;
 
 /**
  * _filp_stack_size - Maximum size of the stack.
@@ -48,14 +52,14 @@ static struct filp_stack *_filp_swap_stack = NULL;
  * By default is 16384. Just to avoid mad code from
  * devouring all the available memory.
  */
-int _filp_stack_size = 16384;
+FILP_TLS int _filp_stack_size = 16384;
 
 /**
  * _filp_stack_elems - Number of elements currently in the stack.
  *
  * The number of elements currently stored in the stack.
  */
-int _filp_stack_elems = 0;
+FILP_TLS int _filp_stack_elems = 0;
 
 
 /* dictionary */
@@ -67,11 +71,31 @@ int _filp_stack_elems = 0;
  *
  * This variable holds the symbol table, or dictionary.
  */
-static struct filp_sym *_filp_dict[FILP_DICT_HASH_SIZE];
+static FILP_TLS struct filp_sym *_filp_dict[FILP_DICT_HASH_SIZE];
+
+
+/* interned strings */
+
+/* longer strings are not interned by filp_new_interned_value() */
+#define FILP_INTERN_MAX 256
+
+struct filp_istr {
+    struct filp_istr *next;     /* next in the bucket */
+    unsigned int hash;          /* hash of the string */
+    int count;                  /* usage count */
+    char str[1];                /* the string */
+};
+
+/* the intern table, a hash of struct filp_istr */
+static FILP_TLS struct filp_istr **_filp_intern_tbl = NULL;
+static FILP_TLS int _filp_intern_size = 0;
+static FILP_TLS int _filp_intern_num = 0;
+
+#define FILP_ISTR(s) ((struct filp_istr *) ((s) - offsetof(struct filp_istr, str)))
 
 /* accounting */
-int _filp_val_account = 0;
-int _filp_sym_account = 0;
+FILP_TLS int _filp_val_account = 0;
+FILP_TLS int _filp_sym_account = 0;
 
 /**
  * _filp_version - Version of filp.
@@ -86,7 +110,7 @@ char _filp_version[] = VERSION;
  * This flag tells filp if it must perform mathematical operations
  * using integers (by default) or real numbers.
  */
-int _filp_real = 0;
+FILP_TLS int _filp_real = 0;
 
 /* increment block size for filp_poke() */
 int _filp_block_size = 1024;
@@ -98,7 +122,7 @@ int _filp_block_size = 1024;
  * not recognized as commands) are treated as literal strings.
  * Barewords are dangerous and hard to debug. Don't use it.
  */
-int _filp_bareword = 0;
+FILP_TLS int _filp_bareword = 0;
 
 /**
  * _filp_error - Last error code.
@@ -106,14 +130,14 @@ int _filp_bareword = 0;
  * This variable contains the last error code. Can be
  * used as an offset to the filp_error_strings filp array.
  */
-int _filp_error = FILPERR_NONE;
+FILP_TLS int _filp_error = FILPERR_NONE;
 
 /**
  * _filp_error_info - Text info about the last error.
  *
  * This string contain additional info about the last error.
  */
-char _filp_error_info[80] = "";
+FILP_TLS char _filp_error_info[80] = "";
 
 /**
  * _filp_isolate - Flag to isolate potentially dangerous commands.
@@ -123,7 +147,7 @@ char _filp_error_info[80] = "";
  * embedded systems exposed to untested input code. Basicly,
  * denies access to file functions, putenv and shell execution.
  */
-int _filp_isolate = 0;
+FILP_TLS int _filp_isolate = 0;
 
 /* license */
 char *_filp_license =
@@ -146,11 +170,19 @@ OTHER DEALINGS IN THE SOFTWARE.\n\
 https://triptico.com/software/filp.html\n";
 
 /* > 0 if filp code is in execution */
-int _in_filp = 0;
+FILP_TLS int _in_filp = 0;
+
+/* incremented each time symbols are created or destroyed,
+   so cached symbol lookups can be invalidated */
+FILP_TLS int _filp_dict_serial = 0;
+
+/* lowest address the C stack can grow to while running code
+   on a stack of fixed size (as generators do), or NULL */
+FILP_TLS char *_filp_cstack_limit = NULL;
 
 /* frequently used values */
-struct filp_val *_filp_null_value = NULL;
-struct filp_val *_filp_true_value = NULL;
+FILP_TLS struct filp_val *_filp_null_value = NULL;
+FILP_TLS struct filp_val *_filp_true_value = NULL;
 
 
 /******************
@@ -184,6 +216,52 @@ char *filp_poke(char *ptr, int *size, int offset, int c)
 }
 
 
+/**
+ * filp_append - Appends a block of bytes to a dynamic string.
+ * @ptr: the string
+ * @size: size of the string
+ * @offset: pointer to the offset where the block should be stored
+ * @data: the block of bytes
+ * @len: number of bytes in @data
+ *
+ * Appends @len bytes from @data to the dynamic string @ptr at
+ * the position pointed by @offset, that is incremented accordingly.
+ * Unlike filp_poke(), the string grows by doubling its @size, so
+ * building big strings this way takes amortized linear time.
+ * Returns a pointer to the new string (the original @ptr could
+ * have changed). If memory is exhausted, the string is freed,
+ * @size and @offset are reset and NULL is returned.
+ */
+char *filp_append(char *ptr, int *size, int *offset, void *data, int len)
+{
+    char *p;
+
+    if (len <= 0)
+        return ptr;
+
+    if (*offset + len > *size) {
+        int s = *size ? *size : _filp_block_size;
+
+        while (s < *offset + len)
+            s *= 2;
+
+        if ((p = realloc(ptr, s)) == NULL) {
+            free(ptr);
+            *size = *offset = 0;
+            return NULL;
+        }
+
+        ptr = p;
+        *size = s;
+    }
+
+    memcpy(ptr + *offset, data, len);
+    *offset += len;
+
+    return ptr;
+}
+
+
 /**
  * filp_splice - Deletes and inserts text in an string
  * @src: the source string
@@ -319,6 +397,119 @@ struct filp_val *filp_new_value(filp_type type, void *value, int size)
 }
 
 
+/**
+ * filp_new_scalar_view - Creates a scalar sharing another's bytes.
+ * @v: the scalar that holds the bytes
+ * @str: a null-terminated string inside the bytes of @v
+ * @len: the length of @str (-1, calculate it)
+ *
+ * Creates a new scalar value containing @str without copying it,
+ * as a view of the bytes of @v, that is kept alive meanwhile.
+ * As scalars are immutable, suffixes of a string or the fields
+ * of a split one can be taken this way at no cost.
+ */
+struct filp_val *filp_new_scalar_view(struct filp_val *v, char *str, int len)
+{
+    struct filp_val *r;
+
+    if ((r = filp_new_value(FILP_SCALAR, NULL, 0)) == NULL)
+        return NULL;
+
+    if (len == -1)
+        len = strlen(str);
+
+    r->value = str;
+    r->size = len + 1;
+    r->cache = v;
+
+    filp_ref_value(v);
+
+    return r;
+}
+
+
+static int _filp_builder_size(int size)
+/* the allocated size of a growable buffer of size bytes */
+{
+    int s = 64;
+
+    while (s < size)
+        s *= 2;
+
+    return s;
+}
+
+
+/**
+ * filp_new_builder - Creates a new string builder.
+ *
+ * Creates a new, empty string builder: a mutable string that
+ * grows by doubling its buffer, so appending to it takes
+ * amortized constant time. Like scalars, its size is its
+ * length plus one, and it's always null-terminated.
+ */
+struct filp_val *filp_new_builder(void)
+{
+    struct filp_val *v;
+
+    if ((v = filp_new_value(FILP_BUILDER, NULL, 1)) == NULL)
+        return NULL;
+
+    if ((v->value = (char *) malloc(_filp_builder_size(1))) == NULL)
+        return NULL;
+
+    v->value[0] = '\0';
+
+    return v;
+}
+
+
+/**
+ * filp_builder_append - Appends bytes to a string builder.
+ * @v: the string builder
+ * @data: the bytes to be appended
+ * @len: number of bytes in @data
+ *
+ * Appends @len bytes from @data to the string builder @v. It
+ * also works on scalars with growable bytes (the ones with the
+ * grow flag set) if nothing else references them.
+ * Returns 0 if out of memory, or 1 otherwise.
+ */
+int filp_builder_append(struct filp_val *v, char *data, int len)
+{
+    int l = v->size - 1;
+    char *ptr;
+
+    if (_filp_builder_size(l + len + 1) > _filp_builder_size(v->size)) {
+        ptr = (char *) realloc(v->value, _filp_builder_size(l + len + 1));
+
+        if (ptr == NULL)
+            return 0;
+
+        v->value = ptr;
+    }
+
+    memcpy(v->value + l, data, len);
+    v->value[l + len] = '\0';
+    v->size += len;
+
+    return 1;
+}
+
+
+/**
+ * filp_builder_str - Returns the content of a string builder.
+ * @v: the string builder
+ *
+ * Returns a new scalar with a copy of the content of the
+ * string builder @v, that can still be appended to.
+ */
+struct filp_val *filp_builder_str(struct filp_val *v)
+{
+    return filp_new_value(FILP_SCALAR, v->value, v->size);
+}
+
+
 /**
  * filp_ref_value - Increments the reference to a value
  * @v: the value
@@ -347,6 +538,25 @@ void filp_unref_value(struct filp_val *v)
 }
 
 
+/**
+ * filp_val_len - Returns the length of a value.
+ * @v: the value
+ *
+ * Returns the length in bytes of the string of @v. Scalars, code
+ * and string builders keep it (their size is always the length
+ * plus one, for the null terminator), so it's not recalculated,
+ * and they can contain binary data; for any other value, it's
+ * the length of its printable representation.
+ */
+int filp_val_len(struct filp_val *v)
+{
+    if (v->type == FILP_SCALAR || v->type == FILP_CODE || v->type == FILP_BUILDER)
+        return v->size > 0 ? v->size - 1 : 0;
+
+    return v->value ? strlen(v->value) : 0;
+}
+
+
 /**
  * filp_cmp - Compares two filp values.
  * @v1: first value
@@ -359,8 +569,16 @@ void filp_unref_value(struct filp_val *v)
 int filp_cmp(struct filp_val *v1, struct filp_val *v2)
 {
     /* only scalars can really be compared */
-    if (v1->type == FILP_SCALAR || v2->type == FILP_SCALAR)
-        return strcmp(v1->value, v2->value);
+    if (v1->type == FILP_SCALAR || v2->type == FILP_SCALAR) {
+        int l1 = filp_val_len(v1);
+        int l2 = filp_val_len(v2);
+        int c;
+
+        if ((c = memcmp(v1->value, v2->value, l1 < l2 ? l1 : l2)) == 0)
+            c = l1 - l2;
+
+        return c;
+    }
 
     /* if they are pointers, try a simple comparison,
        just to test if both pointers are the same */
@@ -397,6 +615,43 @@ int filp_is_true(struct filp_val *v)
 
 /* stack */
 
+static int _filp_mark(int pos)
+/* appends a list marker at offset pos */
+{
+    struct filp_stack *s = &_filp_stack;
+
+    if (s->nmarks == s->amarks) {
+        int n = s->amarks ? s->amarks * 2 : 16;
+        int *m;
+
+        if ((m = (int *) realloc(s->marks, n * sizeof(int))) == NULL)
+            return 0;
+
+        s->marks = m;
+        s->amarks = n;
+    }
+
+    s->marks[s->nmarks++] = pos;
+
+    return 1;
+}
+
+
+static void _filp_remark(int pos)
+/* rebuilds the list markers from offset pos upwards */
+{
+    struct filp_stack *s = &_filp_stack;
+
+    while (s->nmarks && s->marks[s->nmarks - 1] >= pos)
+        s->nmarks--;
+
+    for (; pos < _filp_stack_elems; pos++) {
+        if (s->values[pos]->type == FILP_NULL)
+            _filp_mark(pos);
+    }
+}
+
+
 /**
  * filp_push - Pushes a value into the stack, duplicating it.
  * @v: the value to be pushed
@@ -407,27 +662,38 @@ int filp_is_true(struct filp_val *v)
  */
 int filp_push(struct filp_val *v)
 {
-    struct filp_stack *s;
+    struct filp_stack *s = &_filp_stack;
 
     /* stack overflow? */
-    if (_filp_stack_elems == _filp_stack_size)
+    if (_filp_stack_elems >= _filp_stack_size)
         return 0;
 
-    if ((s = (struct filp_stack *) malloc(sizeof(struct filp_stack))) == NULL)
-        return 0;
+    if (_filp_stack_elems == s->alloc) {
+        struct filp_val **a;
+        int n;
 
-    memset(s, '\0', sizeof(struct filp_stack));
+        n = s->alloc ? s->alloc * 2 : 64;
+        if (n > _filp_stack_size)
+            n = _filp_stack_size;
 
-    s->next = _filp_stack;
-    _filp_stack = s;
+        a = (struct filp_val **) realloc(s->values,
+                                         n * sizeof(struct filp_val *));
+        if (a == NULL)
+            return 0;
+
+        s->values = a;
+        s->alloc = n;
+    }
 
-    _filp_stack_elems++;
+    /* NULL values delimit lists */
+    if (v->type == FILP_NULL && !_filp_mark(_filp_stack_elems))
+        return 0;
 
     /* if value is an array, it must be duplicated */
     if (v->type == FILP_ARRAY)
         v = filp_array_dup(v);
 
-    s->value = v;
+    s->values[_filp_stack_elems++] = v;
 
     /* the value is now referenced in the stack */
     filp_ref_value(v);
@@ -444,19 +710,16 @@ int filp_push(struct filp_val *v)
  */
 struct filp_val *filp_pop(void)
 {
-    struct filp_stack *s;
+    struct filp_stack *s = &_filp_stack;
     struct filp_val *v;
 
-    if (_filp_stack == NULL)
+    if (_filp_stack_elems == 0)
         return _filp_null_value;
 
-    s = _filp_stack;
-    _filp_stack = s->next;
-    _filp_stack_elems--;
-
-    v = s->value;
+    v = s->values[--_filp_stack_elems];
 
-    free(s);
+    if (v->type == FILP_NULL && s->nmarks)
+        s->nmarks--;
 
     /* value is not referenced here anymore */
     filp_unref_value(v);
@@ -475,14 +738,10 @@ struct filp_val *filp_pop(void)
  */
 struct filp_val *filp_stack_value(int pos)
 {
-    struct filp_stack *s;
-
-    for (s = _filp_stack, pos--; s != NULL && pos; s = s->next, pos--);
-
-    if (s == NULL)
+    if (pos < 1 || pos > _filp_stack_elems)
         return _filp_null_value;
 
-    return s->value;
+    return _filp_stack.values[_filp_stack_elems - pos];
 }
 
 
@@ -494,23 +753,28 @@ struct filp_val *filp_stack_value(int pos)
  */
 void filp_rot(int pos)
 {
-    struct filp_stack *s;
-    struct filp_stack *r;
+    struct filp_stack *s = &_filp_stack;
+    struct filp_val *v;
+    int i;
 
-    if (--pos == 0)
+    if (pos == 1)
         return;
 
-    for (s = _filp_stack, --pos; s != NULL && pos; s = s->next, pos--);
-
-    if (s == NULL || s->next == NULL) {
+    if (pos < 1 || pos > _filp_stack_elems) {
         filp_null_push();
         return;
     }
 
-    r = s->next;
-    s->next = r->next;
-    r->next = _filp_stack;
-    _filp_stack = r;
+    i = _filp_stack_elems - pos;
+    v = s->values[i];
+
+    memmove(&s->values[i], &s->values[i + 1],
+            (pos - 1) * sizeof(struct filp_val *));
+    s->values[_filp_stack_elems - 1] = v;
+
+    /* list markers moved? */
+    if (s->nmarks && s->marks[s->nmarks - 1] >= i)
+        _filp_remark(i);
 }
 
 
@@ -521,31 +785,274 @@ void filp_rot(int pos)
  */
 void filp_swap_stack(void)
 {
-    struct filp_stack *s;
+    filp_exchange_stack(&_filp_swap_stack);
+}
+
 
-    s = _filp_swap_stack;
-    _filp_swap_stack = _filp_stack;
+/**
+ * filp_exchange_stack - Exchanges the stack with another one.
+ * @stack: pointer to the other stack
+ *
+ * Makes the stack pointed by @stack the current one, storing
+ * the previous one into it. Calling it again restores the
+ * original stack. A zero-filled struct filp_stack is a
+ * valid, empty stack.
+ */
+void filp_exchange_stack(struct filp_stack *stack)
+{
+    struct filp_stack s;
+
+    _filp_stack.elems = _filp_stack_elems;
+
+    s = *stack;
+    *stack = _filp_stack;
     _filp_stack = s;
 
-    for (_filp_stack_elems = 0; s != NULL; s = s->next)
-        _filp_stack_elems++;
+    _filp_stack_elems = _filp_stack.elems;
 }
 
 
 /**
  * filp_list_size - Computes the size of a list.
  *
- * Computes the size of a list.
+ * Computes the size of a list, i.e. the number of elements
+ * above the topmost FILP_NULL marker (or the full stack,
+ * if there is none).
  */
 int filp_list_size(void)
+{
+    struct filp_stack *s = &_filp_stack;
+
+    if (s->nmarks == 0)
+        return _filp_stack_elems;
+
+    return _filp_stack_elems - s->marks[s->nmarks - 1] - 1;
+}
+
+
+/**
+ * filp_list_reverse - Reverses a list in place.
+ *
+ * Reverses the order of the elements of the list in the top
+ * of the stack. The list marker is left untouched.
+ */
+void filp_list_reverse(void)
+{
+    struct filp_val **l;
+    struct filp_val *v;
+    int i, j;
+
+    l = &_filp_stack.values[_filp_stack_elems - filp_list_size()];
+
+    for (i = 0, j = filp_list_size() - 1; i < j; i++, j--) {
+        v = l[i];
+        l[i] = l[j];
+        l[j] = v;
+    }
+}
+
+
+/**
+ * filp_list_drop - Drops a list.
+ *
+ * Pops all the elements of the list in the top of the stack,
+ * including its FILP_NULL marker.
+ */
+void filp_list_drop(void)
 {
     int n;
-    struct filp_stack *s;
 
-    for (n = 0, s = _filp_stack; s != NULL && s->value->type != FILP_NULL;
-         s = s->next, n++);
+    for (n = filp_list_size() + 1; n > 0; n--)
+        filp_pop();
+}
+
+
+/** interned strings **/
+
+static unsigned int _filp_intern_hashfunc(char *str)
+{
+    unsigned int h = 2166136261U;
+
+    while (*str)
+        h = (h ^ (unsigned char) *str++) * 16777619U;
+
+    return h;
+}
+
+
+static struct filp_istr *_filp_intern_find(char *str, unsigned int h)
+{
+    struct filp_istr *i;
+
+    if (_filp_intern_size == 0)
+        return NULL;
+
+    for (i = _filp_intern_tbl[h & (_filp_intern_size - 1)]; i != NULL; i = i->next) {
+        if (i->hash == h && strcmp(i->str, str) == 0)
+            break;
+    }
+
+    return i;
+}
+
+
+static void _filp_intern_grow(void)
+/* doubles the number of buckets of the intern table */
+{
+    struct filp_istr **t;
+    struct filp_istr *i;
+    int n, size;
+
+    size = _filp_intern_size ? _filp_intern_size * 2 : 256;
+
+    if ((t = (struct filp_istr **) calloc(size, sizeof(struct filp_istr *))) == NULL)
+        return;
+
+    for (n = 0; n < _filp_intern_size; n++) {
+        while ((i = _filp_intern_tbl[n]) != NULL) {
+            _filp_intern_tbl[n] = i->next;
+
+            i->next = t[i->hash & (size - 1)];
+            t[i->hash & (size - 1)] = i;
+        }
+    }
+
+    free(_filp_intern_tbl);
+    _filp_intern_tbl = t;
+    _filp_intern_size = size;
+}
+
+
+/**
+ * filp_intern - Interns a string.
+ * @str: the string
+ *
+ * Returns the interned copy of @str: a buffer, shared by all
+ * identical strings interned by the running interpreter, that
+ * must never be modified. So, two interned strings are equal if
+ * and only if they are the same pointer. Each call takes
+ * a reference that must be released with filp_intern_unref().
+ * Returns NULL if out of memory.
+ */
+char *filp_intern(char *str)
+{
+    struct filp_istr *i;
+    unsigned int h;
+    int l;
+
+    h = _filp_intern_hashfunc(str);
+
+    if ((i = _filp_intern_find(str, h)) == NULL) {
+        if (_filp_intern_num >= _filp_intern_size)
+            _filp_intern_grow();
+
+        if (_filp_intern_size == 0)
+            return NULL;
+
+        l = strlen(str);
+
+        if ((i = (struct filp_istr *) malloc(sizeof(struct filp_istr) + l)) == NULL)
+            return NULL;
 
-    return n;
+        memcpy(i->str, str, l + 1);
+        i->hash = h;
+        i->count = 0;
+
+        i->next = _filp_intern_tbl[h & (_filp_intern_size - 1)];
+        _filp_intern_tbl[h & (_filp_intern_size - 1)] = i;
+
+        _filp_intern_num++;
+    }
+
+    i->count++;
+
+    return i->str;
+}
+
+
+/**
+ * filp_intern_lookup - Finds an interned string.
+ * @str: the string
+ *
+ * Returns the interned copy of @str, if there is one, or NULL
+ * otherwise. No reference is taken.
+ */
+char *filp_intern_lookup(char *str)
+{
+    struct filp_istr *i;
+
+    i = _filp_intern_find(str, _filp_intern_hashfunc(str));
+
+    return i ? i->str : NULL;
+}
+
+
+/**
+ * filp_intern_hash - Returns the hash of an interned string.
+ * @istr: the interned string
+ *
+ * Returns the hash of the interned string @istr, that is
+ * calculated only once, when the string is interned.
+ */
+unsigned int filp_intern_hash(char *istr)
+{
+    return FILP_ISTR(istr)->hash;
+}
+
+
+/**
+ * filp_intern_unref - Releases an interned string.
+ * @istr: the interned string
+ *
+ * Releases a reference taken by filp_intern(). When the last
+ * one is released, the string is freed.
+ */
+void filp_intern_unref(char *istr)
+{
+    struct filp_istr *i = FILP_ISTR(istr);
+    struct filp_istr **p;
+
+    if (--i->count > 0)
+        return;
+
+    for (p = &_filp_intern_tbl[i->hash & (_filp_intern_size - 1)]; *p != i;
+         p = &(*p)->next);
+
+    *p = i->next;
+    _filp_intern_num--;
+
+    free(i);
+}
+
+
+/**
+ * filp_new_interned_value - Creates a scalar with an interned string.
+ * @str: the string
+ *
+ * Creates a new scalar value containing @str, as filp_new_value()
+ * does, but sharing the interned copy of the string if it's
+ * not too long. Useful for hash keys and symbol names, that are
+ * repeated a lot and compared often.
+ */
+struct filp_val *filp_new_interned_value(char *str)
+{
+    struct filp_val *v;
+    char *i;
+    int l;
+
+    if ((l = strlen(str)) >= FILP_INTERN_MAX || (i = filp_intern(str)) == NULL)
+        return filp_new_value(FILP_SCALAR, str, -1);
+
+    if ((v = filp_new_value(FILP_SCALAR, NULL, 0)) == NULL) {
+        filp_intern_unref(i);
+        return NULL;
+    }
+
+    v->value = i;
+    v->size = l + 1;
+    v->interned = 1;
+
+    return v;
 }
 
 
@@ -567,10 +1074,15 @@ struct filp_sym *filp_find_symbol(char *name)
     if (name == NULL || *name == '\0')
         return NULL;
 
-    h = filp_hashfunc((unsigned char *) name, FILP_DICT_HASH_SIZE);
+    /* symbol names are interned: if the name isn't,
+       no symbol can have it */
+    if ((name = filp_intern_lookup(name)) == NULL)
+        return NULL;
+
+    h = filp_intern_hash(name) % FILP_DICT_HASH_SIZE;
 
     for (p = NULL, s = _filp_dict[h]; s != NULL; p = s, s = s->next) {
-        if (strcmp(name, s->name) == 0)
+        if (s->name == name)
             break;
     }
 
@@ -588,6 +1100,31 @@ struct filp_sym *filp_find_symbol(char *name)
 }
 
 
+/**
+ * filp_find_bin_code - Finds the symbol of a binary code value.
+ * @v: the FILP_BIN_CODE value
+ *
+ * Finds the symbol holding the C function of @v, i.e. the name
+ * it was registered with by filp_bin_code(). The full dictionary
+ * is walked. Returns the symbol, or a NULL pointer if not found.
+ */
+struct filp_sym *filp_find_bin_code(struct filp_val *v)
+{
+    struct filp_sym *s;
+    int h;
+
+    for (h = 0; h < FILP_DICT_HASH_SIZE; h++) {
+        for (s = _filp_dict[h]; s != NULL; s = s->next) {
+            if (s->type == FILP_BIN_CODE && s->value != NULL &&
+                s->value->value == v->value)
+                return s;
+        }
+    }
+
+    return NULL;
+}
+
+
 /**
  * filp_new_symbol - Creates a new symbol.
  * @type: type of the new symbol
@@ -598,8 +1135,7 @@ struct filp_sym *filp_find_symbol(char *name)
 struct filp_sym *filp_new_symbol(filp_type type, char *name)
 {
     struct filp_sym *s;
-    char *cp_name;
-    int l, h;
+    int h;
 
     if (name == NULL)
         return NULL;
@@ -609,19 +1145,19 @@ struct filp_sym *filp_new_symbol(filp_type type, char *name)
 
     memset(s, '\0', sizeof(struct filp_sym));
 
-    l = strlen(name) + 1;
-    if ((cp_name = (char *) malloc(l)) == NULL)
+    if ((s->name = filp_intern(name)) == NULL) {
+        free(s);
         return NULL;
+    }
 
-    strcpy(cp_name, name);
-    s->name = cp_name;
     s->type = type;
 
-    h = filp_hashfunc((unsigned char *) name, FILP_DICT_HASH_SIZE);
+    h = filp_intern_hash(s->name) % FILP_DICT_HASH_SIZE;
     s->next = _filp_dict[h];
     _filp_dict[h] = s;
 
     _filp_sym_account++;
+    _filp_dict_serial++;
 
     return s;
 }
@@ -638,8 +1174,10 @@ struct filp_val *filp_get_symbol(struct filp_sym *s)
     struct filp_val *v;
     int *i;
     char *ptr;
+    char *e;
     double *d;
     FILE *f;
+    int l;
 
     if (s->value == NULL)
         return NULL;
@@ -653,8 +1191,12 @@ struct filp_val *filp_get_symbol(struct filp_sym *s)
         v = filp_new_real_value(*d);
     }
     else if (s->type == FILP_EXT_STRING) {
+        /* the buffer may not be full, nor null-terminated */
         ptr = (char *) s->value;
-        v = filp_new_value(FILP_SCALAR, ptr, s->size);
+        l = (e = memchr(ptr, '\0', s->size)) != NULL ? e - ptr : s->size;
+
+        v = filp_new_value(FILP_SCALAR, ptr, l + 1);
+        v->value[l] = '\0';
     }
     else if (s->type == FILP_FILE) {
         f = (FILE *) s->value->value;
@@ -731,7 +1273,7 @@ void filp_destroy_symbol(struct filp_sym *s)
     struct filp_sym *s2;
     int h;
 
-    h = filp_hashfunc(s->name, FILP_DICT_HASH_SIZE);
+    h = filp_intern_hash(s->name) % FILP_DICT_HASH_SIZE;
 
     if (_filp_dict[h] == s)
         _filp_dict[h] = s->next;
@@ -749,9 +1291,11 @@ void filp_destroy_symbol(struct filp_sym *s)
             filp_unref_value(s->value);
     }
 
+    filp_intern_unref(s->name);
     free(s);
 
     _filp_sym_account--;
+    _filp_dict_serial++;
 #else
     filp_set_symbol(s, _filp_null_value);
 #endif
@@ -777,7 +1321,7 @@ int filp_push_dict(char *mask)
     for (n = 0; n < FILP_DICT_HASH_SIZE; n++) {
         for (s = _filp_dict[n]; s != NULL; s = s->next) {
             if (i == 0 || memcmp(s->name, mask, i) == 0) {
-                filp_scalar_push(s->name);
+                filp_push(filp_new_interned_value(s->name));
                 cnt++;
             }
         }
@@ -809,13 +1353,31 @@ int filp_sweep_head(void)
     v = _filp_val_head;
     _filp_val_head = _filp_val_head->next;
 
+    /* free cached data (e.g. compiled code) */
+    if (v->cache_free != NULL)
+        v->cache_free(v->cache);
+
     /* free memory blocks */
-    if (v->type == FILP_SCALAR || v->type == FILP_CODE) {
-        if (v->value != NULL)
+    if (v->type == FILP_SCALAR || v->type == FILP_CODE || v->type == FILP_BUILDER) {
+        if (v->interned)
+            filp_intern_unref(v->value);
+        else if (v->type == FILP_SCALAR && v->cache != NULL && v->cache_free == NULL)
+            filp_unref_value((struct filp_val *) v->cache);
+        else if (v->value != NULL)
             free(v->value);
     }
     else if (v->type == FILP_ARRAY)
         filp_array_destroy(v);
+    else if (v->type == FILP_TASK)
+        filp_task_unref(v->value);
+    else if (v->type == FILP_CHANNEL)
+        filp_channel_unref(v->value);
+    else if (v->type == FILP_GENERATOR)
+        filp_gen_destroy(v->value);
+    else if (v->type == FILP_VECTOR)
+        filp_vector_destroy(v->value);
+    else if (v->type == FILP_OMAP)
+        filp_omap_destroy(v->value);
 
     free(v);
 
@@ -836,7 +1398,7 @@ int filp_sweep_head(void)
  */
 void filp_sweeper(int full)
 {
-    static int _last_val_account = 0;
+    static FILP_TLS int _last_val_account = 0;
     int n;
 
     /* do nothing if queue value is empty or has one element */
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <time.h>
 
 #include "filp.h"
@@ -356,7 +357,8 @@ static int _filpf_unset(void)
  * a name of a symbol, the type of its content is returned; otherwise,
  * the value type itself is returned.
  * The returned value can be one of SCALAR, CODE, BIN_CODE, EXT_INT,
- * EXT_REAL, EXT_STRING, NULL, FILE or ARRAY.
+ * EXT_REAL, EXT_STRING, NULL, FILE, ARRAY, TASK, CHANNEL, GENERATOR,
+ * VECTOR, OMAP or BUILDER.
  * [Symbol management commands]
  */
 static int _filpf_type(void)
@@ -365,12 +367,14 @@ static int _filpf_type(void)
     struct filp_val *v;
     struct filp_sym *s;
     static char *types[] = { "SCALAR", "CODE", "BIN_CODE", "EXT_INT",
-        "EXT_REAL", "EXT_STRING", "NULL", "FILE", "ARRAY"
+        "EXT_REAL", "EXT_STRING", "NULL", "FILE", "ARRAY", "TASK",
+        "CHANNEL", "GENERATOR", "VECTOR", "OMAP", "BUILDER"
     };
 
     v = filp_pop();
 
-    if ((s = filp_find_symbol(v->value)) == NULL)
+    /* only scalars can be symbol names */
+    if (v->type != FILP_SCALAR || (s = filp_find_symbol(v->value)) == NULL)
         filp_scalar_push(types[v->type]);
     else
         filp_scalar_push(types[s->type]);
@@ -757,15 +761,20 @@ static int _filpf_cmp(char *token)
     v1 = filp_pop();
     v2 = filp_pop();
 
-    ret = filp_cmp(v1, v2);
-
     ret2 = 0;
-    if (strcmp(token, "eq") == 0)
-        ret2 = (ret == 0) ? 1 : 0;
-    else if (strcmp(token, "gt") == 0)
-        ret2 = (ret < 0) ? 1 : 0;
-    else if (strcmp(token, "lt") == 0)
-        ret2 = (ret > 0) ? 1 : 0;
+    if (strcmp(token, "eq") == 0) {
+        /* different lengths can't be equal */
+        if (filp_val_len(v1) == filp_val_len(v2))
+            ret2 = (filp_cmp(v1, v2) == 0) ? 1 : 0;
+    }
+    else {
+        ret = filp_cmp(v1, v2);
+
+        if (strcmp(token, "gt") == 0)
+            ret2 = (ret < 0) ? 1 : 0;
+        else if (strcmp(token, "lt") == 0)
+            ret2 = (ret > 0) ? 1 : 0;
+    }
 
     filp_bool_push(ret2);
 
@@ -1035,19 +1044,43 @@ static int _filpf_loop(void)
  * Executes a block of code for each element of a list, that is,
  * until there is a NULL in the top of stack. The code block must
  * take the values from the top of stack on each iteration. The NULL
- * value is automatically dropped.
+ * value is automatically dropped. If the value below the code block
+ * is a generator, the values are taken one by one from it until
+ * it finishes (see gen).
  * [Control structures]
  * [List processing commands]
  */
 static int _filpf_foreach(void)
 /** [ @list_elements ... ] @code_block foreach */
+/** @generator @code_block foreach */
 {
     struct filp_val *v;
     struct filp_val *code;
-    int ret = 0;
+    int n, ret = 0;
 
     code = filp_pop();
 
+    /* generators are consumed lazily */
+    if (filp_stack_value(1)->type == FILP_GENERATOR) {
+        v = filp_pop();
+
+        filp_ref_value(v);
+        filp_ref_value(code);
+
+        while ((n = filp_gen_next(v)) > 0 && (ret = filp_execv(code)) == FILP_OK);
+
+        filp_unref_value(code);
+        filp_unref_value(v);
+
+        if (n < 0)
+            ret = FILP_ERROR;
+
+        if (ret == FILP_BREAK)
+            ret = FILP_OK;
+
+        return ret;
+    }
+
     for (;;) {
         v = filp_pop();
         if (v->type == FILP_NULL)
@@ -1240,26 +1273,7 @@ static int _filpf_switch(void)
 static int _filpf_reverse(void)
 /** [ @elem-1 @elem-2 ... @elem-n ] reverse [ @elem-n ... @elem-2 @elem-1 ] */
 {
-    struct filp_val *v;
-    int n;
-
-    /* the filp version was
-       filp_exec("/reverse { [ # /_ 3 = { $_ rot } { /_ ++ } while } set");
-       But the while test does not work if a 0 value is found.
-     */
-
-    filp_exec("[ #");
-
-    for (n = 3;; n++) {
-        filp_rot(n);
-
-        v = filp_stack_value(1);
-
-        if (v->type == FILP_NULL) {
-            filp_pop();
-            break;
-        }
-    }
+    filp_list_reverse();
 
     return FILP_OK;
 }
@@ -1280,24 +1294,20 @@ static int _filpf_seek(void)
 /** [ @elements_of_list ] @value seek %offset */
 {
     struct filp_val *o;
-    struct filp_val *v;
-    int ret;
+    int n, ret;
 
     o = filp_pop();
+    n = filp_list_size();
 
-    for (ret = 1;; ret++) {
-        v = filp_pop();
-        if (v->type == FILP_NULL) {
-            ret = 0;
-            break;
-        }
-
-        if (filp_cmp(v, o) == 0)
+    for (ret = 1; ret <= n; ret++) {
+        if (filp_cmp(filp_stack_value(ret), o) == 0)
             break;
     }
 
-    while (v->type != FILP_NULL)
-        v = filp_pop();
+    if (ret > n)
+        ret = 0;
+
+    filp_list_drop();
 
     filp_int_push(ret);
 
@@ -1319,27 +1329,25 @@ static int _filpf_seek(void)
 static int _filpf_index(void)
 /** [ @elements_of_list ] @offset index %value */
 {
-    struct filp_val *v;
     struct filp_val *c;
-    int m, n;
+    int n;
 
     n = filp_int_pop();
     c = NULL;
 
-    for (m = 1; n != 0 && m < n; m++)
-        filp_pop();
+    if (n > 0 && n <= filp_list_size())
+        c = filp_stack_value(n);
 
-    if (n)
-        c = filp_pop();
+    /* keep it alive while the list is dropped */
+    if (c != NULL)
+        filp_ref_value(c);
 
-    for (;;) {
-        v = filp_pop();
-        if (v->type == FILP_NULL)
-            break;
-    }
+    filp_list_drop();
 
-    if (c != NULL)
+    if (c != NULL) {
         filp_push(c);
+        filp_unref_value(c);
+    }
     else
         filp_null_push();
 
@@ -1367,6 +1375,15 @@ static int _filpf_load(void)
 }
 
 
+static int _filp_scalar_mine(struct filp_val *v)
+/* tests if the bytes of a popped scalar can be modified in place,
+   i.e. nothing else references it or shares them */
+{
+    return v->type == FILP_SCALAR && v->count == 0 && !v->interned &&
+        (v->cache == NULL || v->own);
+}
+
+
 /**
  * strcat - Concatenates two strings.
  * @str1: the first string
@@ -1381,8 +1398,7 @@ static int _filpf_strcat(void)
 {
     struct filp_val *first;
     struct filp_val *last;
-    int l;
-    char *str;
+    struct filp_val *v;
 
     last = filp_pop();
     first = filp_pop();
@@ -1393,17 +1409,30 @@ static int _filpf_strcat(void)
         return FILP_ERROR;
     }
 
-    l = strlen(first->value) + strlen(last->value) + 1;
-    if ((str = malloc(l)) == NULL) {
+    if (first->grow && first != last && _filp_scalar_mine(first)) {
+        /* the result of a previous concatenation that nothing
+           else references: append in place, so chains of .
+           take linear time */
+        v = first;
+    }
+    else {
+        /* a new growable buffer */
+        if ((v = filp_new_builder()) == NULL ||
+            !filp_builder_append(v, first->value, filp_val_len(first))) {
+            _filp_error = FILPERR_OUT_OF_MEMORY;
+            return FILP_ERROR;
+        }
+
+        v->type = FILP_SCALAR;
+        v->grow = 1;
+    }
+
+    if (!filp_builder_append(v, last->value, filp_val_len(last))) {
         _filp_error = FILPERR_OUT_OF_MEMORY;
         return FILP_ERROR;
     }
 
-    strcpy(str, first->value);
-    strcat(str, last->value);
-
-    filp_scalar_push(str);
-    free(str);
+    filp_push(v);
 
     return FILP_OK;
 }
@@ -1413,7 +1442,7 @@ static int _filpf_strcat(void)
  * length - Returns the length of a string.
  * @string: the string
  *
- * Returns the length of the string.
+ * Returns the length of the string (or string builder).
  * [String manipulation commands]
  */
 static int _filpf_length(void)
@@ -1424,13 +1453,13 @@ static int _filpf_length(void)
 
     v = filp_pop();
 
-    if (v->type != FILP_SCALAR) {
+    if (v->type != FILP_SCALAR && v->type != FILP_BUILDER) {
         filp_null_push();
         _filp_error = FILPERR_SCALAR_EXPECTED;
         return FILP_ERROR;
     }
 
-    i = strlen(v->value);
+    i = filp_val_len(v);
 
     filp_int_push(i);
 
@@ -1452,15 +1481,14 @@ static int _filpf_substr(void)
 /** @string @offset @size substr %substring */
 {
     struct filp_val *s;
+    struct filp_val *v;
     int org, num, l;
-    char *str;
 
     num = filp_int_pop();
     org = filp_int_pop();
 
     s = filp_pop();
-    l = strlen(s->value);
-    str = (char *) malloc(l + 1);
+    l = filp_val_len(s);
 
     if (num <= 0 || org <= 0) {
         num = org = 0;
@@ -1470,15 +1498,61 @@ static int _filpf_substr(void)
     if (org + num > l)
         num = l - org;
 
+    /* nothing to extract: org can be out of the string */
     if (num <= 0)
-        num = 0;
+        v = filp_new_value(FILP_SCALAR, "", 1);
+    else
+    if (num == l && s->type == FILP_SCALAR)
+        v = s;
+    else
+    if (org + num == l && s->type == FILP_SCALAR) {
+        /* suffixes are null-terminated: share them */
+        v = filp_new_scalar_view(s, &s->value[org], num);
+    }
+    else {
+        v = filp_new_value(FILP_SCALAR, &s->value[org], num + 1);
+        v->value[num] = '\0';
+    }
+
+    filp_push(v);
+
+    return FILP_OK;
+}
+
+
+/**
+ * chop - Chops the last character of a string.
+ * @string: the string to be chopped
+ *
+ * Chops the last character of a string. Mainly to be used
+ * to cut the trailing \n character of a line read from a
+ * file.
+ * [String manipulation commands]
+ */
+static int _filpf_chop(void)
+/** @string chop %string */
+{
+    struct filp_val *s;
+    struct filp_val *v;
+    int l;
+
+    s = filp_pop();
 
-    strncpy(str, &s->value[org], num);
-    str[num] = '\0';
+    if ((l = filp_val_len(s)) > 0)
+        l--;
 
-    filp_scalar_push(str);
+    if (_filp_scalar_mine(s)) {
+        /* nobody else sees it: just cut it */
+        s->value[l] = '\0';
+        s->size = l + 1;
+        v = s;
+    }
+    else {
+        v = filp_new_value(FILP_SCALAR, s->value, l + 1);
+        v->value[l] = '\0';
+    }
 
-    free(str);
+    filp_push(v);
 
     return FILP_OK;
 }
@@ -1522,7 +1596,7 @@ static int _filpf_instr(void)
 {
     struct filp_val *ss;
     struct filp_val *s;
-    int n, l;
+    int n, l, ls;
 
     ss = filp_pop();
     s = filp_pop();
@@ -1532,15 +1606,21 @@ static int _filpf_instr(void)
         return FILP_ERROR;
     }
 
-    l = strlen(ss->value);
+    l = filp_val_len(ss);
+    ls = filp_val_len(s);
 
-    for (n = 0; s->value[n]; n++) {
-        if (memcmp(&s->value[n], ss->value, l) == 0)
-            break;
+    n = -1;
+
+    if (l == 0) {
+        if (ls)
+            n = 0;
     }
+    else {
+        char *p = filp_memmem(s->value, ls, ss->value, l);
 
-    if (s->value[n] == '\0')
-        n = -1;
+        if (p != NULL)
+            n = p - s->value;
+    }
 
     filp_int_push(n + 1);
 
@@ -1563,8 +1643,11 @@ static int _filpf_split(void)
 {
     struct filp_val *s;
     struct filp_val *v;
+    struct filp_val *b;
+    struct filp_val *f;
     char *ptr;
-    char *wrk;
+    char *e;
+    int l, n;
 
     v = filp_pop();
     s = filp_pop();
@@ -1576,28 +1659,42 @@ static int _filpf_split(void)
         return FILP_ERROR;
     }
 
-    if (v->value[0] == '\0') {
+    l = filp_val_len(s);
+    n = filp_val_len(v);
+
+    if (n == 0) {
         char tmp[2];
 
         tmp[1] = '\0';
-        for (ptr = s->value; *ptr; ptr++) {
+        for (ptr = s->value, e = ptr + l; ptr < e; ptr++) {
             tmp[0] = *ptr;
-            filp_scalar_push(tmp);
+            filp_push(filp_new_value(FILP_SCALAR, tmp, 2));
         }
     }
     else {
-        /* creates a working copy (as strtok destroys it) */
-        wrk = (char *) malloc(strlen(s->value) + 1);
-        strcpy(wrk, s->value);
+        /* the slices are null-terminated in place, if the string
+           is not referenced anywhere else, or in a working copy
+           (not using strtok, as it's not reentrant); anyway, they
+           are views of it, as each one owns its own bytes */
+        if (s != v && _filp_scalar_mine(s))
+            b = s;
+        else
+            b = filp_new_value(FILP_SCALAR, s->value, l + 1);
 
-        ptr = strtok(wrk, v->value);
+        e = b->value + l;
 
-        while (ptr != NULL) {
-            filp_scalar_push(ptr);
-            ptr = strtok(NULL, v->value);
-        }
+        for (ptr = b->value + filp_memspn(b->value, l, v->value, n); ptr < e;) {
+            char *end = ptr + filp_memcspn(ptr, e - ptr, v->value, n);
 
-        free(wrk);
+            f = filp_new_scalar_view(b, ptr, end - ptr);
+            f->own = 1;
+            filp_push(f);
+
+            if (end < e)
+                *end++ = '\0';
+
+            ptr = end + filp_memspn(end, e - end, v->value, n);
+        }
     }
 
     return FILP_OK;
@@ -1605,676 +1702,2371 @@ static int _filpf_split(void)
 
 
 /**
- * sprintf - Formats into a string.
- * @value: values to be inserted
- * @format_string: printf style formatting string
+ * join - Joins a list into a string.
+ * @joiner: the joiner string
+ * @list_elements: the elements of the list
  *
- * Makes a printf() -like formatting into a string. As in that
- * function, the percent char is used as a placeholder for
- * a formatting command.
+ * Joins a list into a string, using the string @joiner
+ * as a glue. If used on a task created by spawn, waits for it
+ * to finish and returns the value left in the top of its stack
+ * (NULL if it left none), failing with its error if it failed.
+ * A task can be joined more than once.
  * [String manipulation commands]
+ * [List processing commands]
+ * [Thread commands]
  */
-static int _filpf_sprintf(void)
-/** @value [ @value ... ] @format_string sprintf %result_string */
+static int _filpf_join(void)
+/** [ @list_elements ] @joiner join %string */
 {
-    struct filp_val *s;
+    struct filp_val *j;
     struct filp_val *v;
-    int ivalue;
-    double rvalue;
-    char *str = NULL;
-    int size, n, m, c, i;
-    char tmp[2048];
-    char tmp2[2048];
+    struct filp_val *b;
+    int n, i;
 
-    s = filp_pop();
+    j = filp_pop();
 
-    for (n = m = size = 0; (c = s->value[n++]) != '\0';) {
-        if (c == '%') {
-            if ((c = s->value[n++]) == '%')
-                str = filp_poke(str, &size, m++, '%');
-            else {
-                tmp[0] = '%';
-                for (i = 1; c != '\0' && strchr("-.0123456789", c) != NULL;
-                     i++) {
-                    tmp[i] = c;
-                    c = s->value[n++];
-                }
-                tmp[i++] = c;
-                tmp[i] = '\0';
-
-                switch (tmp[i - 1]) {
-                case 'd':
-                case 'i':
-                case 'x':
-                case 'X':
-                case 'o':
-                case 'c':
-                    ivalue = filp_int_pop();
-                    sprintf(tmp2, tmp, ivalue);
-                    break;
-                case 'f':
-                    rvalue = filp_real_pop();
-                    sprintf(tmp2, tmp, rvalue);
-                    break;
-                case 's':
-                    v = filp_pop();
-                    sprintf(tmp2, tmp, v->value);
-                    break;
-                default:
-                    strcpy(tmp, tmp2);
-                    break;
-                }
-
-                /* transfer */
-                for (i = 0; tmp2[i]; i++)
-                    str = filp_poke(str, &size, m++, tmp2[i]);
-            }
-        }
-        else
-            str = filp_poke(str, &size, m++, c);
+    if (j->type == FILP_TASK)
+        return filp_task_join(j);
+
+    if (j->type != FILP_SCALAR) {
+        _filp_error = FILPERR_SCALAR_EXPECTED;
+        return FILP_ERROR;
     }
 
-    str = filp_poke(str, &size, m++, '\0');
-    filp_scalar_push(str);
-    free(str);
+    /* an empty list gives its NULL marker */
+    if ((n = filp_list_size()) == 0)
+        return FILP_OK;
 
-    return FILP_OK;
-}
+    if ((b = filp_new_builder()) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
 
+    /* the elements are appended in place, from the bottom */
+    for (i = n; i > 0; i--) {
+        v = filp_stack_value(i);
 
-/**
- * sscanf - Scans a string and extracts values.
- * @string: the string to be scanned
- * @format_string: the format string
- *
- * Scans a string and extracts values using a scanf() -like
- * format string.
- * [String manipulation commands]
- */
-static int _filpf_sscanf(void)
-/* funci?n 'sscanf' */
-/** @string @format_string sscanf @value1 @value2 ... */
-{
-    struct filp_val *fv;
-    struct filp_val *vv;
-    char *f;
-    char *v;
-    char *str = NULL;
-    char *ptr;
-    int i, size, dsize, t;
-    char cmd;
+        if (v->type != FILP_SCALAR) {
+            _filp_error = FILPERR_SCALAR_EXPECTED;
+            return FILP_ERROR;
+        }
 
-    fv = filp_pop();
-    vv = filp_pop();
+        if ((i < n && !filp_builder_append(b, j->value, filp_val_len(j))) ||
+            !filp_builder_append(b, v->value, filp_val_len(v))) {
+            _filp_error = FILPERR_OUT_OF_MEMORY;
+            return FILP_ERROR;
+        }
+    }
 
-    f = fv->value;
-    v = vv->value;
+    filp_list_drop();
 
-    size = dsize = 0;
+    /* the result can still be appended to by . */
+    b->type = FILP_SCALAR;
+    b->grow = 1;
 
-    filp_null_push();
+    filp_push(b);
 
-    t = _filp_stack_elems;
+    return FILP_OK;
+}
 
-    while (*v && *f) {
-        cmd = *f;
-        if (cmd == '%') {
-            int ignore = 0;
 
-            /* which format? */
-            f++;
-            dsize = 0;
+/* compiled sprintf formats */
 
-            /* if * follows, value will not be used */
-            if (*f == '*') {
-                ignore = 1;
-                f++;
-            }
+#define FILP_FMT_TEXT   0       /* literal text */
+#define FILP_FMT_INT    1       /* plain %d or %i */
+#define FILP_FMT_STR    2       /* %s, maybe with width or precision */
+#define FILP_FMT_IFMT   3       /* other integer conversions */
+#define FILP_FMT_RFMT   4       /* real conversions */
 
-            /* calculate size, if any */
-            while (strchr("0123456789", *f) != NULL) {
-                dsize *= 10;
-                dsize += (*f) - '0';
-                f++;
-            }
+struct filp_fmt_op {
+    int op;                     /* FILP_FMT_* */
+    int off;                    /* offset of the text in the format */
+    int len;                    /* length of the text */
+    int width;                  /* %s: minimum width */
+    int prec;                   /* %s: maximum length (-1, none) */
+    int left;                   /* %s: left-justify */
+    char spec[32];              /* printf() conversion spec */
+};
 
-            if (*f == 's') {
-                f++;
+struct filp_fmt {
+    int num;                    /* number of ops */
+    int size;                   /* allocated ops */
+    struct filp_fmt_op *ops;    /* the ops */
+    char *text;                 /* copy of the format */
+};
 
-                /* it's a string; store it */
-                if (dsize) {
-                    /* with size */
-                    for (i = 0; i < dsize && *v; i++, v++)
-                        str = filp_poke(str, &size, i, *v);
-                    str = filp_poke(str, &size, i, '\0');
-                }
-                else {
-                    /* no size: next char in format string
-                       is used as a delimiter */
-                    for (i = 0; *v != *f && *v; i++, v++)
-                        str = filp_poke(str, &size, i, *v);
-                    str = filp_poke(str, &size, i, '\0');
-                }
-
-                if (cmd == '%' && !ignore)
-                    filp_scalar_push(str);
-            }
-            else if (*f == 'f' || *f == 'd' || *f == 'i' || *f == 'u' || *f == 'x') {
-                if (*f == 'f')
-                    ptr = "-.0123456789";
-                else if (*f == 'x')
-                    ptr = "-x0123456789abcdefABCDEF";
-                else if (*f == 'u')
-                    ptr = "0123456789";
-                else
-                    ptr = "-0123456789";
 
-                /* take chars while valid */
-                for (i = 0; strchr(ptr, *v) != NULL && *v; i++, v++)
-                    str = filp_poke(str, &size, i, *v);
-                str = filp_poke(str, &size, i, '\0');
+static void _filp_fmt_free(void *p)
+/* frees a compiled format */
+{
+    struct filp_fmt *f = (struct filp_fmt *) p;
 
-                if (*str && !ignore) {
-                    if (*f == 'd' || *f == 'i' || *f == 'u') {
-                        int i;
+    free(f->ops);
+    free(f->text);
+    free(f);
+}
 
-                        i = atoi(str);
-                        filp_int_push(i);
-                    }
-                    else
-                        filp_scalar_push(str);
-                }
 
-                f++;
-            }
-            else if (*f == '%') {
-                if (*f == *v)
-                    f++;
-                else
-                    f--;
-                v++;
-            }
-        }
-        else {
-            if (*f == *v)
-                f++;
-            v++;
+static struct filp_fmt_op *_filp_fmt_add(struct filp_fmt *f, int op, int off, int len)
+/* adds an op to a compiled format */
+{
+    struct filp_fmt_op *o;
+
+    /* consecutive text is merged */
+    if (op == FILP_FMT_TEXT && f->num) {
+        o = &f->ops[f->num - 1];
+
+        if (o->op == FILP_FMT_TEXT && o->off + o->len == off) {
+            o->len += len;
+            return o;
         }
     }
 
-    if (str)
-        free(str);
+    if (f->num == f->size) {
+        f->size = f->size ? f->size * 2 : 8;
+        f->ops = (struct filp_fmt_op *) realloc(f->ops,
+                                f->size * sizeof(struct filp_fmt_op));
+    }
 
-    /* reverses and destroy the NULL list delimiter */
-    if (t != _filp_stack_elems)
-        filp_execf("reverse %d rot pop", _filp_stack_elems - t + 1);
+    o = &f->ops[f->num++];
+    memset(o, '\0', sizeof(struct filp_fmt_op));
 
-    return FILP_OK;
-}
+    o->op = op;
+    o->off = off;
+    o->len = len;
 
+    if (op != FILP_FMT_TEXT) {
+        memcpy(o->spec, f->text + off, len);
+        o->spec[len] = '\0';
+    }
 
-/** arrays **/
+    return o;
+}
 
-/**
- * array - Creates an array.
- * @value: values that are part of the array.
- *
- * Creates an array. The ) character can be used as a synonym,
- * and it's preferred as it's more intuitive. The new array
- * value is left on the top of stack, ready to be asigned
- * or used.
- * [Array commands]
- */
-static int _filpf_array(void)
-/** ( @value @value ... ) %new_array */
-/** ( @value @value array %new_array */
+
+static int _filp_fmt_str_spec(struct filp_fmt_op *o)
+/* parses the flags, width and precision of a %s spec */
 {
-    struct filp_val *a;
-    struct filp_val *e;
-    int n;
+    char *ptr = o->spec + 1;
 
-    n = filp_list_size();
+    o->prec = -1;
 
-    a = filp_new_value(FILP_ARRAY, NULL, n);
+    for (; *ptr == '-' || *ptr == '0'; ptr++)
+        if (*ptr == '-')
+            o->left = 1;
 
-    for (; n > 0; n--) {
-        e = filp_pop();
-        if (e->type == FILP_NULL)
-            break;
+    for (; *ptr >= '0' && *ptr <= '9'; ptr++)
+        o->width = o->width * 10 + *ptr - '0';
 
-        filp_array_set(a, e, n);
+    if (*ptr == '.') {
+        for (o->prec = 0, ptr++; *ptr >= '0' && *ptr <= '9'; ptr++)
+            o->prec = o->prec * 10 + *ptr - '0';
     }
 
-    /* here there should be a NULL, so drop it */
-    filp_pop();
-
-    filp_push(a);
-
-    return FILP_OK;
+    return *ptr == 's';
 }
 
 
-static struct filp_val *filp_array_pop(int *imm, int create)
+static struct filp_fmt *_filp_fmt_compile(char *text, int l)
+/* compiles a sprintf format of length l */
 {
-    struct filp_sym *s;
-    struct filp_val *a;
-    struct filp_val *v;
+    struct filp_fmt *f;
+    struct filp_fmt_op *o;
+    char *ptr;
+    int n, i;
 
-    v = filp_pop();
+    if ((f = (struct filp_fmt *) calloc(1, sizeof(struct filp_fmt))) == NULL)
+        return NULL;
 
-    a = NULL;
+    if ((f->text = (char *) malloc(l + 1)) == NULL) {
+        free(f);
+        return NULL;
+    }
 
-    if (v->type == FILP_SCALAR) {
-        /* it's not an immediate value */
-        *imm = 0;
+    memcpy(f->text, text, l + 1);
+    text = f->text;
 
-        /* is it a symbol name? */
-        if ((s = filp_find_symbol(v->value)) != NULL) {
-            if (s->value->type == FILP_ARRAY)
-                a = s->value;
+    for (n = 0; n < l;) {
+        if ((ptr = memchr(text + n, '%', l - n)) == NULL) {
+            _filp_fmt_add(f, FILP_FMT_TEXT, n, l - n);
+            break;
         }
-        else if (create) {
-            a = filp_new_value(FILP_ARRAY, NULL, 0);
 
-            s = filp_new_symbol(FILP_ARRAY, v->value);
-            filp_set_symbol(s, a);
+        if (ptr > text + n)
+            _filp_fmt_add(f, FILP_FMT_TEXT, n, ptr - text - n);
+
+        n = ptr - text;
+
+        if (n + 1 < l && text[n + 1] == '%') {
+            _filp_fmt_add(f, FILP_FMT_TEXT, n + 1, 1);
+            n += 2;
+            continue;
         }
-    }
-    else if (v->type == FILP_ARRAY) {
-        *imm = 1;
-        a = v;
-    }
 
-    if (a == NULL)
-        _filp_error = FILPERR_ARRAY_EXPECTED;
+        /* flags, width and precision */
+        for (i = n + 1; i < l && text[i] && strchr("-.0123456789", text[i]); i++);
 
-    return a;
+        /* an unfinished or too long spec is kept as is */
+        if (i == l || i - n + 2 > (int) sizeof(o->spec)) {
+            _filp_fmt_add(f, FILP_FMT_TEXT, n, i - n);
+            n = i;
+            continue;
+        }
+
+        switch (text[i]) {
+        case 'd':
+        case 'i':
+            _filp_fmt_add(f, i == n + 1 ? FILP_FMT_INT : FILP_FMT_IFMT, n, i - n + 1);
+            break;
+
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            _filp_fmt_add(f, FILP_FMT_IFMT, n, i - n + 1);
+            break;
+
+        case 'f':
+            _filp_fmt_add(f, FILP_FMT_RFMT, n, i - n + 1);
+            break;
+
+        case 's':
+            o = _filp_fmt_add(f, FILP_FMT_STR, n, i - n + 1);
+
+            /* not understood: keep it as is */
+            if (!_filp_fmt_str_spec(o))
+                o->op = FILP_FMT_TEXT;
+
+            break;
+
+        default:
+            /* unknown conversions are kept as is */
+            _filp_fmt_add(f, FILP_FMT_TEXT, n, i - n + 1);
+            break;
+        }
+
+        n = i + 1;
+    }
+
+    return f;
+}
+
+
+static int _filp_fmt_append(struct filp_val *b, char *spec, ...)
+/* appends a printf() formatted value to a builder */
+{
+    char tmp[128];
+    char *ptr = tmp;
+    va_list ap;
+    int n, ret;
+
+    va_start(ap, spec);
+    n = vsnprintf(tmp, sizeof(tmp), spec, ap);
+    va_end(ap);
+
+    /* too big for the buffer: format it again */
+    if (n >= (int) sizeof(tmp)) {
+        if ((ptr = (char *) malloc(n + 1)) == NULL)
+            return 0;
+
+        va_start(ap, spec);
+        vsnprintf(ptr, n + 1, spec, ap);
+        va_end(ap);
+    }
+
+    ret = n < 0 || filp_builder_append(b, ptr, n);
+
+    if (ptr != tmp)
+        free(ptr);
+
+    return ret;
+}
+
+
+static int _filp_fmt_run(struct filp_fmt *f, struct filp_val *b)
+/* runs a compiled format, popping the values and appending to b */
+{
+    struct filp_fmt_op *o;
+    struct filp_val *v;
+    char tmp[16];
+    int n, l, w, ret = 1;
+
+    for (n = 0; ret && n < f->num; n++) {
+        o = &f->ops[n];
+
+        switch (o->op) {
+        case FILP_FMT_TEXT:
+            ret = filp_builder_append(b, f->text + o->off, o->len);
+            break;
+
+        case FILP_FMT_INT:
+            ret = filp_builder_append(b, tmp, filp_itoa(tmp, filp_int_pop()));
+            break;
+
+        case FILP_FMT_STR:
+            v = filp_pop();
+            l = filp_val_len(v);
+
+            if (o->prec != -1 && l > o->prec)
+                l = o->prec;
+
+            for (w = l; ret && !o->left && w < o->width; w++)
+                ret = filp_builder_append(b, " ", 1);
+
+            ret = ret && filp_builder_append(b, v->value, l);
+
+            for (w = l; ret && o->left && w < o->width; w++)
+                ret = filp_builder_append(b, " ", 1);
+
+            break;
+
+        case FILP_FMT_IFMT:
+            ret = _filp_fmt_append(b, o->spec, filp_int_pop());
+            break;
+
+        case FILP_FMT_RFMT:
+            ret = _filp_fmt_append(b, o->spec, filp_real_pop());
+            break;
+        }
+    }
+
+    return ret;
+}
+
+
+/**
+ * sprintf - Formats into a string.
+ * @value: values to be inserted
+ * @format_string: printf style formatting string
+ *
+ * Makes a printf() -like formatting into a string. As in that
+ * function, the percent char is used as a placeholder for
+ * a formatting command. Formats are compiled the first time
+ * they are used and kept with the format string.
+ * [String manipulation commands]
+ */
+static int _filpf_sprintf(void)
+/** @value [ @value ... ] @format_string sprintf %result_string */
+{
+    struct filp_val *s;
+    struct filp_val *b;
+    struct filp_fmt *f;
+    int ret;
+
+    s = filp_pop();
+
+    if ((f = (struct filp_fmt *) s->cache) == NULL || s->cache_free != _filp_fmt_free) {
+        if ((f = _filp_fmt_compile(s->value, filp_val_len(s))) == NULL) {
+            _filp_error = FILPERR_OUT_OF_MEMORY;
+            return FILP_ERROR;
+        }
+
+        /* keep it, if the cache is not used by anything else
+           (scalar views use it for the value holding their bytes) */
+        if (s->type == FILP_SCALAR && s->cache == NULL) {
+            s->cache = f;
+            s->cache_free = _filp_fmt_free;
+        }
+    }
+
+    if ((b = filp_new_builder()) != NULL)
+        ret = _filp_fmt_run(f, b);
+    else
+        ret = 0;
+
+    if (s->cache != f)
+        _filp_fmt_free(f);
+
+    if (!ret) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    b->type = FILP_SCALAR;
+    b->grow = 1;
+
+    filp_push(b);
+
+    return FILP_OK;
+}
+
+
+/* compiled sscanf formats */
+
+#define FILP_SCAN_LIT   0       /* skip up to a char */
+#define FILP_SCAN_STR   1       /* %s */
+#define FILP_SCAN_NUM   2       /* %d, %i, %u, %x or %f */
+
+/* chars accepted by the numeric conversions */
+#define FILP_SC_DIGIT   1
+#define FILP_SC_MINUS   2
+#define FILP_SC_DOT     4
+#define FILP_SC_HEX     8
+
+static unsigned char _filp_scan_class[256] = {
+    ['0'] = FILP_SC_DIGIT, ['1'] = FILP_SC_DIGIT, ['2'] = FILP_SC_DIGIT,
+    ['3'] = FILP_SC_DIGIT, ['4'] = FILP_SC_DIGIT, ['5'] = FILP_SC_DIGIT,
+    ['6'] = FILP_SC_DIGIT, ['7'] = FILP_SC_DIGIT, ['8'] = FILP_SC_DIGIT,
+    ['9'] = FILP_SC_DIGIT, ['-'] = FILP_SC_MINUS, ['.'] = FILP_SC_DOT,
+    ['a'] = FILP_SC_HEX, ['b'] = FILP_SC_HEX, ['c'] = FILP_SC_HEX,
+    ['d'] = FILP_SC_HEX, ['e'] = FILP_SC_HEX, ['f'] = FILP_SC_HEX,
+    ['A'] = FILP_SC_HEX, ['B'] = FILP_SC_HEX, ['C'] = FILP_SC_HEX,
+    ['D'] = FILP_SC_HEX, ['E'] = FILP_SC_HEX, ['F'] = FILP_SC_HEX,
+    ['x'] = FILP_SC_HEX
+};
+
+struct filp_scan_op {
+    int op;                     /* FILP_SCAN_* */
+    int c;                      /* char, delimiter (-1, none) or conversion */
+    int width;                  /* %s: number of chars (0, up to c) */
+    int set;                    /* numbers: mask of FILP_SC_* */
+    int ignore;                 /* %*: don't store */
+};
+
+struct filp_scan {
+    int num;                    /* number of ops */
+    int fields;                 /* number of stored fields */
+    struct filp_scan_op ops[1]; /* the ops */
+};
+
+
+static void _filp_scan_free(void *p)
+/* frees a compiled sscanf format */
+{
+    free(p);
+}
+
+
+static struct filp_scan *_filp_scan_compile(char *f)
+/* compiles a sscanf format */
+{
+    struct filp_scan *s;
+    struct filp_scan_op *o;
+
+    /* no format char generates more than one op */
+    s = (struct filp_scan *) malloc(sizeof(struct filp_scan) +
+                                    strlen(f) * sizeof(struct filp_scan_op));
+    if (s == NULL)
+        return NULL;
+
+    s->num = s->fields = 0;
+
+    while (*f) {
+        o = &s->ops[s->num];
+        memset(o, '\0', sizeof(struct filp_scan_op));
+
+        if (*f == '%') {
+            f++;
+
+            /* if * follows, value will not be used */
+            if (*f == '*') {
+                o->ignore = 1;
+                f++;
+            }
+
+            /* width, if any */
+            for (; *f >= '0' && *f <= '9'; f++)
+                o->width = o->width * 10 + *f - '0';
+
+            if (*f == '\0')
+                break;
+
+            if (*f == 's') {
+                /* with no width, the next char in the format
+                   string is used as a delimiter */
+                o->op = FILP_SCAN_STR;
+                o->c = f[1] ? (unsigned char) f[1] : -1;
+            }
+            else
+            if (strchr("fdiux", *f) != NULL) {
+                o->op = FILP_SCAN_NUM;
+                o->c = *f;
+                o->width = 0;
+
+                if (*f == 'f')
+                    o->set = FILP_SC_DIGIT | FILP_SC_MINUS | FILP_SC_DOT;
+                else
+                if (*f == 'x')
+                    o->set = FILP_SC_DIGIT | FILP_SC_MINUS | FILP_SC_HEX;
+                else
+                if (*f == 'u')
+                    o->set = FILP_SC_DIGIT;
+                else
+                    o->set = FILP_SC_DIGIT | FILP_SC_MINUS;
+            }
+            else {
+                /* %% and unknown conversions match their char */
+                o->op = FILP_SCAN_LIT;
+                o->c = (unsigned char) *f;
+            }
+        }
+        else {
+            o->op = FILP_SCAN_LIT;
+            o->c = (unsigned char) *f;
+        }
+
+        if (o->op != FILP_SCAN_LIT && !o->ignore)
+            s->fields++;
+
+        s->num++;
+        f++;
+    }
+
+    return s;
+}
+
+
+static struct filp_val *_filp_scan_int(char *p, int l)
+/* converts the chars of a %d field as atoi() does */
+{
+    unsigned int u = 0;
+    int i = 0;
+
+    if (l && p[0] == '-')
+        i++;
+
+    for (; i < l && p[i] >= '0' && p[i] <= '9'; i++)
+        u = u * 10 + p[i] - '0';
+
+    return filp_new_int_value(l && p[0] == '-' ? -(int) u : (int) u);
+}
+
+
+/**
+ * filp_sscanf - Scans a string using a sscanf format.
+ * @fmt: the format string
+ * @str: the string to be scanned
+ * @len: length of @str
+ *
+ * Extracts the fields of the @len bytes of @str described by
+ * the scanf() -like format string @fmt (see sscanf) and pushes
+ * them into the stack, the first one on top. The format is
+ * compiled the first time it is used and kept in @fmt.
+ * Returns the number of pushed fields, or -1 if out of memory.
+ */
+int filp_sscanf(struct filp_val *fmt, char *str, int len)
+{
+    struct filp_scan *s;
+    struct filp_scan_op *o;
+    struct filp_val *tmp[16];
+    struct filp_val **vals = tmp;
+    struct filp_val *v;
+    char *e = str + len;
+    char *p;
+    int n, l, i;
+
+    if ((s = (struct filp_scan *) fmt->cache) == NULL ||
+        fmt->cache_free != _filp_scan_free) {
+        if ((s = _filp_scan_compile(fmt->value)) == NULL)
+            return -1;
+
+        /* keep it, as sprintf does */
+        if (fmt->type == FILP_SCALAR && fmt->cache == NULL) {
+            fmt->cache = s;
+            fmt->cache_free = _filp_scan_free;
+        }
+    }
+
+    if (s->fields > (int) (sizeof(tmp) / sizeof(tmp[0])) &&
+        (vals = (struct filp_val **) malloc(s->fields * sizeof(struct filp_val *))) == NULL)
+        n = -1;
+    else
+        n = 0;
+
+    for (i = 0; n != -1 && str < e && i < s->num; i++) {
+        o = &s->ops[i];
+        v = NULL;
+
+        switch (o->op) {
+        case FILP_SCAN_LIT:
+            /* chars up to the matching one are skipped */
+            p = memchr(str, o->c, e - str);
+            str = p ? p + 1 : e;
+            break;
+
+        case FILP_SCAN_STR:
+            if (o->width)
+                l = o->width < e - str ? o->width : e - str;
+            else
+            if (o->c != -1 && (p = memchr(str, o->c, e - str)) != NULL)
+                l = p - str;
+            else
+                l = e - str;
+
+            if (!o->ignore)
+                v = filp_new_scalar_len(str, l);
+
+            str += l;
+            break;
+
+        case FILP_SCAN_NUM:
+            /* take chars while valid */
+            for (l = 0; str + l < e &&
+                 (_filp_scan_class[(unsigned char) str[l]] & o->set); l++);
+
+            if (l && !o->ignore) {
+                if (o->c == 'f' || o->c == 'x')
+                    v = filp_new_scalar_len(str, l);
+                else
+                    v = _filp_scan_int(str, l);
+            }
+
+            str += l;
+            break;
+        }
+
+        if (v != NULL)
+            vals[n++] = v;
+    }
+
+    /* the fields are pushed from the last one */
+    for (i = n; i > 0; i--)
+        filp_push(vals[i - 1]);
+
+    if (vals != tmp)
+        free(vals);
+
+    if (s != fmt->cache)
+        _filp_scan_free(s);
+
+    return n;
+}
+
+
+/**
+ * sscanf - Scans a string and extracts values.
+ * @string: the string to be scanned
+ * @format_string: the format string
+ *
+ * Scans a string and extracts values using a scanf() -like
+ * format string. The extracted values are left in the stack,
+ * the first one on top. If none can be extracted, NULL is
+ * pushed instead.
+ * [String manipulation commands]
+ */
+static int _filpf_sscanf(void)
+/* funci?n 'sscanf' */
+/** @string @format_string sscanf @value1 @value2 ... */
+{
+    struct filp_val *fv;
+    struct filp_val *vv;
+    int n;
+
+    fv = filp_pop();
+    vv = filp_pop();
+
+    if ((n = filp_sscanf(fv, vv->value, filp_val_len(vv))) == -1) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    if (n == 0)
+        filp_null_push();
+
+    return FILP_OK;
+}
+
+
+/** arrays **/
+
+/**
+ * array - Creates an array.
+ * @value: values that are part of the array.
+ *
+ * Creates an array. The ) character can be used as a synonym,
+ * and it's preferred as it's more intuitive. The new array
+ * value is left on the top of stack, ready to be asigned
+ * or used.
+ * [Array commands]
+ */
+static int _filpf_array(void)
+/** ( @value @value ... ) %new_array */
+/** ( @value @value array %new_array */
+{
+    struct filp_val *a;
+    struct filp_val *e;
+    int n;
+
+    n = filp_list_size();
+
+    a = filp_new_value(FILP_ARRAY, NULL, n);
+
+    for (; n > 0; n--) {
+        e = filp_pop();
+        if (e->type == FILP_NULL)
+            break;
+
+        filp_array_set(a, e, n);
+    }
+
+    /* here there should be a NULL, so drop it */
+    filp_pop();
+
+    filp_push(a);
+
+    return FILP_OK;
+}
+
+
+/**
+ * filp_array_pop - Pops an array from the stack.
+ * @imm: pointer to store the immediate flag
+ * @create: create the array symbol if it does not exist
+ *
+ * Pops an array from the stack. The popped value can be an array
+ * (an immediate value, and @imm is set to 1) or the name of a
+ * symbol containing an array (@imm is set to 0). If @create
+ * is set and the symbol does not exist, it's created as an
+ * empty array. Returns the array, or NULL (setting the
+ * FILPERR_ARRAY_EXPECTED error) if no array could be taken.
+ */
+struct filp_val *filp_array_pop(int *imm, int create)
+{
+    struct filp_sym *s;
+    struct filp_val *a;
+    struct filp_val *v;
+
+    v = filp_pop();
+
+    a = NULL;
+
+    if (v->type == FILP_SCALAR) {
+        /* it's not an immediate value */
+        *imm = 0;
+
+        /* is it a symbol name? */
+        if ((s = filp_find_symbol(v->value)) != NULL) {
+            if (s->value->type == FILP_ARRAY)
+                a = s->value;
+        }
+        else if (create) {
+            a = filp_new_value(FILP_ARRAY, NULL, 0);
+
+            s = filp_new_symbol(FILP_ARRAY, v->value);
+            filp_set_symbol(s, a);
+        }
+    }
+    else if (v->type == FILP_ARRAY) {
+        *imm = 1;
+        a = v;
+    }
+
+    if (a == NULL)
+        _filp_error = FILPERR_ARRAY_EXPECTED;
+
+    return a;
+}
+
+
+static struct filp_val *_filp_vector_pop(int *imm)
+/* pops a vector (or the name of a vector symbol), if there is one */
+{
+    struct filp_val *v;
+    struct filp_sym *s;
+
+    v = filp_stack_value(1);
+
+    if (v->type == FILP_VECTOR)
+        *imm = 1;
+    else if (v->type == FILP_SCALAR &&
+             (s = filp_find_symbol(v->value)) != NULL && s->type == FILP_VECTOR) {
+        *imm = 0;
+        v = s->value;
+    }
+    else
+        return NULL;
+
+    filp_pop();
+
+    return v;
+}
+
+
+/**
+ * vector - Creates a numeric vector.
+ * @size: the number of elements, or an array
+ * @type: the type of the elements ('real' or 'int')
+ *
+ * Creates a numeric vector of @size elements, all set to zero,
+ * or with the elements of an array converted to numbers. The
+ * elements of a vector are packed numbers (doubles or 64 bit
+ * integers) instead of filp values, so they can be shared with
+ * C code without copying (see filp_new_vector()). The @, @=,
+ * forall and map commands work on vectors as on arrays, but
+ * vectors cannot grow or shrink and, unlike arrays, are not
+ * copied when assigned to symbols or pushed to the stack.
+ * [Array commands]
+ */
+static int _filpf_vector(void)
+/** @size @type vector %vector */
+/** @array @type vector %vector */
+{
+    struct filp_val *t;
+    struct filp_val *a;
+    struct filp_val *v;
+    int n, kind;
+
+    t = filp_pop();
+    a = filp_pop();
+
+    kind = strcmp(t->value, "int") == 0 ? FILP_VEC_INT : FILP_VEC_REAL;
+
+    if (a->type == FILP_ARRAY) {
+        v = filp_new_vector(kind, NULL, filp_array_size(a));
+
+        for (n = 1; n <= filp_array_size(a); n++)
+            filp_vector_set(v, filp_array_get(a, n), n);
+    }
+    else
+        v = filp_new_vector(kind, NULL, filp_val_to_int(a));
+
+    if (v == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    filp_push(v);
+
+    return FILP_OK;
+}
+
+
+/**
+ * varray - Converts a numeric vector to an array.
+ * @vector: the vector
+ *
+ * Returns an array with the elements of a numeric vector.
+ * To convert an array to a vector, use vector.
+ * [Array commands]
+ */
+static int _filpf_varray(void)
+/** @vector varray %array */
+{
+    struct filp_val *v;
+    struct filp_val *a;
+    int n;
+
+    v = filp_pop();
+
+    if (v->type != FILP_VECTOR) {
+        _filp_error = FILPERR_VECTOR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    a = filp_new_value(FILP_ARRAY, NULL, filp_vector_size(v));
+
+    for (n = 1; n <= filp_vector_size(v); n++)
+        filp_array_set(a, filp_vector_get(v, n), n);
+
+    filp_push(a);
+
+    return FILP_OK;
+}
+
+
+static int _filp_vector_op(int op)
+{
+    struct filp_val *a;
+    struct filp_val *b;
+    struct filp_val *r;
+
+    b = filp_pop();
+    a = filp_pop();
+
+    if ((r = filp_vector_op(op, a, b)) == NULL) {
+        _filp_error = FILPERR_VECTOR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    filp_push(r);
+
+    return FILP_OK;
+}
+
+
+/**
+ * v+ - Adds numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a new vector with the sums of each pair of elements
+ * of the two vectors. If one of them is a scalar, it's added to
+ * all the elements of the other one. The result holds integers if
+ * both operands do, and reals otherwise. If the vectors differ in
+ * size, the result is as long as the shortest one. These vector
+ * operations use SIMD instructions if the processor has them.
+ * [Array commands]
+ */
+static int _filpf_vadd(void)
+/** @v1 @v2 v+ %vector */
+{
+    return _filp_vector_op(FILP_VOP_ADD);
+}
+
+
+/**
+ * v- - Subtracts numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a new vector with the differences of each pair
+ * of elements of the two vectors. See v+.
+ * [Array commands]
+ */
+static int _filpf_vsub(void)
+/** @v1 @v2 v- %vector */
+{
+    return _filp_vector_op(FILP_VOP_SUB);
+}
+
+
+/**
+ * v* - Multiplies numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a new vector with the products of each pair
+ * of elements of the two vectors. See v+.
+ * [Array commands]
+ */
+static int _filpf_vmul(void)
+/** @v1 @v2 v* %vector */
+{
+    return _filp_vector_op(FILP_VOP_MUL);
+}
+
+
+/**
+ * v/ - Divides numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a new vector with the quotients of each pair
+ * of elements of the two vectors. Integer divisions by zero
+ * give zero. See v+.
+ * [Array commands]
+ */
+static int _filpf_vdiv(void)
+/** @v1 @v2 v/ %vector */
+{
+    return _filp_vector_op(FILP_VOP_DIV);
+}
+
+
+/**
+ * vscale - Scales a numeric vector.
+ * @vector: the vector
+ * @factor: the scaling factor
+ *
+ * Returns a new vector with all the elements of @vector
+ * multiplied by @factor. It's the same as v* with a scalar.
+ * [Array commands]
+ */
+static int _filpf_vscale(void)
+/** @vector @factor vscale %vector */
+{
+    return _filp_vector_op(FILP_VOP_MUL);
+}
+
+
+/**
+ * v< - Compares numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a mask: an integer vector holding 1 where the element
+ * of @v1 is lower than the one in @v2, and 0 elsewhere. See v+.
+ * [Array commands]
+ */
+static int _filpf_vlt(void)
+/** @v1 @v2 v< %mask */
+{
+    return _filp_vector_op(FILP_VOP_LT);
+}
+
+
+/**
+ * v> - Compares numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a mask: an integer vector holding 1 where the element
+ * of @v1 is greater than the one in @v2, and 0 elsewhere. See v+.
+ * [Array commands]
+ */
+static int _filpf_vgt(void)
+/** @v1 @v2 v> %mask */
+{
+    return _filp_vector_op(FILP_VOP_GT);
+}
+
+
+/**
+ * v== - Compares numeric vectors.
+ * @v1: first vector (or scalar)
+ * @v2: second vector (or scalar)
+ *
+ * Returns a mask: an integer vector holding 1 where the elements
+ * of @v1 and @v2 are equal, and 0 elsewhere. See v+.
+ * [Array commands]
+ */
+static int _filpf_veq(void)
+/** @v1 @v2 v== %mask */
+{
+    return _filp_vector_op(FILP_VOP_EQ);
+}
+
+
+/**
+ * vdot - Returns the dot product of two numeric vectors.
+ * @v1: first vector
+ * @v2: second vector
+ *
+ * Returns the sum of the products of each pair of elements
+ * of the two vectors, as a real number. See v+.
+ * [Array commands]
+ */
+static int _filpf_vdot(void)
+/** @v1 @v2 vdot %real */
+{
+    struct filp_val *a;
+    struct filp_val *b;
+
+    b = filp_pop();
+    a = filp_pop();
+
+    if (a->type != FILP_VECTOR && b->type != FILP_VECTOR) {
+        _filp_error = FILPERR_VECTOR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    filp_real_push(filp_vector_dot(a, b));
+
+    return FILP_OK;
+}
+
+
+/* reductions */
+
+struct _filp_reduce {
+    int num;                    /* number of values */
+    filp_int64 isum, imin, imax;        /* integer mode */
+    double rsum, rmin, rmax;    /* real mode */
+};
+
+
+static void _filp_reduce_val(struct _filp_reduce *r, struct filp_val *v)
+/* accumulates a value, converted as arithmetic commands do */
+{
+    filp_int64 i;
+    double d;
+
+    /* holes and non-scalars are ignored */
+    if (v == NULL || v->type != FILP_SCALAR)
+        return;
+
+    if (_filp_real) {
+        d = strtod(v->value, NULL);
+
+        /* NaNs are skipped, as in filp_vector_reduce() */
+        r->rsum += d;
+        if (r->num == 0 || d < r->rmin || r->rmin != r->rmin)
+            r->rmin = d;
+        if (r->num == 0 || d > r->rmax || r->rmax != r->rmax)
+            r->rmax = d;
+    }
+    else {
+        i = strtoll(v->value, NULL, 0);
+
+        r->isum += i;
+        if (r->num == 0 || i < r->imin)
+            r->imin = i;
+        if (r->num == 0 || i > r->imax)
+            r->imax = i;
+    }
+
+    r->num++;
+}
+
+
+static int _filp_reduce(int op)
+{
+    struct _filp_reduce r;
+    struct filp_val *v;
+    int n;
+
+    memset(&r, '\0', sizeof(r));
+
+    v = filp_stack_value(1);
+
+    if (v->type == FILP_VECTOR) {
+        filp_pop();
+        filp_push(filp_vector_reduce(op, v));
+
+        return FILP_OK;
+    }
+
+    if (v->type == FILP_ARRAY) {
+        /* walk the array storage */
+        filp_pop();
+
+        for (n = 1; n <= filp_array_size(v); n++)
+            _filp_reduce_val(&r, filp_array_get(v, n));
+    }
+    else {
+        /* a list: consume it, including the NULL delimiter */
+        while ((v = filp_pop())->type != FILP_NULL)
+            _filp_reduce_val(&r, v);
+    }
+
+    if (op == FILP_VRED_COUNT)
+        filp_int_push(r.num);
+    else if (r.num == 0)
+        filp_null_push();
+    else if (op == FILP_VRED_MEAN)
+        filp_real_push((_filp_real ? r.rsum : (double) r.isum) / r.num);
+    else if (_filp_real)
+        filp_real_push(op == FILP_VRED_SUM ? r.rsum :
+                       op == FILP_VRED_MIN ? r.rmin : r.rmax);
+    else
+        filp_push(filp_new_int64_value(op == FILP_VRED_SUM ? r.isum :
+                                       op == FILP_VRED_MIN ? r.imin : r.imax));
+
+    return FILP_OK;
+}
+
+
+/**
+ * sum - Adds all the elements of an array, vector or list.
+ * @array: the array, numeric vector or list
+ *
+ * Returns the sum of all the elements of an array, a numeric
+ * vector or a list, computed directly instead of executing code
+ * for each element. Elements are converted to numbers as the
+ * arithmetic commands do, so the result is an integer or a real
+ * depending on the value of filp_real; for vectors, it depends
+ * on the type of its elements. Elements that are not scalars
+ * (like NULLs or nested arrays) are ignored. Vectors are reduced
+ * using SIMD instructions, if available. Returns NULL if there
+ * are no elements.
+ * [Array commands]
+ * [List processing commands]
+ * [Math commands]
+ */
+static int _filpf_sum(void)
+/** @array sum %number */
+/** @vector sum %number */
+/** [ @list_elements ] sum %number */
+{
+    return _filp_reduce(FILP_VRED_SUM);
+}
+
+
+/**
+ * min - Returns the minimum element of an array, vector or list.
+ * @array: the array, numeric vector or list
+ *
+ * Returns the lowest numeric value of all the elements of an
+ * array, a numeric vector or a list. NaNs are skipped. See sum.
+ * [Array commands]
+ * [List processing commands]
+ * [Math commands]
+ */
+static int _filpf_min(void)
+/** @array min %number */
+/** @vector min %number */
+/** [ @list_elements ] min %number */
+{
+    return _filp_reduce(FILP_VRED_MIN);
+}
+
+
+/**
+ * max - Returns the maximum element of an array, vector or list.
+ * @array: the array, numeric vector or list
+ *
+ * Returns the greatest numeric value of all the elements of an
+ * array, a numeric vector or a list. NaNs are skipped. See sum.
+ * [Array commands]
+ * [List processing commands]
+ * [Math commands]
+ */
+static int _filpf_max(void)
+/** @array max %number */
+/** @vector max %number */
+/** [ @list_elements ] max %number */
+{
+    return _filp_reduce(FILP_VRED_MAX);
+}
+
+
+/**
+ * mean - Returns the mean of the elements of an array, vector or list.
+ * @array: the array, numeric vector or list
+ *
+ * Returns the arithmetic mean of all the elements of an array,
+ * a numeric vector or a list, always as a real number. See sum.
+ * [Array commands]
+ * [List processing commands]
+ * [Math commands]
+ */
+static int _filpf_mean(void)
+/** @array mean %real */
+/** @vector mean %real */
+/** [ @list_elements ] mean %real */
+{
+    return _filp_reduce(FILP_VRED_MEAN);
+}
+
+
+/**
+ * count - Counts the elements of an array, vector or list.
+ * @array: the array, numeric vector or list
+ *
+ * Returns the number of elements of an array, a numeric vector
+ * or a list that are taken into account by sum, min, max and
+ * mean (i.e. the scalar ones). Unlike lsize, the list is
+ * consumed.
+ * [Array commands]
+ * [List processing commands]
+ */
+static int _filpf_count(void)
+/** @array count %number */
+/** @vector count %number */
+/** [ @list_elements ] count %number */
+{
+    return _filp_reduce(FILP_VRED_COUNT);
+}
+
+
+/**
+ * aget - Gets an element from an array.
+ * @array: the array
+ * @subscript: the number of the element to be taken
+ *
+ * Gets the element number @subscript from the @array. If
+ * @subscript is out of range, NULL is returned instead.
+ * The array subscripts in filp starts at 1; the 0 element
+ * contains the total number of elements in the array.
+ * [Array commands]
+ */
+static int _filpf_array_get(void)
+/** @array @subscript @ %element */
+/** @array @subscript aget %element */
+{
+    int n, i;
+    struct filp_val *a;
+    struct filp_val *v;
+
+    n = filp_int_pop();
+
+    if ((a = _filp_vector_pop(&i)) != NULL) {
+        if (n == 0)
+            filp_int_push(filp_vector_size(a));
+        else if ((v = filp_vector_get(a, n)) != NULL)
+            filp_push(v);
+        else
+            filp_null_push();
+
+        return FILP_OK;
+    }
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    if (n == 0)
+        filp_int_push(filp_array_size(a));
+    else if ((v = filp_array_get(a, n)) != NULL)
+        filp_push(v);
+    else
+        filp_null_push();
+
+    return FILP_OK;
+}
+
+
+static int _filpf_array_setins(char *token)
+{
+    struct filp_val *v;
+    struct filp_val *a;
+    int n, i;
+    int ret = 0;
+
+    v = filp_pop();
+    n = filp_int_pop();
+
+    /* vectors can only be assigned */
+    if (strcmp(token, "aset") == 0 && (a = _filp_vector_pop(&i)) != NULL) {
+        filp_vector_set(a, v, n);
+
+        if (i)
+            filp_push(a);
+
+        return FILP_OK;
+    }
+
+    if ((a = filp_array_pop(&i, 1)) == NULL)
+        return FILP_ERROR;
+
+    if (strcmp(token, "ains") == 0)
+        filp_array_ins(a, v, n);
+    else
+        filp_array_set(a, v, n);
+
+    if (i)
+        filp_push(a);
+
+    return ret;
+}
+
+
+/**
+ * aset - Assigns a value to an element of an array.
+ * @array: the array or array symbol
+ * @subscript: the subscript number to be asigned
+ * @value: the value to be set
+ *
+ * Assigns a @value to the element @subscript of an @array.
+ * Remember that the array subscripts in filp start at 1.
+  * The @= command can be used as a synonym.
+ * [Array commands]
+ */
+/** @array_symbol @subscript @value aset */
+/** @array @subscript @value aset %modified_array */
+static int _filpf_array_set(void)
+{
+    return _filpf_array_setins("aset");
+}
+
+/**
+ * ains - Inserts a value into an array.
+ * @array: the array or array symbol
+ * @subscript: the subscript number of the insertion position
+ * @value: the value to be inserted
+ *
+ * Inserts a @value into the @subscript position of an @array.
+ * The elements with greater subscripts move up one position,
+ * incrementing the total size of the array by 1.
+ * Remember that the array subscripts in filp start at 1. If the
+ * subscript is 0 (array size), the element is added to the end.
+ * [Array commands]
+ */
+/** @array_symbol @subscript @value ains */
+/** @array @subscript @value ains %modified_array */
+static int _filpf_array_ins(void)
+{
+    return _filpf_array_setins("ains");
+}
+
+
+/**
+ * adump - Dumps an array as a list.
+ * @array: the array to be dumped.
+ *
+ * Dumps an array as a list.
+ * [Array commands]
+ */
+static int _filpf_array_dump(void)
+/** @array adump [ %array_elements ] */
+{
+    int i, n;
+    struct filp_val *a;
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_null_push();
+
+    for (n = 1; n <= a->size; n++)
+        filp_push(filp_array_get(a, n));
+
+    return FILP_OK;
+}
+
+
+/**
+ * adel - Deletes an element from an array.
+ * @array: the array or array symbol
+ * @subscript: subscript of the element to be deleted
+ *
+ * Deletes an element from an @array. The array shrinks.
+ * If @subscript is zero, the last element is deleted and
+ * if it's out of range, nothing happens.
+ * [Array commands]
+ */
+static int _filpf_array_del(void)
+/** @array_symbol @subscript adel */
+/** @array @subscript adel %modified_array */
+{
+    int n, i;
+    struct filp_val *a;
+
+    n = filp_int_pop();
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_array_del(a, n);
+
+    if (i)
+        filp_push(a);
+
+    return FILP_OK;
+}
+
+
+/**
+ * aseek - Seeks an array for a scalar.
+ * @array: the array to be searched into
+ * @scalar: the value to be found
+ *
+ * Seeks an array in search of a string.
+ * Returns the subscript where the scalar is, or 0 if not found.
+ * [Array commands]
+ */
+/** @array @scalar aseek %subscript */
+int _filpf_array_seek(void)
+{
+    int i;
+    struct filp_val *v;
+    struct filp_val *a;
+
+    v = filp_pop();
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_int_push(filp_array_seek(a, v->value, 1));
+
+    return FILP_OK;
+}
+
+
+/**
+ * abseek - Seeks a sorted array for a scalar.
+ * @array: the array to be searched into
+ * @scalar: the value to be found
+ *
+ * Seeks a sorted array in search of a string.
+ * Returns the subscript where the scalar is if positive,
+ * or the position where it should be if negative.
+ * [Array commands]
+ */
+/** @array @scalar abseek %subscript */
+int _filpf_array_binary_seek(void)
+{
+    int i;
+    struct filp_val *v;
+    struct filp_val *a;
+
+    v = filp_pop();
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_int_push(filp_array_binary_seek(a, v->value, 1));
+
+    return FILP_OK;
+}
+
+
+/**
+ * asort - Sorts an array.
+ * @array: array or array symbol to be sorted
+ *
+ * Sorts (alfabetically) an array. Equal elements keep
+ * their relative order.
+ * [Array commands]
+ */
+/** @array_symbol asort */
+/** @array asort %sorted_array */
+int _filpf_array_sort(void)
+{
+    int i;
+    struct filp_val *a;
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_array_sort(a, 1);
+
+    if (i)
+        filp_push(a);
+
+    return FILP_OK;
+}
+
+
+/**
+ * nsort - Sorts an array numerically.
+ * @array: array or array symbol to be sorted
+ *
+ * Sorts an array by the numeric value of its elements
+ * (non-numeric ones count as 0). Equal elements keep their
+ * relative order.
+ * [Array commands]
+ */
+static int _filpf_nsort(void)
+/** @array_symbol nsort */
+/** @array nsort %sorted_array */
+{
+    int i;
+    struct filp_val *a;
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_array_nsort(a, 1);
+
+    if (i)
+        filp_push(a);
+
+    return FILP_OK;
+}
+
+
+/**
+ * sortby - Sorts an array by a computed key.
+ * @array: array or array symbol to be sorted
+ * @code: code that returns the key of an element
+ *
+ * Sorts an array by the keys returned by @code, that is
+ * executed once per element, receiving it on the top of
+ * the stack. If all the keys are numbers, they are compared
+ * numerically; otherwise, alphabetically. Equal keys keep
+ * the relative order of the elements.
+ * [Array commands]
+ */
+static int _filpf_sortby(void)
+/** @array_symbol { @code } sortby */
+/** @array { @code } sortby %sorted_array */
+{
+    struct filp_val *a;
+    struct filp_val *c;
+    struct filp_val *k;
+    struct filp_val *v;
+    int i, n, num;
+    int ret = FILP_OK;
+
+    c = filp_pop();
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    num = filp_array_size(a);
+    k = filp_new_value(FILP_ARRAY, NULL, num);
+
+    filp_ref_value(c);
+    filp_ref_value(a);
+    filp_ref_value(k);
+
+    for (n = 1; n <= num; n++) {
+        if ((v = filp_array_get(a, n)) == NULL)
+            v = _filp_null_value;
+
+        filp_push(v);
+
+        if ((ret = filp_execv(c)) < 0)
+            break;
+
+        filp_array_set(k, filp_pop(), n);
+    }
+
+    if (ret >= 0)
+        filp_array_sort_by(a, k);
+
+    filp_unref_value(k);
+    filp_unref_value(a);
+    filp_unref_value(c);
+
+    if (ret < 0)
+        return FILP_ERROR;
+
+    if (i)
+        filp_push(a);
+
+    return FILP_OK;
+}
+
+
+/**
+ * aslice - Extracts a range of elements from an array.
+ * @array: the array or array symbol
+ * @subscript: subscript of the first element
+ * @num: number of elements
+ *
+ * Returns a new array with @num elements of @array, starting
+ * from @subscript. The elements are not copied: the new array
+ * shares them with the original one until any of them is
+ * modified. The range is clipped to the array bounds.
+ * [Array commands]
+ */
+static int _filpf_aslice(void)
+/** @array @subscript @num aslice %slice */
+{
+    int n, o, i;
+    struct filp_val *a;
+
+    n = filp_int_pop();
+    o = filp_int_pop();
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_push(filp_array_slice(a, o, n));
+
+    return FILP_OK;
+}
+
+
+/**
+ * ahead - Extracts the first elements of an array.
+ * @array: the array or array symbol
+ * @num: number of elements
+ *
+ * Returns a new array with the first @num elements of @array,
+ * sharing them as aslice does.
+ * [Array commands]
+ */
+static int _filpf_ahead(void)
+/** @array @num ahead %slice */
+{
+    int n, i;
+    struct filp_val *a;
+
+    n = filp_int_pop();
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_push(filp_array_slice(a, 1, n));
+
+    return FILP_OK;
+}
+
+
+/**
+ * atail - Extracts the last elements of an array.
+ * @array: the array or array symbol
+ * @num: number of elements
+ *
+ * Returns a new array with the last @num elements of @array,
+ * sharing them as aslice does.
+ * [Array commands]
+ */
+static int _filpf_atail(void)
+/** @array @num atail %slice */
+{
+    int n, i;
+    struct filp_val *a;
+
+    n = filp_int_pop();
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    if (n > filp_array_size(a))
+        n = filp_array_size(a);
+
+    filp_push(filp_array_slice(a, filp_array_size(a) - n + 1, n));
+
+    return FILP_OK;
+}
+
+
+static int _filp_vector_forall_map(struct filp_val *a, struct filp_val *c,
+                   int reassign, int imm)
+{
+    int n;
+
+    filp_ref_value(c);
+    filp_ref_value(a);
+
+    for (n = 1; n <= filp_vector_size(a); n++) {
+        filp_push(filp_vector_get(a, n));
+        filp_execv(c);
+
+        if (reassign)
+            filp_vector_set(a, filp_pop(), n);
+    }
+
+    filp_unref_value(a);
+    filp_unref_value(c);
+
+    if (reassign && imm)
+        filp_push(a);
+
+    return FILP_OK;
+}
+
+
+static int _filpf_forall_map(int reassign)
+{
+    int i, n;
+    struct filp_val *a;
+    struct filp_val *c;
+    struct filp_val *v;
+
+    c = filp_pop();
+
+    if ((a = _filp_vector_pop(&i)) != NULL)
+        return _filp_vector_forall_map(a, c, reassign, i);
+
+    if ((a = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_ref_value(c);
+    filp_ref_value(a);
+
+    for (n = 1; n <= filp_array_size(a); n++) {
+        if ((v = filp_array_get(a, n)) != NULL) {
+            filp_push(v);
+            filp_execv(c);
+
+            if (reassign) {
+                v = filp_pop();
+                filp_array_set(a, v, n);
+            }
+        }
+    }
+
+    filp_unref_value(a);
+    filp_unref_value(c);
+
+    if (reassign && i)
+        filp_push(a);
+
+    return FILP_OK;
 }
 
 
 /**
- * aget - Gets an element from an array.
+ * forall - Executes a block of code for all elements of the array
  * @array: the array
- * @subscript: the number of the element to be taken
+ * @code: the code to be executed
  *
- * Gets the element number @subscript from the @array. If
- * @subscript is out of range, NULL is returned instead.
- * The array subscripts in filp starts at 1; the 0 element
- * contains the total number of elements in the array.
+ * Executes a block of @code for each element of @array after pushing each
+ * one to the stack. The code block must take the values from the top of
+ * stack on each iteration.
+ * [Control structures]
  * [Array commands]
  */
-static int _filpf_array_get(void)
-/** @array @subscript @ %element */
-/** @array @subscript aget %element */
+static int _filpf_forall(void)
+/** @array { @code } forall */
+{
+    return _filpf_forall_map(0);
+}
+
+
+/**
+ * map - Executes a block of code for all elements of the array modifying
+ * @array: the array or array symbol
+ * @code: the code to be executed
+ *
+ * Executes a block of @code for each element of @array after pushing each
+ * one to the stack. At the end of the block, the value in the top of stack
+ * will be assigned to the element. If @array is an immediate value (i.e.
+ * not a symbol), the modified array is left on the stack.
+ * [Control structures]
+ * [Array commands]
+ */
+static int _filpf_map(void)
+/** @array_symbol { @code } map */
+/** @array { @code } map %modified_array */
+{
+    return _filpf_forall_map(1);
+}
+
+
+static struct filp_val *_filp_array_from(struct filp_val **e, int num)
+/* creates an array holding @num values, releasing them */
 {
-    int n, i;
     struct filp_val *a;
-    struct filp_val *v;
+    int n;
 
-    n = filp_int_pop();
+    a = filp_new_value(FILP_ARRAY, NULL, num);
 
+    for (n = 0; n < num; n++) {
+        filp_array_set(a, e[n], n + 1);
+        filp_unref_value(e[n]);
+    }
+
+    return a;
+}
+
+
+static int _filp_filter(int part)
+{
+    struct filp_val *a;
+    struct filp_val *c;
+    struct filp_val *v;
+    struct filp_val **t;
+    struct filp_val **f;
+    int i, n, nt, nf, num;
+    int ret = FILP_OK;
+
+    c = filp_pop();
     if ((a = filp_array_pop(&i, 0)) == NULL)
         return FILP_ERROR;
 
-    if (n == 0)
-        filp_int_push(filp_array_size(a));
-    else if ((v = filp_array_get(a, n)) != NULL)
+    num = filp_array_size(a);
+
+    /* room for all the elements, so no reallocations are needed */
+    t = (struct filp_val **) malloc((num + 1) * sizeof(struct filp_val *) * 2);
+    f = t + num + 1;
+
+    if (t == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    filp_ref_value(c);
+    filp_ref_value(a);
+
+    for (n = nt = nf = 0; n < num; n++) {
+        if ((v = filp_array_get(a, n + 1)) == NULL)
+            v = _filp_null_value;
+
+        /* keep it alive while the code runs */
+        filp_ref_value(v);
+
+        filp_push(v);
+
+        if ((ret = filp_execv(c)) < 0) {
+            filp_unref_value(v);
+            break;
+        }
+
+        if (filp_is_true(filp_pop()))
+            t[nt++] = v;
+        else if (part)
+            f[nf++] = v;
+        else
+            filp_unref_value(v);
+    }
+
+    filp_unref_value(a);
+    filp_unref_value(c);
+
+    a = _filp_array_from(t, nt);
+    v = _filp_array_from(f, nf);
+
+    free(t);
+
+    if (ret < 0)
+        return FILP_ERROR;
+
+    filp_push(a);
+
+    if (part)
         filp_push(v);
-    else
-        filp_null_push();
 
     return FILP_OK;
 }
 
 
-static int _filpf_array_setins(char *token)
+/**
+ * filter - Selects the elements of an array.
+ * @array: the array or array symbol
+ * @code: the code to be executed
+ *
+ * Executes a block of @code for each element of @array after
+ * pushing it to the stack, and returns a new array with the
+ * elements for which the block returned a true value. The block
+ * is compiled once, and the new array is built in a single pass.
+ * The grep command can be used as a synonym.
+ * [Control structures]
+ * [Array commands]
+ */
+static int _filpf_filter(void)
+/** @array { @code } filter %array */
+/** @array { @code } grep %array */
+{
+    return _filp_filter(0);
+}
+
+
+/**
+ * partition - Splits an array in two.
+ * @array: the array or array symbol
+ * @code: the code to be executed
+ *
+ * Executes a block of @code for each element of @array after
+ * pushing it to the stack, as filter does, and returns two new
+ * arrays: the one with the elements for which the block returned
+ * a true value, and then (in the top of stack) the one with
+ * the rest of them.
+ * [Control structures]
+ * [Array commands]
+ */
+static int _filpf_partition(void)
+/** @array { @code } partition %true_array %false_array */
+{
+    return _filp_filter(1);
+}
+
+
+/**
+ * reduce - Reduces an array to a value using a block of code.
+ * @array: the array or array symbol
+ * @initial: the initial value of the accumulator
+ * @code: the code to be executed
+ *
+ * Executes a block of @code for each element of @array with
+ * the accumulator and the element pushed to the stack (in that
+ * order); the block must leave the new value of the accumulator,
+ * that is returned after processing the last element. The
+ * fold command can be used as a synonym.
+ * [Control structures]
+ * [Array commands]
+ */
+static int _filpf_reduce(void)
+/** @array @initial { @code } reduce %accumulator */
+/** @array @initial { @code } fold %accumulator */
 {
-    struct filp_val *v;
     struct filp_val *a;
-    int n, i;
-    int ret = 0;
+    struct filp_val *c;
+    struct filp_val *v;
+    struct filp_val *acc;
+    int i, n, ret = FILP_OK;
 
-    v = filp_pop();
-    n = filp_int_pop();
+    c = filp_pop();
+    acc = filp_pop();
 
-    if ((a = filp_array_pop(&i, 1)) == NULL)
+    if ((a = filp_array_pop(&i, 0)) == NULL)
         return FILP_ERROR;
 
-    if (strcmp(token, "ains") == 0)
-        filp_array_ins(a, v, n);
-    else
-        filp_array_set(a, v, n);
+    filp_ref_value(c);
+    filp_ref_value(a);
 
-    if (i)
-        filp_push(a);
+    filp_push(acc);
 
-    return ret;
+    for (n = 1; n <= filp_array_size(a) && ret >= 0; n++) {
+        if ((v = filp_array_get(a, n)) == NULL)
+            v = _filp_null_value;
+
+        filp_push(v);
+        ret = filp_execv(c);
+    }
+
+    filp_unref_value(a);
+    filp_unref_value(c);
+
+    return ret < 0 ? FILP_ERROR : FILP_OK;
 }
 
 
 /**
- * aset - Assigns a value to an element of an array.
- * @array: the array or array symbol
- * @subscript: the subscript number to be asigned
- * @value: the value to be set
+ * license - Returns the filp license.
  *
- * Assigns a @value to the element @subscript of an @array.
- * Remember that the array subscripts in filp start at 1.
-  * The @= command can be used as a synonym.
+ * Returns a text string containing the license of the filp library
+ * [Special constants]
+ */
+static int _filpf_license(void)
+/** license %license_text */
+{
+    filp_scalar_push(_filp_license);
+    return FILP_OK;
+}
+
+
+
+/**
+ * sweep - Collects garbage.
+ *
+ * Calls the internal garbage collector.
+ * [Special commands]
+ */
+static int _filpf_sweep(void)
+/** sweep */
+{
+    filp_sweeper(1);
+    return FILP_OK;
+}
+
+
+/**
+ * dumper - Dumps a value (probably an array) as a tree.
+ * @value: the value to be dumped
+ *
+ * Dumps a value (probably an array) as a filp-parseable tree.
+ * Ordered maps are dumped as the list of pairs given to omap.
+ */
+static int _filpf_dumper(void)
+/** @value dumper %value_tree */
+{
+    char *ptr;
+
+    ptr = filp_dumper(filp_pop(), 3);
+    filp_scalar_push(ptr);
+    free(ptr);
+
+    return FILP_OK;
+}
+
+
+/**
+ * jsonencode - Serializes a value as JSON.
+ * @value: the value
+ *
+ * Returns the JSON representation of @value. Hashes and ordered
+ * maps are objects, arrays and vectors are arrays, scalars that
+ * look like numbers are numbers and other ones are strings.
  * [Array commands]
  */
-/** @array_symbol @subscript @value aset */
-/** @array @subscript @value aset %modified_array */
-static int _filpf_array_set(void)
+static int _filpf_jsonencode(void)
+/** @value jsonencode %json_string */
 {
-    return _filpf_array_setins("aset");
+    struct filp_val *v;
+    char *ptr;
+    int l;
+
+    if ((ptr = filp_json_encode(filp_pop(), &l)) == NULL) {
+        _filp_error = FILPERR_SYNTAX_ERROR;
+        strcpy(_filp_error_info, "JSON nested too deep");
+        return FILP_ERROR;
+    }
+
+    /* the string is given to the value */
+    v = filp_new_value(FILP_SCALAR, NULL, 0);
+    v->value = ptr;
+    v->size = l + 1;
+
+    filp_push(v);
+
+    return FILP_OK;
+}
+
+
+/**
+ * jsondecode - Parses a JSON string.
+ * @json_string: the JSON document
+ *
+ * Parses a JSON document and returns its value. Objects are
+ * hashes, arrays are arrays, true and false are 1 and 0 and
+ * null is NULL. Malformed documents are syntax errors.
+ * [Array commands]
+ */
+static int _filpf_jsondecode(void)
+/** @json_string jsondecode %value */
+{
+    struct filp_val *s;
+    struct filp_val *v;
+    int err;
+
+    s = filp_pop();
+
+    if (s->type != FILP_SCALAR) {
+        _filp_error = FILPERR_SCALAR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    if ((v = filp_json_decode(s->value, filp_val_len(s), &err)) == NULL) {
+        _filp_error = FILPERR_SYNTAX_ERROR;
+        sprintf(_filp_error_info, "JSON error at offset %d", err);
+        return FILP_ERROR;
+    }
+
+    filp_push(v);
+
+    return FILP_OK;
 }
 
+
 /**
- * ains - Inserts a value into an array.
- * @array: the array or array symbol
- * @subscript: the subscript number of the insertion position
- * @value: the value to be inserted
+ * freeze - Serializes a value into a binary string.
+ * @value: the value
  *
- * Inserts a @value into the @subscript position of an @array.
- * The elements with greater subscripts move up one position,
- * incrementing the total size of the array by 1.
- * Remember that the array subscripts in filp start at 1. If the
- * subscript is 0 (array size), the element is added to the end.
+ * Returns a compact binary representation of @value, that can
+ * be written to a file and rebuilt with 'thaw'. Unlike 'dumper',
+ * the result is not filp code and no parsing is needed to read
+ * it back. Files and channels are stored as NULL.
  * [Array commands]
  */
-/** @array_symbol @subscript @value ains */
-/** @array @subscript @value ains %modified_array */
-static int _filpf_array_ins(void)
+static int _filpf_freeze(void)
+/** @value freeze %frozen */
 {
-    return _filpf_array_setins("ains");
+    struct filp_val *v;
+    char *ptr;
+    int l;
+
+    ptr = filp_freeze(filp_pop(), &l);
+
+    /* the string is given to the value */
+    v = filp_new_value(FILP_SCALAR, NULL, 0);
+    v->value = ptr;
+    v->size = l + 1;
+
+    filp_push(v);
+
+    return FILP_OK;
 }
 
 
 /**
- * adump - Dumps an array as a list.
- * @array: the array to be dumped.
+ * thaw - Rebuilds a value from a binary string.
+ * @frozen: the result of 'freeze'
  *
- * Dumps an array as a list.
+ * Rebuilds the value stored by 'freeze'. Binary code is looked
+ * up by name. Malformed or too deeply nested data is a syntax
+ * error.
  * [Array commands]
  */
-static int _filpf_array_dump(void)
-/** @array adump [ %array_elements ] */
+static int _filpf_thaw(void)
+/** @frozen thaw %value */
 {
-    int i, n;
-    struct filp_val *a;
+    struct filp_val *s;
+    struct filp_val *v;
 
-    if ((a = filp_array_pop(&i, 0)) == NULL)
+    s = filp_pop();
+
+    if (s->type != FILP_SCALAR) {
+        _filp_error = FILPERR_SCALAR_EXPECTED;
         return FILP_ERROR;
+    }
 
-    filp_null_push();
+    if ((v = filp_thaw(s->value, filp_val_len(s))) == NULL) {
+        _filp_error = FILPERR_SYNTAX_ERROR;
+        strcpy(_filp_error_info, "malformed frozen value");
+        return FILP_ERROR;
+    }
 
-    for (n = 1; n <= a->size; n++)
-        filp_push(filp_array_get(a, n));
+    filp_push(v);
 
     return FILP_OK;
 }
 
 
 /**
- * adel - Deletes an element from an array.
- * @array: the array or array symbol
- * @subscript: subscript of the element to be deleted
+ * safe - Enters isolate mode
  *
- * Deletes an element from an @array. The array shrinks.
- * If @subscript is zero, the last element is deleted and
- * if it's out of range, nothing happens.
- * [Array commands]
+ * Enters isolate mode, so all potentially dangerous commands
+ * as file access, environment variable definitions and external
+ * command executions are disabled. There is no turning back.
+ * When executed inside an 'eval' code, isolate mode operates
+ * only inside it.
  */
-static int _filpf_array_del(void)
-/** @array_symbol @subscript adel */
-/** @array @subscript adel %modified_array */
+static int _filpf_safe(void)
+/** safe */
 {
-    int n, i;
-    struct filp_val *a;
+    _filp_isolate = 1;
+    return FILP_OK;
+}
 
-    n = filp_int_pop();
 
-    if ((a = filp_array_pop(&i, 0)) == NULL)
-        return FILP_ERROR;
+static int _filpf_hash(void)
+/** [ @key @value ... ] hash @hash */
+{
+    struct filp_val *h;
+    struct filp_val *v;
+    struct filp_val *k;
 
-    filp_array_del(a, n);
+    h = filp_new_hash(31);
 
-    if (i)
-        filp_push(a);
+    for (;;) {
+        v = filp_pop();
+
+        if (v->type == FILP_NULL)
+            break;
+
+        k = filp_pop();
+
+        if (k->type == FILP_NULL)
+            break;
+
+        filp_hash_set(h, k->value, v);
+    }
+
+    filp_push(h);
 
     return FILP_OK;
 }
 
 
-/**
- * aseek - Seeks an array for a scalar.
- * @array: the array to be searched into
- * @scalar: the value to be found
- *
- * Seeks an array in search of a string.
- * Returns the subscript where the scalar is, or 0 if not found.
- * [Array commands]
- */
-/** @array @scalar aseek %subscript */
-int _filpf_array_seek(void)
+static int _filpf_hget(void)
+/** @hash @key hget %value */
 {
     int i;
+    struct filp_val *k;
+    struct filp_val *h;
     struct filp_val *v;
-    struct filp_val *a;
 
-    v = filp_pop();
 
-    if ((a = filp_array_pop(&i, 0)) == NULL)
+    k = filp_pop();
+
+    if ((h = filp_array_pop(&i, 0)) == NULL)
         return FILP_ERROR;
 
-    filp_int_push(filp_array_seek(a, v->value, 1));
+    v = filp_hash_get(h, k->value);
+    filp_push(v == NULL ? _filp_null_value : v);
 
     return FILP_OK;
 }
 
 
-/**
- * abseek - Seeks a sorted array for a scalar.
- * @array: the array to be searched into
- * @scalar: the value to be found
- *
- * Seeks a sorted array in search of a string.
- * Returns the subscript where the scalar is if positive,
- * or the position where it should be if negative.
- * [Array commands]
- */
-/** @array @scalar abseek %subscript */
-int _filpf_array_binary_seek(void)
+static int _filpf_hset(void)
+/** @hash_symbol @key @value hset */
+/** @hash @key @value hset %modified_hash */
 {
     int i;
     struct filp_val *v;
-    struct filp_val *a;
+    struct filp_val *k;
+    struct filp_val *h;
 
     v = filp_pop();
-
-    if ((a = filp_array_pop(&i, 0)) == NULL)
+    k = filp_pop();
+    if ((h = filp_array_pop(&i, 0)) == NULL)
         return FILP_ERROR;
 
-    filp_int_push(filp_array_binary_seek(a, v->value, 1));
+    filp_hash_set(h, k->value, v);
+    if (i)
+        filp_push(h);
 
     return FILP_OK;
 }
 
 
-/**
- * asort - Sorts an array.
- * @array: array or array symbol to be sorted
- *
- * Sorts (alfabetically) an array.
- * [Array commands]
- */
-/** @array_symbol asort */
-/** @array asort %sorted_array */
-int _filpf_array_sort(void)
+static int _filpf_hdel(void)
+/** @hash_symbol @key hdel */
+/** @hash @key hdel %modified_hash */
 {
     int i;
-    struct filp_val *a;
+    struct filp_val *k;
+    struct filp_val *h;
 
-    if ((a = filp_array_pop(&i, 0)) == NULL)
-        return FILP_ERROR;
+    k = filp_pop();
 
-    filp_array_sort(a, 1);
+    if ((h = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
 
+    filp_hash_del(h, k->value);
     if (i)
-        filp_push(a);
+        filp_push(h);
 
     return FILP_OK;
 }
 
 
-static int _filpf_forall_map(int reassign)
+static int _filpf_hdump_keys_values(int keys, int values)
 {
     int i, n;
-    struct filp_val *a;
-    struct filp_val *c;
+    struct filp_val *h;
+    struct filp_val *k;
     struct filp_val *v;
 
-    c = filp_pop();
-    if ((a = filp_array_pop(&i, 0)) == NULL)
+    if ((h = filp_array_pop(&i, 0)) == NULL)
         return FILP_ERROR;
 
-    filp_ref_value(c);
-    filp_ref_value(a);
+    filp_null_push();
 
-    for (n = 1; n <= filp_array_size(a); n++) {
-        if ((v = filp_array_get(a, n)) != NULL) {
-            filp_push(v);
-            filp_execv(c);
+    for (n = 1; n <= filp_hash_size(h); n++) {
+        if (!filp_hash_get_pair(h, n, &k, &v))
+            break;
 
-            if (reassign) {
-                v = filp_pop();
-                filp_array_set(a, v, n);
-            }
-        }
+        if (keys)
+            filp_push(k);
+        if (values)
+            filp_push(v);
     }
 
-    filp_unref_value(a);
-    filp_unref_value(c);
-
-    if (reassign && i)
-        filp_push(a);
-
     return FILP_OK;
 }
 
 
-/**
- * forall - Executes a block of code for all elements of the array
- * @array: the array
- * @code: the code to be executed
- *
- * Executes a block of @code for each element of @array after pushing each
- * one to the stack. The code block must take the values from the top of
- * stack on each iteration.
- * [Control structures]
- * [Array commands]
- */
-static int _filpf_forall(void)
-/** @array { @code } forall */
+static int _filpf_hdump(void)
+/** @hash hdump [ %hash_elements ] */
 {
-    return _filpf_forall_map(0);
+    return _filpf_hdump_keys_values(1, 1);
 }
 
 
-/**
- * map - Executes a block of code for all elements of the array modifying
- * @array: the array or array symbol
- * @code: the code to be executed
- *
- * Executes a block of @code for each element of @array after pushing each
- * one to the stack. At the end of the block, the value in the top of stack
- * will be assigned to the element. If @array is an immediate value (i.e.
- * not a symbol), the modified array is left on the stack.
- * [Control structures]
- * [Array commands]
- */
-static int _filpf_map(void)
-/** @array_symbol { @code } map */
-/** @array { @code } map %modified_array */
+static int _filpf_keys(void)
+/** @hash keys [ %hash_keys ] */
 {
-    return _filpf_forall_map(1);
+    return _filpf_hdump_keys_values(1, 0);
 }
 
 
-/**
- * license - Returns the filp license.
- *
- * Returns a text string containing the license of the filp library
- * [Special constants]
- */
-static int _filpf_license(void)
-/** license %license_text */
+static int _filpf_values(void)
+/** @hash values [ %hash_values ] */
 {
-    filp_scalar_push(_filp_license);
-    return FILP_OK;
+    return _filpf_hdump_keys_values(0, 1);
 }
 
 
+static int _filpf_hsize(void)
+/** @hash hsize %size */
+{
+    int i;
+    struct filp_val *h;
+
+    if ((h = filp_array_pop(&i, 0)) == NULL)
+        return FILP_ERROR;
+
+    filp_push(filp_new_int_value(filp_hash_size(h)));
 
-/**
- * sweep - Collects garbage.
- *
- * Calls the internal garbage collector.
- * [Special commands]
- */
-static int _filpf_sweep(void)
-/** sweep */
-{
-    filp_sweeper(1);
     return FILP_OK;
 }
 
 
-/**
- * dumper - Dumps a value (probably an array) as a tree.
- * @value: the value to be dumped
- *
- * Dumps a value (probably an array) as a filp-parseable tree.
- */
-static int _filpf_dumper(void)
-/** @value dumper %value_tree */
+/** ordered maps **/
+
+static struct filp_val *_filp_omap_pop(int *imm)
+/* pops an ordered map (or the name of an ordered map symbol) */
 {
-    char *ptr;
+    struct filp_val *v;
+    struct filp_sym *s;
 
-    ptr = filp_dumper(filp_pop(), 3);
-    filp_scalar_push(ptr);
-    free(ptr);
+    v = filp_pop();
 
-    return FILP_OK;
+    if (v->type == FILP_OMAP)
+        *imm = 1;
+    else if (v->type == FILP_SCALAR &&
+             (s = filp_find_symbol(v->value)) != NULL && s->type == FILP_OMAP) {
+        *imm = 0;
+        v = s->value;
+    }
+    else {
+        _filp_error = FILPERR_OMAP_EXPECTED;
+        return NULL;
+    }
+
+    return v;
 }
 
 
-/**
- * safe - Enters isolate mode
- *
- * Enters isolate mode, so all potentially dangerous commands
- * as file access, environment variable definitions and external
- * command executions are disabled. There is no turning back.
- * When executed inside an 'eval' code, isolate mode operates
- * only inside it.
- */
-static int _filpf_safe(void)
-/** safe */
+static char *_filp_omap_key(struct filp_val *k)
+/* the key string of a value, or NULL */
 {
-    _filp_isolate = 1;
-    return FILP_OK;
+    return k->type == FILP_SCALAR ? k->value : NULL;
 }
 
 
-static int _filpf_hash(void)
-/** [ @key @value ... ] hash @hash */
+/**
+ * omap - Creates an ordered map.
+ * @key: a key
+ * @value: its value
+ *
+ * Creates an ordered map, a map of keys to values that is kept
+ * sorted (alphabetically) by key, from a list of key-value pairs.
+ * Ordered maps are stored as B-trees, so lookups, insertions
+ * and deletions are fast even on big maps, and they can be walked
+ * in order or by key ranges. Unlike arrays, they are not copied
+ * when pushed to the stack.
+ * [Ordered map commands]
+ */
+static int _filpf_omap(void)
+/** [ @key @value ... ] omap %omap */
 {
-    struct filp_val *h;
+    struct filp_val *m;
     struct filp_val *v;
     struct filp_val *k;
 
-    h = filp_new_hash(31);
+    if ((m = filp_new_omap()) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    filp_ref_value(m);
 
     for (;;) {
         v = filp_pop();
@@ -2287,136 +4079,397 @@ static int _filpf_hash(void)
         if (k->type == FILP_NULL)
             break;
 
-        filp_hash_set(h, k->value, v);
+        if (k->type == FILP_SCALAR)
+            filp_omap_set(m, k->value, v);
     }
 
-    filp_push(h);
+    filp_push(m);
+    filp_unref_value(m);
 
     return FILP_OK;
 }
 
 
-static int _filpf_hget(void)
-/** @hash @key hget %value */
+/**
+ * oget - Gets a value from an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ * @key: the key
+ *
+ * Returns the value stored under @key, or NULL if there is none.
+ * [Ordered map commands]
+ */
+static int _filpf_oget(void)
+/** @omap @key oget %value */
 {
     int i;
     struct filp_val *k;
-    struct filp_val *h;
-    struct filp_val *v;
-
+    struct filp_val *m;
+    struct filp_val *v = NULL;
 
     k = filp_pop();
 
-    if ((h = filp_array_pop(&i, 0)) == NULL)
+    if ((m = _filp_omap_pop(&i)) == NULL)
         return FILP_ERROR;
 
-    v = filp_hash_get(h, k->value);
+    if (_filp_omap_key(k) != NULL)
+        v = filp_omap_get(m, k->value);
+
     filp_push(v == NULL ? _filp_null_value : v);
 
     return FILP_OK;
 }
 
 
-static int _filpf_hset(void)
-/** @hash_symbol @key @value hset */
-/** @hash @key @value hset %modified_hash */
+/**
+ * oset - Stores a value into an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ * @key: the key
+ * @value: the value
+ *
+ * Stores @value under @key, replacing the previous one, if any.
+ * If @omap is an immediate value, it's left on the stack.
+ * [Ordered map commands]
+ */
+static int _filpf_oset(void)
+/** @omap_symbol @key @value oset */
+/** @omap @key @value oset %omap */
 {
     int i;
     struct filp_val *v;
     struct filp_val *k;
-    struct filp_val *h;
+    struct filp_val *m;
 
     v = filp_pop();
     k = filp_pop();
-    if ((h = filp_array_pop(&i, 0)) == NULL)
+
+    if ((m = _filp_omap_pop(&i)) == NULL)
         return FILP_ERROR;
 
-    filp_hash_set(h, k->value, v);
+    if (_filp_omap_key(k) == NULL) {
+        _filp_error = FILPERR_SCALAR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    filp_omap_set(m, k->value, v);
+
     if (i)
-        filp_push(h);
+        filp_push(m);
 
     return FILP_OK;
 }
 
 
-static int _filpf_hdel(void)
-/** @hash_symbol @key hdel */
-/** @hash @key hdel %modified_hash */
+/**
+ * odel - Deletes a key from an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ * @key: the key
+ *
+ * Deletes @key (and its value) from the ordered map.
+ * If @omap is an immediate value, it's left on the stack.
+ * [Ordered map commands]
+ */
+static int _filpf_odel(void)
+/** @omap_symbol @key odel */
+/** @omap @key odel %omap */
 {
     int i;
     struct filp_val *k;
-    struct filp_val *h;
+    struct filp_val *m;
 
     k = filp_pop();
 
-    if ((h = filp_array_pop(&i, 0)) == NULL)
+    if ((m = _filp_omap_pop(&i)) == NULL)
         return FILP_ERROR;
 
-    filp_hash_del(h, k->value);
+    if (_filp_omap_key(k) != NULL)
+        filp_omap_del(m, k->value);
+
     if (i)
-        filp_push(h);
+        filp_push(m);
 
     return FILP_OK;
 }
 
 
-static int _filpf_hdump_keys_values(int keys, int values)
+/**
+ * osize - Returns the number of keys of an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ *
+ * Returns the number of key-value pairs of the ordered map.
+ * [Ordered map commands]
+ */
+static int _filpf_osize(void)
+/** @omap osize %size */
 {
-    int i, n;
-    struct filp_val *h;
+    int i;
+    struct filp_val *m;
+
+    if ((m = _filp_omap_pop(&i)) == NULL)
+        return FILP_ERROR;
+
+    filp_int_push(filp_omap_size(m));
+
+    return FILP_OK;
+}
+
+
+static int _filp_ofloor_oceil(int ceil)
+{
+    int i;
     struct filp_val *k;
-    struct filp_val *v;
+    struct filp_val *m;
+    struct filp_val *r = NULL;
 
-    if ((h = filp_array_pop(&i, 0)) == NULL)
+    k = filp_pop();
+
+    if ((m = _filp_omap_pop(&i)) == NULL)
         return FILP_ERROR;
 
-    filp_null_push();
+    if (_filp_omap_key(k) != NULL)
+        r = ceil ? filp_omap_ceil(m, k->value) : filp_omap_floor(m, k->value);
 
-    for (n = 1; n <= filp_hash_size(h); n++) {
-        if (!filp_hash_get_pair(h, n, &k, &v))
-            break;
+    filp_push(r == NULL ? _filp_null_value : r);
 
-        if (keys)
-            filp_push(k);
-        if (values)
-            filp_push(v);
+    return FILP_OK;
+}
+
+
+/**
+ * ofloor - Finds the nearest key at or before another one.
+ * @omap: the ordered map or ordered map symbol
+ * @key: the key
+ *
+ * Returns the greatest key of the ordered map that is less or
+ * equal than @key, or NULL if there is none.
+ * [Ordered map commands]
+ */
+static int _filpf_ofloor(void)
+/** @omap @key ofloor %key */
+{
+    return _filp_ofloor_oceil(0);
+}
+
+
+/**
+ * oceil - Finds the nearest key at or after another one.
+ * @omap: the ordered map or ordered map symbol
+ * @key: the key
+ *
+ * Returns the smallest key of the ordered map that is greater or
+ * equal than @key, or NULL if there is none.
+ * [Ordered map commands]
+ */
+static int _filpf_oceil(void)
+/** @omap @key oceil %key */
+{
+    return _filp_ofloor_oceil(1);
+}
+
+
+struct _filp_orange {
+    int keys;                   /* push keys */
+    int values;                 /* push values */
+};
+
+static int _filp_orange_push(struct filp_val *k, struct filp_val *v, void *arg)
+{
+    struct _filp_orange *o = (struct _filp_orange *) arg;
+
+    if (o->keys && !filp_push(k))
+        return 1;
+    if (o->values && !filp_push(v))
+        return 1;
+
+    return 0;
+}
+
+
+static int _filp_orange(int from_to, int keys, int values)
+{
+    int i;
+    struct filp_val *m;
+    struct filp_val *f = NULL;
+    struct filp_val *t = NULL;
+    struct _filp_orange o;
+
+    if (from_to) {
+        t = filp_pop();
+        f = filp_pop();
     }
 
+    if ((m = _filp_omap_pop(&i)) == NULL)
+        return FILP_ERROR;
+
+    o.keys = keys;
+    o.values = values;
+
+    filp_null_push();
+
+    filp_omap_range(m, f ? _filp_omap_key(f) : NULL,
+                    t ? _filp_omap_key(t) : NULL, _filp_orange_push, &o);
+
     return FILP_OK;
 }
 
 
-static int _filpf_hdump(void)
-/** @hash hdump [ %hash_elements ] */
+/**
+ * orange - Returns a range of an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ * @from: the first key
+ * @to: the key where the range ends
+ *
+ * Returns a list with the keys and values of the ordered map
+ * which keys are greater or equal than @from and less than @to,
+ * in order. If @from or @to are NULL, the range is open from
+ * the beginning or to the end.
+ * [Ordered map commands]
+ */
+static int _filpf_orange(void)
+/** @omap @from @to orange [ %key %value ... ] */
 {
-    return _filpf_hdump_keys_values(1, 1);
+    return _filp_orange(1, 1, 1);
 }
 
 
-static int _filpf_keys(void)
-/** @hash keys [ %hash_keys ] */
+/**
+ * odump - Returns all the pairs of an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ *
+ * Returns a list with all the keys and values of the ordered
+ * map, in order.
+ * [Ordered map commands]
+ */
+static int _filpf_odump(void)
+/** @omap odump [ %key %value ... ] */
 {
-    return _filpf_hdump_keys_values(1, 0);
+    return _filp_orange(0, 1, 1);
 }
 
 
-static int _filpf_values(void)
-/** @hash values [ %hash_values ] */
+/**
+ * okeys - Returns all the keys of an ordered map.
+ * @omap: the ordered map or ordered map symbol
+ *
+ * Returns a list with all the keys of the ordered map, in order.
+ * [Ordered map commands]
+ */
+static int _filpf_okeys(void)
+/** @omap okeys [ %key ... ] */
 {
-    return _filpf_hdump_keys_values(0, 1);
+    return _filp_orange(0, 1, 0);
 }
 
 
-static int _filpf_hsize(void)
-/** @hash hsize %size */
+/* string builders */
+
+static struct filp_val *_filp_builder_pop(int *imm)
+/* pops a string builder (or the name of a string builder symbol) */
+{
+    struct filp_val *v;
+    struct filp_sym *s;
+
+    v = filp_pop();
+
+    if (v->type == FILP_BUILDER)
+        *imm = 1;
+    else if (v->type == FILP_SCALAR &&
+             (s = filp_find_symbol(v->value)) != NULL && s->type == FILP_BUILDER) {
+        *imm = 0;
+        v = s->value;
+    }
+    else {
+        _filp_error = FILPERR_BUILDER_EXPECTED;
+        return NULL;
+    }
+
+    return v;
+}
+
+
+/**
+ * sbnew - Creates a string builder.
+ *
+ * Creates a new, empty string builder, a string that can be
+ * appended to in place (see sbappend). Building a big string by
+ * appending many small ones to a string builder takes linear
+ * time, instead of copying it again on each concatenation.
+ * Unlike scalars, string builders are not copied when pushed
+ * to the stack.
+ * [String manipulation commands]
+ */
+static int _filpf_sbnew(void)
+/** sbnew %builder */
+{
+    struct filp_val *b;
+
+    if ((b = filp_new_builder()) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    filp_push(b);
+
+    return FILP_OK;
+}
+
+
+/**
+ * sbappend - Appends to a string builder.
+ * @builder: the string builder or string builder symbol
+ * @string: the string to be appended
+ *
+ * Appends @string to the string builder. If @builder is an
+ * immediate value, it's left on the stack.
+ * [String manipulation commands]
+ */
+static int _filpf_sbappend(void)
+/** @builder_symbol @string sbappend */
+/** @builder @string sbappend %builder */
 {
     int i;
-    struct filp_val *h;
+    struct filp_val *v;
+    struct filp_val *b;
 
-    if ((h = filp_array_pop(&i, 0)) == NULL)
+    v = filp_pop();
+
+    if ((b = _filp_builder_pop(&i)) == NULL)
         return FILP_ERROR;
 
-    filp_push(filp_new_int_value(filp_hash_size(h)));
+    if (v->type != FILP_SCALAR && v->type != FILP_BUILDER) {
+        _filp_error = FILPERR_SCALAR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    if (!filp_builder_append(b, v->value, filp_val_len(v))) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    if (i)
+        filp_push(b);
+
+    return FILP_OK;
+}
+
+
+/**
+ * sbstr - Returns the content of a string builder.
+ * @builder: the string builder or string builder symbol
+ *
+ * Returns the string built so far by the string builder,
+ * that can still be appended to.
+ * [String manipulation commands]
+ */
+static int _filpf_sbstr(void)
+/** @builder sbstr %string */
+{
+    int i;
+    struct filp_val *b;
+
+    if ((b = _filp_builder_pop(&i)) == NULL)
+        return FILP_ERROR;
+
+    filp_push(filp_builder_str(b));
 
     return FILP_OK;
 }
@@ -2513,11 +4566,13 @@ void filp_lib_startup(void)
     filp_bin_code("length", _filpf_length);
     filp_bin_code("strlen", _filpf_length);
     filp_bin_code("substr", _filpf_substr);
+    filp_bin_code("chop", _filpf_chop);
     filp_bin_code("splice", _filpf_splice);
     filp_bin_code("instr", _filpf_instr);
     filp_bin_code("sprintf", _filpf_sprintf);
     filp_bin_code("sscanf", _filpf_sscanf);
     filp_bin_code("split", _filpf_split);
+    filp_bin_code("join", _filpf_join);
 
     filp_bin_code(")", _filpf_array);
     filp_bin_code("array", _filpf_array);
@@ -2531,11 +4586,41 @@ void filp_lib_startup(void)
     filp_bin_code("aseek", _filpf_array_seek);
     filp_bin_code("abseek", _filpf_array_binary_seek);
     filp_bin_code("asort", _filpf_array_sort);
+    filp_bin_code("nsort", _filpf_nsort);
+    filp_bin_code("sortby", _filpf_sortby);
+    filp_bin_code("aslice", _filpf_aslice);
+    filp_bin_code("ahead", _filpf_ahead);
+    filp_bin_code("atail", _filpf_atail);
     filp_bin_code("forall", _filpf_forall);
     filp_bin_code("map", _filpf_map);
+    filp_bin_code("filter", _filpf_filter);
+    filp_bin_code("grep", _filpf_filter);
+    filp_bin_code("partition", _filpf_partition);
+    filp_bin_code("reduce", _filpf_reduce);
+    filp_bin_code("fold", _filpf_reduce);
+    filp_bin_code("vector", _filpf_vector);
+    filp_bin_code("varray", _filpf_varray);
+    filp_bin_code("v+", _filpf_vadd);
+    filp_bin_code("v-", _filpf_vsub);
+    filp_bin_code("v*", _filpf_vmul);
+    filp_bin_code("v/", _filpf_vdiv);
+    filp_bin_code("vscale", _filpf_vscale);
+    filp_bin_code("v<", _filpf_vlt);
+    filp_bin_code("v>", _filpf_vgt);
+    filp_bin_code("v==", _filpf_veq);
+    filp_bin_code("vdot", _filpf_vdot);
+    filp_bin_code("sum", _filpf_sum);
+    filp_bin_code("min", _filpf_min);
+    filp_bin_code("max", _filpf_max);
+    filp_bin_code("mean", _filpf_mean);
+    filp_bin_code("count", _filpf_count);
 
     filp_bin_code("sweep", _filpf_sweep);
     filp_bin_code("dumper", _filpf_dumper);
+    filp_bin_code("jsonencode", _filpf_jsonencode);
+    filp_bin_code("jsondecode", _filpf_jsondecode);
+    filp_bin_code("freeze", _filpf_freeze);
+    filp_bin_code("thaw", _filpf_thaw);
 
     filp_bin_code("safe", _filpf_safe);
 
@@ -2548,6 +4633,21 @@ void filp_lib_startup(void)
     filp_bin_code("values", _filpf_values);
     filp_bin_code("hsize", _filpf_hsize);
 
+    filp_bin_code("omap", _filpf_omap);
+    filp_bin_code("oget", _filpf_oget);
+    filp_bin_code("oset", _filpf_oset);
+    filp_bin_code("odel", _filpf_odel);
+    filp_bin_code("osize", _filpf_osize);
+    filp_bin_code("ofloor", _filpf_ofloor);
+    filp_bin_code("oceil", _filpf_oceil);
+    filp_bin_code("orange", _filpf_orange);
+    filp_bin_code("odump", _filpf_odump);
+    filp_bin_code("okeys", _filpf_okeys);
+
+    filp_bin_code("sbnew", _filpf_sbnew);
+    filp_bin_code("sbappend", _filpf_sbappend);
+    filp_bin_code("sbstr", _filpf_sbstr);
+
     /**
      * tpop - Stores the top of stack into the temporal variable.
      * @value: value to be stored
@@ -2569,31 +4669,6 @@ void filp_lib_startup(void)
 
     filp_exec("/clean { { pop } foreach } set");
 
-    /**
-     * chop - Chops the last character of a string.
-     * @string: the string to be chopped
-     *
-     * Chops the last character of a string. Mainly to be used
-     * to cut the trailing \n character of a line read from a
-     * file.
-     * [String manipulation commands]
-     */
-    /** @string chop %strin */
-    filp_exec("/chop { dup length 1 - 1 # substr } set");
-
-    /**
-     * join - Joins a list into a string.
-     * @joiner: the joiner string
-     * @list_elements: the elements of the list
-     *
-     * Joins a list into a string, using the string @joiner
-     * as a glue.
-     * [String manipulation commands]
-     * [List processing commands]
-     */
-    /** [ @list_elements ] @joiner join %string */
-    filp_exec("/join { tpop # { # $_ # . . # } foreach } set");
-
     /**
      * sort - Sorts a list.
      * @list: the list
@@ -2750,7 +4825,7 @@ void filp_lib_startup(void)
      */
     /** filp_error_strings */
     filp_exec
-        ("/filp_error_strings ( 'token not found' 'scalar expected' 'internal error' 'out of memory' 'array expected' 'file expected' 'file not found' 'permission denied' 'not implemented' 'syntax error') =");
+        ("/filp_error_strings ( 'token not found' 'scalar expected' 'internal error' 'out of memory' 'array expected' 'file expected' 'file not found' 'permission denied' 'not implemented' 'syntax error' 'task expected' 'channel expected' 'generator expected' 'vector expected' 'ordered map expected' 'string builder expected') =");
 
     filp_exec("/#= { # = } set");
     filp_exec("/not { { false } { true } ifelse } set");
@@ -2771,6 +4846,7 @@ int filp_startup(void)
 {
     filp_lib_startup();
     filp_slib_startup();
+    filp_thread_startup();
 
     return 1;
 }
@@ -132,10 +132,20 @@ static void _filp_push_literal_string(char *str, int slash, int interp)
 }
 
 
-static int _filp_isspchar(char c)
-{
-    return strchr("{}()[]", c) != NULL;
-}
+/* char classes for the tokenizer */
+#define FILP_CC_SEP     1       /* token separator */
+#define FILP_CC_SPECIAL 2       /* one-char token */
+
+static unsigned char _filp_cclass[256] = {
+    ['\0'] = FILP_CC_SPECIAL,
+    [' '] = FILP_CC_SEP, ['\t'] = FILP_CC_SEP, ['\n'] = FILP_CC_SEP,
+    ['{'] = FILP_CC_SPECIAL, ['}'] = FILP_CC_SPECIAL,
+    ['('] = FILP_CC_SPECIAL, [')'] = FILP_CC_SPECIAL,
+    ['['] = FILP_CC_SPECIAL, [']'] = FILP_CC_SPECIAL
+};
+
+#define _filp_cc(c) _filp_cclass[(unsigned char) (c)]
+#define _filp_isspchar(c) (_filp_cc(c) & FILP_CC_SPECIAL)
 
 
 static char *_filp_parse_token(char *token, int *t_size, char **code_ptr)
@@ -147,7 +157,7 @@ static char *_filp_parse_token(char *token, int *t_size, char **code_ptr)
     code = *code_ptr;
 
     /* separate token */
-    while (filp_issep(*code))
+    while (_filp_cc(*code) & FILP_CC_SEP)
         code++;
 
     /* string literal? */
@@ -171,8 +181,13 @@ static char *_filp_parse_token(char *token, int *t_size, char **code_ptr)
         code++;
     }
     else {
-        for (; *code && !_filp_isspchar(*code) && !filp_issep(*code); code++, n++)
-            token = filp_poke(token, t_size, n, *code);
+        char *w = code;
+
+        /* a word: find its end, then copy it at once */
+        while (_filp_cc(*code) == 0)
+            code++;
+
+        token = filp_append(token, t_size, &n, w, code - w);
     }
 
     /* null-terminate token */
@@ -184,119 +199,245 @@ static char *_filp_parse_token(char *token, int *t_size, char **code_ptr)
 }
 
 
-static int _filp_process_token(char *token)
+/* compiled programs */
+
+#define FILP_OP_PUSH    0       /* push a literal value */
+#define FILP_OP_STRING  1       /* push an interpolated string */
+#define FILP_OP_SYMVAL  2       /* push the value of a symbol ($name) */
+#define FILP_OP_TOKEN   3       /* execute a symbol or push a literal */
+#define FILP_OP_BREAK   4
+#define FILP_OP_END     5
+
+struct filp_insn {
+    int op;                     /* FILP_OP_* */
+    char *token;                /* the token */
+    struct filp_val *value;     /* literal value */
+    struct filp_sym *sym;       /* cached symbol */
+    int serial;                 /* _filp_dict_serial when cached */
+};
+
+struct filp_prog {
+    int refs;                   /* references */
+    int num;                    /* number of instructions */
+    int size;                   /* allocated instructions */
+    struct filp_insn *insns;    /* the instructions */
+};
+
+
+static struct filp_insn *_filp_prog_add(struct filp_prog *p, int op, char *token)
+/* adds an instruction to a program */
 {
-    struct filp_val *v = NULL;
-    struct filp_sym *s;
-    int (*func) (void);
-    int ret = FILP_OK;
+    struct filp_insn *i;
+
+    if (p->num == p->size) {
+        p->size = p->size ? p->size * 2 : 16;
+        p->insns = (struct filp_insn *) realloc(p->insns,
+                                p->size * sizeof(struct filp_insn));
+    }
+
+    i = &p->insns[p->num++];
+    memset(i, '\0', sizeof(struct filp_insn));
+
+    i->op = op;
+    i->serial = -1;
+
+    if (token != NULL) {
+        i->token = (char *) malloc(strlen(token) + 1);
+        strcpy(i->token, token);
+    }
+
+    return i;
+}
+
+
+static void _filp_prog_literal(struct filp_insn *i, struct filp_val *v)
+/* sets the literal value of an instruction */
+{
+    i->value = v;
+    filp_ref_value(v);
+}
+
+
+static void _filp_compile_token(struct filp_prog *p, char *token)
+/* compiles a token */
+{
+    struct filp_insn *i;
+    char *pstr;
 
-    /* break? */
     if (strcmp(token, "break") == 0)
-        ret = FILP_BREAK;
+        _filp_prog_add(p, FILP_OP_BREAK, NULL);
     else
-        /* end? */
     if (strcmp(token, "end") == 0)
-        ret = FILP_END;
+        _filp_prog_add(p, FILP_OP_END, NULL);
     else
-        /* is it a single quoted literal string? */
-    if (*token == '\'')
-        _filp_push_literal_string(token, 0, 0);
+    if (*token == '\'' || (*token == '"' && strchr(token, '$') == NULL)) {
+        /* constant string */
+        i = _filp_prog_add(p, FILP_OP_PUSH, NULL);
+
+        pstr = _filp_parse_string(token, *token == '"', 0);
+        _filp_prog_literal(i, filp_new_interned_value(pstr));
+        free(pstr);
+    }
     else
-        /* is it a double quoted literal string? */
-    if (*token == '"')
-        _filp_push_literal_string(token, 1, 1);
+    if (*token == '"') {
+        /* interpolated at run time */
+        _filp_prog_add(p, FILP_OP_STRING, token);
+    }
     else
-        /* is it a symbol value? */
     if (*token == '$')
-        filp_push_symbol_value(token + 1);
-    else
-        /* is it a symbol name? */
-    if ((s = filp_find_symbol(token)) != NULL) {
-        v = s->value;
-
-        if (s->type == FILP_BIN_CODE) {
-            /* execute, if binary code */
-            func = (int (*)()) (v->value);
-            if (func)
-                ret = func();
-
-            v = NULL;
-        }
-        else if (s->type == FILP_CODE) {
-            /* execute, if filp code */
-            ret = filp_execv(v);
-            v = NULL;
-
-            /* don't propagate 'break' */
-            if (ret == FILP_BREAK)
-                ret = FILP_OK;
-        }
-        else
-            v = filp_new_value(FILP_SCALAR, token, -1);
-    }
+        _filp_prog_add(p, FILP_OP_SYMVAL, token + 1);
     else {
+        i = _filp_prog_add(p, FILP_OP_TOKEN, token);
+
+        /* the literal, if it's not a symbol */
         if (*token == '/')
             token++;
-        else if (!_filp_bareword) {
-            /* bang if it's not a number and we
-               don't want barewords (we don't) */
-            if (!isdigit((int) *token) && *token != '-') {
-                /* token not found */
-                _filp_error = FILPERR_TOKEN_NOT_FOUND;
-
-                strncpy(_filp_error_info, token, sizeof(_filp_error_info));
-                return -1;
+
+        _filp_prog_literal(i, filp_new_interned_value(token));
+    }
+}
+
+
+static struct filp_sym *_filp_insn_symbol(struct filp_insn *i)
+/* finds the symbol of an instruction, using the cached one if valid */
+{
+    if (i->serial != _filp_dict_serial) {
+        i->sym = filp_find_symbol(i->token);
+        i->serial = _filp_dict_serial;
+    }
+
+    return i->sym;
+}
+
+
+static int _filp_run_insn(struct filp_insn *i)
+/* runs an instruction */
+{
+    struct filp_val *v;
+    struct filp_sym *s;
+    int (*func) (void);
+    int ret = FILP_OK;
+
+    switch (i->op) {
+    case FILP_OP_PUSH:
+
+        filp_push(i->value);
+        break;
+
+    case FILP_OP_STRING:
+
+        _filp_push_literal_string(i->token, 1, 1);
+        break;
+
+    case FILP_OP_SYMVAL:
+
+        if ((s = _filp_insn_symbol(i)) != NULL)
+            filp_push(filp_get_symbol(s));
+        else
+            filp_null_push();
+
+        break;
+
+    case FILP_OP_TOKEN:
+
+        if ((s = _filp_insn_symbol(i)) != NULL) {
+            v = s->value;
+
+            if (s->type == FILP_BIN_CODE) {
+                /* execute, if binary code */
+                func = (int (*)()) (v->value);
+                if (func)
+                    ret = func();
+            }
+            else if (s->type == FILP_CODE) {
+                /* execute, if filp code */
+                ret = filp_execv(v);
+
+                /* don't propagate 'break' */
+                if (ret == FILP_BREAK)
+                    ret = FILP_OK;
             }
+            else if (*i->token == '/')
+                filp_scalar_push(i->token);
+            else
+                filp_push(i->value);
         }
+        else {
+            if (*i->token != '/' && !_filp_bareword) {
+                /* bang if it's not a number and we
+                   don't want barewords (we don't) */
+                if (!isdigit((int) *i->token) && *i->token != '-') {
+                    /* token not found */
+                    _filp_error = FILPERR_TOKEN_NOT_FOUND;
+
+                    strncpy(_filp_error_info, i->token, sizeof(_filp_error_info) - 1);
+                    _filp_error_info[sizeof(_filp_error_info) - 1] = '\0';
+                    return -1;
+                }
+            }
 
-        /* store as is, as a literal */
-        v = filp_new_value(FILP_SCALAR, token, -1);
-    }
+            /* store as is, as a literal */
+            filp_push(i->value);
+        }
+
+        break;
 
-    if (v != NULL)
-        filp_push(v);
+    case FILP_OP_BREAK:
+
+        ret = FILP_BREAK;
+        break;
+
+    case FILP_OP_END:
+
+        ret = FILP_END;
+        break;
+    }
 
     return ret;
 }
 
 
 /**
- * filp_exec - Executes filp code.
- * @code: filp code to run
+ * filp_compile - Compiles filp code.
+ * @code: filp code
  *
- * Executes the string as filp code. Returns 0 if everything is ok,
- * <0 on error or >0 if execution is intentionally interrupted
- * (by using break or end).
+ * Compiles the filp code into a program that can be run any number
+ * of times with filp_run(), avoiding to parse the source code on
+ * each execution. Literal values are created only once, and
+ * symbols are looked up once (until the dictionary changes).
+ * Symbols are still resolved at run time, so they can be defined
+ * after compiling the code. The returned program has a reference
+ * count of 1, and must be released with filp_prog_unref().
+ * Returns NULL on error.
  */
-int filp_exec(char *code)
-/* runs a program (main parser) */
+struct filp_prog *filp_compile(const char *code)
 {
+    struct filp_prog *p;
     int in_comment;
+    char *src = (char *) code;
     char *token = NULL;
     char *p_code = NULL;
     int t_size;
     int post_code, p_size, p_n;
-    int n, ret;
+    int n;
 
-    _in_filp++;
+    if ((p = (struct filp_prog *) calloc(1, sizeof(struct filp_prog))) == NULL)
+        return NULL;
+
+    p->refs = 1;
 
     in_comment = post_code = 0;
     t_size = p_size = p_n = 0;
-    ret = FILP_OK;
 
     /* if code starts with #!, ignore first line */
-    if (code[0] == '#' && code[1] == '!') {
-        while (*code != '\0' && *code != '\n')
-            code++;
-
-        if (*code == '\0')
-            return FILP_OK;
+    if (src[0] == '#' && src[1] == '!') {
+        while (*src != '\0' && *src != '\n')
+            src++;
     }
 
-    while (ret == FILP_OK) {
+    for (;;) {
         /* parse token */
-        token = _filp_parse_token(token, &t_size, &code);
+        token = _filp_parse_token(token, &t_size, &src);
 
         if (*token == '\0')
             break;
@@ -322,7 +463,8 @@ int filp_exec(char *code)
 
             if (post_code == 0) {
                 p_code = filp_poke(p_code, &p_size, p_n, '\0');
-                filp_code_push(p_code);
+                _filp_prog_literal(_filp_prog_add(p, FILP_OP_PUSH, NULL),
+                           filp_new_value(FILP_CODE, p_code, -1));
                 continue;
             }
         }
@@ -346,11 +488,7 @@ int filp_exec(char *code)
             continue;
         }
 
-        /* process it */
-        ret = _filp_process_token(token);
-
-        /* collect garbage */
-        filp_sweeper(0);
+        _filp_compile_token(p, token);
     }
 
     if (token)
@@ -358,6 +496,113 @@ int filp_exec(char *code)
     if (p_code)
         free(p_code);
 
+    return p;
+}
+
+
+/**
+ * filp_prog_ref - Adds a reference to a compiled program.
+ * @p: the program
+ *
+ * Adds a reference to a program created by filp_compile().
+ */
+void filp_prog_ref(struct filp_prog *p)
+{
+    p->refs++;
+}
+
+
+/**
+ * filp_prog_unref - Releases a reference to a compiled program.
+ * @p: the program
+ *
+ * Releases a reference to a program created by filp_compile(),
+ * destroying it when no one references it anymore.
+ */
+void filp_prog_unref(struct filp_prog *p)
+{
+    int n;
+
+    if (--p->refs)
+        return;
+
+    for (n = 0; n < p->num; n++) {
+        free(p->insns[n].token);
+
+        if (p->insns[n].value != NULL)
+            filp_unref_value(p->insns[n].value);
+    }
+
+    free(p->insns);
+    free(p);
+}
+
+
+static void _filp_prog_free_cache(void *p)
+{
+    filp_prog_unref((struct filp_prog *) p);
+}
+
+
+/**
+ * filp_run - Runs a compiled program.
+ * @p: the program
+ *
+ * Runs a program created by filp_compile(). Returns the
+ * same values as filp_exec().
+ */
+int filp_run(struct filp_prog *p)
+{
+    int n, ret = FILP_OK;
+
+    /* too deep for a C stack of fixed size? */
+    if (_filp_cstack_limit != NULL && (char *) &n < _filp_cstack_limit) {
+        _filp_error = FILPERR_INTERNAL_ERROR;
+        strcpy(_filp_error_info, "nested too deep");
+        return FILP_ERROR;
+    }
+
+    _in_filp++;
+
+    filp_prog_ref(p);
+
+    for (n = 0; n < p->num && ret == FILP_OK; n++) {
+        ret = _filp_run_insn(&p->insns[n]);
+
+        /* collect garbage */
+        filp_sweeper(0);
+    }
+
+    filp_prog_unref(p);
+
+    return ret;
+}
+
+
+/**
+ * filp_exec - Executes filp code.
+ * @code: filp code to run
+ *
+ * Executes the string as filp code. Returns 0 if everything is ok,
+ * <0 on error or >0 if execution is intentionally interrupted
+ * (by using break or end). If the same code is to be run many
+ * times, it's better to compile it once with filp_compile() and
+ * run it with filp_run().
+ */
+int filp_exec(char *code)
+{
+    struct filp_prog *p;
+    int ret;
+
+    if ((p = filp_compile(code)) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    ret = filp_run(p);
+
+    filp_prog_unref(p);
+
     return ret;
 }
 
@@ -367,18 +612,109 @@ int filp_exec(char *code)
  * @code: filp code with printf-like formatting
  *
  * Formats @code as a printf() -like string, and executes it
- * as filp code. See filp_exec() for return values.
+ * as filp code. See filp_exec() for return values. To pass
+ * values from C to filp code, filp_callv() is faster and safer.
  */
 int filp_execf(char *code, ...)
 {
-    char buf[4096];
+    char *buf = NULL;
+    int size = 256;
+    int n, ret;
     va_list argptr;
 
-    va_start(argptr, code);
-    vsprintf(buf, code, argptr);
+    /* format into a buffer big enough for the result */
+    for (;;) {
+        if ((buf = (char *) realloc(buf, size)) == NULL) {
+            _filp_error = FILPERR_OUT_OF_MEMORY;
+            return FILP_ERROR;
+        }
+
+        va_start(argptr, code);
+        n = vsnprintf(buf, size, code, argptr);
+        va_end(argptr);
+
+        if (n >= 0 && n < size)
+            break;
+
+        /* old C libraries return -1 instead of the needed size */
+        size = n >= 0 ? n + 1 : size * 2;
+    }
+
+    ret = filp_exec(buf);
+
+    free(buf);
+
+    return ret;
+}
+
+
+/**
+ * filp_callv - Calls a filp command with arguments.
+ * @word: name of the command
+ * @fmt: types of the arguments
+ *
+ * Pushes the rest of arguments to the stack and executes the
+ * command @word, without converting them to text and parsing
+ * them as filp_execf() does. Each character in @fmt tells the
+ * type of an argument: 'i' for an int, 'd' for a double, 's' for
+ * a string, 'v' for a struct filp_val * and 'n' for a NULL
+ * value (that takes no argument). If @word is not an executable
+ * symbol, its value is pushed. If @word does not exist, nothing
+ * is pushed. See filp_exec() for return values.
+ */
+int filp_callv(char *word, char *fmt, ...)
+{
+    struct filp_sym *s;
+    va_list argptr;
+    int ret = FILP_OK;
+
+    /* look it up first, so no arguments are left on error */
+    if ((s = filp_find_symbol(word)) == NULL) {
+        _filp_error = FILPERR_TOKEN_NOT_FOUND;
+        strncpy(_filp_error_info, word, sizeof(_filp_error_info) - 1);
+        _filp_error_info[sizeof(_filp_error_info) - 1] = '\0';
+        return FILP_ERROR;
+    }
+
+    va_start(argptr, fmt);
+
+    for (; fmt != NULL && *fmt; fmt++) {
+        switch (*fmt) {
+        case 'i':
+            filp_int_push(va_arg(argptr, int));
+            break;
+
+        case 'd':
+            filp_real_push(va_arg(argptr, double));
+            break;
+
+        case 's':
+            filp_scalar_push(va_arg(argptr, char *));
+            break;
+
+        case 'v':
+            filp_push(va_arg(argptr, struct filp_val *));
+            break;
+
+        case 'n':
+            filp_null_push();
+            break;
+        }
+    }
+
     va_end(argptr);
 
-    return filp_exec(buf);
+    if (s->type == FILP_BIN_CODE || s->type == FILP_CODE) {
+        _in_filp++;
+
+        /* don't propagate 'break' */
+        if ((ret = filp_execv(s->value)) == FILP_BREAK)
+            ret = FILP_OK;
+    }
+    else
+        filp_push(filp_get_symbol(s));
+
+    return ret;
 }
 
 
@@ -388,7 +724,8 @@ int filp_execf(char *code, ...)
  *
  * Executes filp code inside a value. The value @v must
  * be binary code, filp code or a scalar containing
- * filp code.
+ * filp code. Filp code values are compiled on the first
+ * execution, and the compiled program is kept with them.
  */
 int filp_execv(struct filp_val *v)
 {
@@ -400,7 +737,17 @@ int filp_execv(struct filp_val *v)
 
     filp_ref_value(v);
 
-    if (v->type == FILP_SCALAR || v->type == FILP_CODE)
+    if (v->type == FILP_CODE) {
+        /* code is compiled once and cached inside the value */
+        if (v->cache == NULL && (v->cache = filp_compile(v->value)) != NULL)
+            v->cache_free = _filp_prog_free_cache;
+
+        if (v->cache != NULL)
+            ret = filp_run((struct filp_prog *) v->cache);
+        else
+            ret = filp_exec(v->value);
+    }
+    else if (v->type == FILP_SCALAR)
         ret = filp_exec(v->value);
     else if (v->type == FILP_BIN_CODE) {
         func = (int (*)()) (v->value);
@@ -427,7 +774,8 @@ int filp_load_exec(char *filename)
     char *code;
 
     if ((code = filp_load_file(filename)) == NULL) {
-        strncpy(_filp_error_info, filename, sizeof(_filp_error_info));
+        strncpy(_filp_error_info, filename, sizeof(_filp_error_info) - 1);
+        _filp_error_info[sizeof(_filp_error_info) - 1] = '\0';
         _filp_error = FILPERR_FILE_NOT_FOUND;
         return -1;
     }
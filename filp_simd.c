@@ -0,0 +1,1036 @@
+/*
+
+    filp - Embeddable, Reverse Polish Notation Programming Language
+
+    Angel Ortega <angel@triptico.com>
+
+    This software is released into the public domain.
+    NO WARRANTY. See file LICENSE for details.
+
+*/
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filp.h"
+
+#ifdef CONFOPT_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef CONFOPT_X86_SIMD
+#include <immintrin.h>
+#define FILP_TARGET(t) __attribute__ ((target(t)))
+#endif
+
+/** data **/
+
+/* instruction set used by the kernels (-1, not yet detected) */
+static int _filp_simd = -1;
+
+/* the kernels */
+struct filp_kernels {
+    void (*add_r) (double *r, double *a, double *b, int n);
+    void (*sub_r) (double *r, double *a, double *b, int n);
+    void (*mul_r) (double *r, double *a, double *b, int n);
+    void (*div_r) (double *r, double *a, double *b, int n);
+    void (*add_i) (filp_int64 *r, filp_int64 *a, filp_int64 *b, int n);
+    void (*sub_i) (filp_int64 *r, filp_int64 *a, filp_int64 *b, int n);
+    void (*cmp_r) (filp_int64 *r, double *a, double *b, int n, int op);
+    double (*dot_r) (double *a, double *b, int n);
+    double (*sum_r) (double *a, int n);
+    double (*min_r) (double *a, int n);
+    double (*max_r) (double *a, int n);
+    filp_int64 (*sum_i) (filp_int64 *a, int n);
+    char *(*memmem) (char *h, int hl, char *n, int nl);
+    int (*memscan) (char *s, int l, char *set, int nset, int in);
+};
+
+static struct filp_kernels _filp_k;
+
+#ifdef CONFOPT_PTHREADS
+/* worker threads can be the first to use the kernels */
+static pthread_once_t _filp_simd_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/** code **/
+
+/* portable kernels */
+
+#define FILP_KERNEL(name, type, op) \
+static void name(type *r, type *a, type *b, int n) \
+{ \
+    int i; \
+    for (i = 0; i < n; i++) \
+        r[i] = a[i] op b[i]; \
+}
+
+FILP_KERNEL(_filp_add_r, double, +)
+FILP_KERNEL(_filp_sub_r, double, -)
+FILP_KERNEL(_filp_mul_r, double, *)
+FILP_KERNEL(_filp_div_r, double, /)
+FILP_KERNEL(_filp_add_i, filp_int64, +)
+FILP_KERNEL(_filp_sub_i, filp_int64, -)
+FILP_KERNEL(_filp_mul_i, filp_int64, *)
+
+static void _filp_div_i(filp_int64 *r, filp_int64 *a, filp_int64 *b, int n)
+{
+    int i;
+
+    /* division by zero gives zero */
+    for (i = 0; i < n; i++)
+        r[i] = b[i] ? a[i] / b[i] : 0;
+}
+
+
+#define FILP_CMP(op, a, b) \
+    ((op) == FILP_VOP_LT ? (a) < (b) : (op) == FILP_VOP_GT ? (a) > (b) : (a) == (b))
+
+static void _filp_cmp_r(filp_int64 *r, double *a, double *b, int n, int op)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        r[i] = FILP_CMP(op, a[i], b[i]);
+}
+
+
+static void _filp_cmp_i(filp_int64 *r, filp_int64 *a, filp_int64 *b, int n, int op)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        r[i] = FILP_CMP(op, a[i], b[i]);
+}
+
+
+static double _filp_dot_r(double *a, double *b, int n)
+{
+    double s = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        s += a[i] * b[i];
+
+    return s;
+}
+
+
+static double _filp_sum_r(double *a, int n)
+{
+    double s = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        s += a[i];
+
+    return s;
+}
+
+
+/* NaNs are skipped (the result is NaN only if all elements are),
+   the same as the SIMD kernels do */
+#define FILP_MINMAX_KERNEL(name, type, op) \
+static type name(type *a, int n) \
+{ \
+    type m; \
+    int i = 0; \
+    while (i < n - 1 && a[i] != a[i]) \
+        i++; \
+    m = a[i]; \
+    for (i++; i < n; i++) \
+        if (a[i] op m) \
+            m = a[i]; \
+    return m; \
+}
+
+FILP_MINMAX_KERNEL(_filp_min_r, double, <)
+FILP_MINMAX_KERNEL(_filp_max_r, double, >)
+FILP_MINMAX_KERNEL(_filp_min_i, filp_int64, <)
+FILP_MINMAX_KERNEL(_filp_max_i, filp_int64, >)
+
+static filp_int64 _filp_sum_i(filp_int64 *a, int n)
+{
+    filp_int64 s = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        s += a[i];
+
+    return s;
+}
+
+
+/* portable string kernels */
+
+static char *_filp_memmem(char *h, int hl, char *n, int nl)
+/* seeks the first char with memchr() and compares the rest */
+{
+    char *p;
+    char *e;
+
+    if (nl == 0)
+        return h;
+
+    if (nl > hl)
+        return NULL;
+
+    e = h + hl - nl;
+
+    for (p = h; p <= e && (p = memchr(p, *n, e - p + 1)) != NULL; p++) {
+        if (memcmp(p + 1, n + 1, nl - 1) == 0)
+            return p;
+    }
+
+    return NULL;
+}
+
+
+static int _filp_memscan(char *s, int l, char *set, int nset, int in)
+/* returns the offset of the first char of s that is (if in is set)
+   or is not in set, or l if there is none */
+{
+    unsigned char t[256];
+    char *p;
+    int i;
+
+    if (nset == 1 && in) {
+        p = memchr(s, *set, l);
+        return p ? p - s : l;
+    }
+
+    memset(t, !in, sizeof(t));
+
+    for (i = 0; i < nset; i++)
+        t[(unsigned char) set[i]] = !!in;
+
+    for (i = 0; i < l && !t[(unsigned char) s[i]]; i++);
+
+    return i;
+}
+
+
+#ifdef CONFOPT_X86_SIMD
+
+/* SSE2 kernels */
+
+#define FILP_SSE2_KERNEL(name, op, intr) \
+static FILP_TARGET("sse2") void name(double *r, double *a, double *b, int n) \
+{ \
+    int i; \
+    for (i = 0; i + 2 <= n; i += 2) \
+        _mm_storeu_pd(r + i, intr(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))); \
+    for (; i < n; i++) \
+        r[i] = a[i] op b[i]; \
+}
+
+FILP_SSE2_KERNEL(_filp_add_r_sse2, +, _mm_add_pd)
+FILP_SSE2_KERNEL(_filp_sub_r_sse2, -, _mm_sub_pd)
+FILP_SSE2_KERNEL(_filp_mul_r_sse2, *, _mm_mul_pd)
+FILP_SSE2_KERNEL(_filp_div_r_sse2, /, _mm_div_pd)
+
+#define FILP_SSE2_IKERNEL(name, op, intr) \
+static FILP_TARGET("sse2") void name(filp_int64 *r, filp_int64 *a, filp_int64 *b, int n) \
+{ \
+    int i; \
+    for (i = 0; i + 2 <= n; i += 2) \
+        _mm_storeu_si128((__m128i *) (r + i), \
+            intr(_mm_loadu_si128((__m128i *) (a + i)), \
+                 _mm_loadu_si128((__m128i *) (b + i)))); \
+    for (; i < n; i++) \
+        r[i] = a[i] op b[i]; \
+}
+
+FILP_SSE2_IKERNEL(_filp_add_i_sse2, +, _mm_add_epi64)
+FILP_SSE2_IKERNEL(_filp_sub_i_sse2, -, _mm_sub_epi64)
+
+static FILP_TARGET("sse2")
+void _filp_cmp_r_sse2(filp_int64 *r, double *a, double *b, int n, int op)
+{
+    __m128d x, y, m;
+    int i, bits;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        x = _mm_loadu_pd(a + i);
+        y = _mm_loadu_pd(b + i);
+
+        if (op == FILP_VOP_LT)
+            m = _mm_cmplt_pd(x, y);
+        else if (op == FILP_VOP_GT)
+            m = _mm_cmpgt_pd(x, y);
+        else
+            m = _mm_cmpeq_pd(x, y);
+
+        bits = _mm_movemask_pd(m);
+        r[i] = bits & 1;
+        r[i + 1] = (bits >> 1) & 1;
+    }
+
+    for (; i < n; i++)
+        r[i] = FILP_CMP(op, a[i], b[i]);
+}
+
+
+static FILP_TARGET("sse2")
+double _filp_dot_r_sse2(double *a, double *b, int n)
+{
+    __m128d acc = _mm_setzero_pd();
+    double t[2];
+    int i;
+
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+    _mm_storeu_pd(t, acc);
+    t[0] += t[1];
+
+    for (; i < n; i++)
+        t[0] += a[i] * b[i];
+
+    return t[0];
+}
+
+
+static FILP_TARGET("sse2")
+double _filp_sum_r_sse2(double *a, int n)
+{
+    __m128d acc = _mm_setzero_pd();
+    double t[2];
+    int i;
+
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_loadu_pd(a + i));
+
+    _mm_storeu_pd(t, acc);
+    t[0] += t[1];
+
+    for (; i < n; i++)
+        t[0] += a[i];
+
+    return t[0];
+}
+
+
+/* min/max_pd return their second operand if any is NaN, so
+   starting from a number and passing it second skips NaNs */
+#define FILP_SSE2_MINMAX_KERNEL(name, op, intr) \
+static FILP_TARGET("sse2") double name(double *a, int n) \
+{ \
+    __m128d m; \
+    double t[2]; \
+    int i = 0; \
+    while (i < n - 1 && a[i] != a[i]) \
+        i++; \
+    m = _mm_set1_pd(a[i]); \
+    for (; i + 2 <= n; i += 2) \
+        m = intr(_mm_loadu_pd(a + i), m); \
+    _mm_storeu_pd(t, m); \
+    if (t[1] op t[0]) \
+        t[0] = t[1]; \
+    for (; i < n; i++) \
+        if (a[i] op t[0]) \
+            t[0] = a[i]; \
+    return t[0]; \
+}
+
+FILP_SSE2_MINMAX_KERNEL(_filp_min_r_sse2, <, _mm_min_pd)
+FILP_SSE2_MINMAX_KERNEL(_filp_max_r_sse2, >, _mm_max_pd)
+
+static FILP_TARGET("sse2")
+filp_int64 _filp_sum_i_sse2(filp_int64 *a, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    filp_int64 t[2];
+    int i;
+
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((__m128i *) (a + i)));
+
+    _mm_storeu_si128((__m128i *) t, acc);
+    t[0] += t[1];
+
+    for (; i < n; i++)
+        t[0] += a[i];
+
+    return t[0];
+}
+
+
+/* string kernels: the candidate positions of a substring are the
+   ones where both its first and last chars match, tested for a
+   whole block at once; sets of up to FILP_SIMD_SET chars are
+   compared char by char, bigger ones use the portable table */
+
+#define FILP_SIMD_SET 4
+
+static FILP_TARGET("sse2")
+char *_filp_memmem_sse2(char *h, int hl, char *n, int nl)
+{
+    __m128i f, l, a, b;
+    unsigned int m;
+    int i;
+
+    if (nl < 2 || hl < nl + 16)
+        return _filp_memmem(h, hl, n, nl);
+
+    f = _mm_set1_epi8(n[0]);
+    l = _mm_set1_epi8(n[nl - 1]);
+
+    for (i = 0; i + nl - 1 + 16 <= hl; i += 16) {
+        a = _mm_loadu_si128((__m128i *) (h + i));
+        b = _mm_loadu_si128((__m128i *) (h + i + nl - 1));
+
+        m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+
+        for (; m; m &= m - 1) {
+            char *p = h + i + __builtin_ctz(m);
+
+            if (memcmp(p + 1, n + 1, nl - 2) == 0)
+                return p;
+        }
+    }
+
+    return _filp_memmem(h + i, hl - i, n, nl);
+}
+
+
+static FILP_TARGET("sse2")
+int _filp_memscan_sse2(char *s, int l, char *set, int nset, int in)
+{
+    __m128i c[FILP_SIMD_SET];
+    __m128i a, r;
+    unsigned int m;
+    int i, j;
+
+    if (nset == 0 || nset > FILP_SIMD_SET)
+        return _filp_memscan(s, l, set, nset, in);
+
+    for (j = 0; j < nset; j++)
+        c[j] = _mm_set1_epi8(set[j]);
+
+    for (i = 0; i + 16 <= l; i += 16) {
+        a = _mm_loadu_si128((__m128i *) (s + i));
+        r = _mm_cmpeq_epi8(a, c[0]);
+
+        for (j = 1; j < nset; j++)
+            r = _mm_or_si128(r, _mm_cmpeq_epi8(a, c[j]));
+
+        m = _mm_movemask_epi8(r);
+
+        if (!in)
+            m = ~m & 0xffff;
+
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+
+    return i + _filp_memscan(s + i, l - i, set, nset, in);
+}
+
+
+/* AVX2 kernels */
+
+#define FILP_AVX2_KERNEL(name, op, intr) \
+static FILP_TARGET("avx2") void name(double *r, double *a, double *b, int n) \
+{ \
+    int i; \
+    for (i = 0; i + 4 <= n; i += 4) \
+        _mm256_storeu_pd(r + i, intr(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+    for (; i < n; i++) \
+        r[i] = a[i] op b[i]; \
+}
+
+FILP_AVX2_KERNEL(_filp_add_r_avx2, +, _mm256_add_pd)
+FILP_AVX2_KERNEL(_filp_sub_r_avx2, -, _mm256_sub_pd)
+FILP_AVX2_KERNEL(_filp_mul_r_avx2, *, _mm256_mul_pd)
+FILP_AVX2_KERNEL(_filp_div_r_avx2, /, _mm256_div_pd)
+
+#define FILP_AVX2_IKERNEL(name, op, intr) \
+static FILP_TARGET("avx2") void name(filp_int64 *r, filp_int64 *a, filp_int64 *b, int n) \
+{ \
+    int i; \
+    for (i = 0; i + 4 <= n; i += 4) \
+        _mm256_storeu_si256((__m256i *) (r + i), \
+            intr(_mm256_loadu_si256((__m256i *) (a + i)), \
+                 _mm256_loadu_si256((__m256i *) (b + i)))); \
+    for (; i < n; i++) \
+        r[i] = a[i] op b[i]; \
+}
+
+FILP_AVX2_IKERNEL(_filp_add_i_avx2, +, _mm256_add_epi64)
+FILP_AVX2_IKERNEL(_filp_sub_i_avx2, -, _mm256_sub_epi64)
+
+static FILP_TARGET("avx2")
+void _filp_cmp_r_avx2(filp_int64 *r, double *a, double *b, int n, int op)
+{
+    __m256d x, y, m;
+    int i, bits;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        x = _mm256_loadu_pd(a + i);
+        y = _mm256_loadu_pd(b + i);
+
+        if (op == FILP_VOP_LT)
+            m = _mm256_cmp_pd(x, y, _CMP_LT_OQ);
+        else if (op == FILP_VOP_GT)
+            m = _mm256_cmp_pd(x, y, _CMP_GT_OQ);
+        else
+            m = _mm256_cmp_pd(x, y, _CMP_EQ_OQ);
+
+        bits = _mm256_movemask_pd(m);
+        r[i] = bits & 1;
+        r[i + 1] = (bits >> 1) & 1;
+        r[i + 2] = (bits >> 2) & 1;
+        r[i + 3] = (bits >> 3) & 1;
+    }
+
+    for (; i < n; i++)
+        r[i] = FILP_CMP(op, a[i], b[i]);
+}
+
+
+static FILP_TARGET("avx2")
+double _filp_dot_r_avx2(double *a, double *b, int n)
+{
+    __m256d acc = _mm256_setzero_pd();
+    double t[4];
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc,
+                    _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+    _mm256_storeu_pd(t, acc);
+    t[0] += t[1] + t[2] + t[3];
+
+    for (; i < n; i++)
+        t[0] += a[i] * b[i];
+
+    return t[0];
+}
+
+
+static FILP_TARGET("avx2")
+double _filp_sum_r_avx2(double *a, int n)
+{
+    __m256d acc = _mm256_setzero_pd();
+    double t[4];
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+
+    _mm256_storeu_pd(t, acc);
+    t[0] += t[1] + t[2] + t[3];
+
+    for (; i < n; i++)
+        t[0] += a[i];
+
+    return t[0];
+}
+
+
+#define FILP_AVX2_MINMAX_KERNEL(name, op, intr, scalar) \
+static FILP_TARGET("avx2") double name(double *a, int n) \
+{ \
+    __m256d m; \
+    double t[4]; \
+    int i = 0; \
+    while (i < n - 1 && a[i] != a[i]) \
+        i++; \
+    m = _mm256_set1_pd(a[i]); \
+    for (; i + 4 <= n; i += 4) \
+        m = intr(_mm256_loadu_pd(a + i), m); \
+    _mm256_storeu_pd(t, m); \
+    t[0] = scalar(t, 4); \
+    for (; i < n; i++) \
+        if (a[i] op t[0]) \
+            t[0] = a[i]; \
+    return t[0]; \
+}
+
+FILP_AVX2_MINMAX_KERNEL(_filp_min_r_avx2, <, _mm256_min_pd, _filp_min_r)
+FILP_AVX2_MINMAX_KERNEL(_filp_max_r_avx2, >, _mm256_max_pd, _filp_max_r)
+
+static FILP_TARGET("avx2")
+filp_int64 _filp_sum_i_avx2(filp_int64 *a, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    filp_int64 t[4];
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_add_epi64(acc, _mm256_loadu_si256((__m256i *) (a + i)));
+
+    _mm256_storeu_si256((__m256i *) t, acc);
+    t[0] += t[1] + t[2] + t[3];
+
+    for (; i < n; i++)
+        t[0] += a[i];
+
+    return t[0];
+}
+
+
+static FILP_TARGET("avx2")
+char *_filp_memmem_avx2(char *h, int hl, char *n, int nl)
+{
+    __m256i f, l, a, b;
+    unsigned int m;
+    int i;
+
+    if (nl < 2 || hl < nl + 32)
+        return _filp_memmem_sse2(h, hl, n, nl);
+
+    f = _mm256_set1_epi8(n[0]);
+    l = _mm256_set1_epi8(n[nl - 1]);
+
+    for (i = 0; i + nl - 1 + 32 <= hl; i += 32) {
+        a = _mm256_loadu_si256((__m256i *) (h + i));
+        b = _mm256_loadu_si256((__m256i *) (h + i + nl - 1));
+
+        m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, f),
+                                                  _mm256_cmpeq_epi8(b, l)));
+
+        for (; m; m &= m - 1) {
+            char *p = h + i + __builtin_ctz(m);
+
+            if (memcmp(p + 1, n + 1, nl - 2) == 0)
+                return p;
+        }
+    }
+
+    return _filp_memmem_sse2(h + i, hl - i, n, nl);
+}
+
+
+static FILP_TARGET("avx2")
+int _filp_memscan_avx2(char *s, int l, char *set, int nset, int in)
+{
+    __m256i c[FILP_SIMD_SET];
+    __m256i a, r;
+    unsigned int m;
+    int i, j;
+
+    if (nset == 0 || nset > FILP_SIMD_SET)
+        return _filp_memscan(s, l, set, nset, in);
+
+    for (j = 0; j < nset; j++)
+        c[j] = _mm256_set1_epi8(set[j]);
+
+    for (i = 0; i + 32 <= l; i += 32) {
+        a = _mm256_loadu_si256((__m256i *) (s + i));
+        r = _mm256_cmpeq_epi8(a, c[0]);
+
+        for (j = 1; j < nset; j++)
+            r = _mm256_or_si256(r, _mm256_cmpeq_epi8(a, c[j]));
+
+        m = _mm256_movemask_epi8(r);
+
+        if (!in)
+            m = ~m;
+
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+
+    return i + _filp_memscan_sse2(s + i, l - i, set, nset, in);
+}
+
+#endif              /* CONFOPT_X86_SIMD */
+
+
+static void _filp_simd_init(void)
+/* detects the instruction set and selects the kernels */
+{
+    int level = 0;
+
+    _filp_k.add_r = _filp_add_r;
+    _filp_k.sub_r = _filp_sub_r;
+    _filp_k.mul_r = _filp_mul_r;
+    _filp_k.div_r = _filp_div_r;
+    _filp_k.add_i = _filp_add_i;
+    _filp_k.sub_i = _filp_sub_i;
+    _filp_k.cmp_r = _filp_cmp_r;
+    _filp_k.dot_r = _filp_dot_r;
+    _filp_k.sum_r = _filp_sum_r;
+    _filp_k.min_r = _filp_min_r;
+    _filp_k.max_r = _filp_max_r;
+    _filp_k.sum_i = _filp_sum_i;
+    _filp_k.memmem = _filp_memmem;
+    _filp_k.memscan = _filp_memscan;
+
+#ifdef CONFOPT_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        _filp_k.add_r = _filp_add_r_avx2;
+        _filp_k.sub_r = _filp_sub_r_avx2;
+        _filp_k.mul_r = _filp_mul_r_avx2;
+        _filp_k.div_r = _filp_div_r_avx2;
+        _filp_k.add_i = _filp_add_i_avx2;
+        _filp_k.sub_i = _filp_sub_i_avx2;
+        _filp_k.cmp_r = _filp_cmp_r_avx2;
+        _filp_k.dot_r = _filp_dot_r_avx2;
+        _filp_k.sum_r = _filp_sum_r_avx2;
+        _filp_k.min_r = _filp_min_r_avx2;
+        _filp_k.max_r = _filp_max_r_avx2;
+        _filp_k.sum_i = _filp_sum_i_avx2;
+        _filp_k.memmem = _filp_memmem_avx2;
+        _filp_k.memscan = _filp_memscan_avx2;
+
+        level = 2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        _filp_k.add_r = _filp_add_r_sse2;
+        _filp_k.sub_r = _filp_sub_r_sse2;
+        _filp_k.mul_r = _filp_mul_r_sse2;
+        _filp_k.div_r = _filp_div_r_sse2;
+        _filp_k.add_i = _filp_add_i_sse2;
+        _filp_k.sub_i = _filp_sub_i_sse2;
+        _filp_k.cmp_r = _filp_cmp_r_sse2;
+        _filp_k.dot_r = _filp_dot_r_sse2;
+        _filp_k.sum_r = _filp_sum_r_sse2;
+        _filp_k.min_r = _filp_min_r_sse2;
+        _filp_k.max_r = _filp_max_r_sse2;
+        _filp_k.sum_i = _filp_sum_i_sse2;
+        _filp_k.memmem = _filp_memmem_sse2;
+        _filp_k.memscan = _filp_memscan_sse2;
+
+        level = 1;
+    }
+#endif
+
+    _filp_simd = level;
+}
+
+
+/**
+ * filp_simd_level - Returns the instruction set used by vector kernels.
+ *
+ * Detects (on the first call) the best instruction set supported
+ * by the processor and selects the vector kernels accordingly.
+ * It's safe to call it from several threads at once.
+ * Returns 2 if AVX2 is used, 1 for SSE2 and 0 if only portable C
+ * code is used (processor not supported or filp built without
+ * SIMD support).
+ */
+int filp_simd_level(void)
+{
+#ifdef CONFOPT_PTHREADS
+    pthread_once(&_filp_simd_once, _filp_simd_init);
+#else
+    if (_filp_simd == -1)
+        _filp_simd_init();
+#endif
+
+    return _filp_simd;
+}
+
+
+static int _filp_operand_kind(struct filp_val *v)
+/* returns the element type of an operand (a vector or a scalar) */
+{
+    char *ptr;
+    int kind;
+
+    if (filp_vector_data(v, &kind, NULL) != NULL)
+        return kind;
+
+    /* scalars are integers only if they look like one */
+    if (v->type == FILP_SCALAR && v->value != NULL && *v->value != '\0') {
+        strtoll(v->value, &ptr, 0);
+
+        if (*ptr == '\0')
+            return FILP_VEC_INT;
+    }
+
+    return FILP_VEC_REAL;
+}
+
+
+static void *_filp_operand_data(struct filp_val *v, int kind, int num, void **tmp)
+/* returns @num elements of an operand as @kind, converting them (or
+   repeating it, if it's a scalar) into a temporary block if needed */
+{
+    void *data;
+    char *ptr;
+    filp_int64 i;
+    double d;
+    int k, n;
+
+    *tmp = NULL;
+
+    if ((data = filp_vector_data(v, &k, NULL)) != NULL && k == kind)
+        return data;
+
+    /* both element types have the same size */
+    if ((*tmp = malloc((num ? num : 1) * sizeof(double))) == NULL)
+        return NULL;
+
+    if (data == NULL) {
+        ptr = v->type == FILP_SCALAR && v->value != NULL ? v->value : "0";
+        i = strtoll(ptr, NULL, 0);
+        d = strtod(ptr, NULL);
+
+        for (n = 0; n < num; n++) {
+            if (kind == FILP_VEC_INT)
+                ((filp_int64 *) *tmp)[n] = i;
+            else
+                ((double *) *tmp)[n] = d;
+        }
+    }
+    else if (kind == FILP_VEC_REAL) {
+        for (n = 0; n < num; n++)
+            ((double *) *tmp)[n] = (double) ((filp_int64 *) data)[n];
+    }
+    else {
+        for (n = 0; n < num; n++)
+            ((filp_int64 *) *tmp)[n] = (filp_int64) ((double *) data)[n];
+    }
+
+    return *tmp;
+}
+
+
+static int _filp_operand_size(struct filp_val *a, struct filp_val *b)
+/* returns the number of elements of an operation (the shortest) */
+{
+    int na, nb;
+
+    na = a->type == FILP_VECTOR ? filp_vector_size(a) : -1;
+    nb = b->type == FILP_VECTOR ? filp_vector_size(b) : -1;
+
+    if (na == -1 || (nb != -1 && nb < na))
+        return nb;
+
+    return na;
+}
+
+
+/**
+ * filp_vector_op - Operates on numeric vectors element by element.
+ * @op: the operation
+ * @a: first operand
+ * @b: second operand
+ *
+ * Applies the @op operation (FILP_VOP_ADD, FILP_VOP_SUB, FILP_VOP_MUL
+ * or FILP_VOP_DIV) to each pair of elements of the @a and @b vectors,
+ * returning a new vector with the results. If any of the operands
+ * is a scalar, it's used for all the elements of the other one. The
+ * result is an integer vector if both operands are integers, and
+ * a real one otherwise; integer divisions by zero give zero. The
+ * comparisons FILP_VOP_LT, FILP_VOP_GT and FILP_VOP_EQ return a mask
+ * (an integer vector of ones and zeros) instead. If vectors differ
+ * in size, the longest one is truncated. The kernels use SIMD
+ * instructions if available (see filp_simd_level()).
+ * Returns NULL if none of the operands is a vector.
+ */
+struct filp_val *filp_vector_op(int op, struct filp_val *a, struct filp_val *b)
+{
+    struct filp_val *r;
+    void *x, *y, *tx, *ty, *d;
+    int kind, num;
+
+    if (a->type != FILP_VECTOR && b->type != FILP_VECTOR)
+        return NULL;
+
+    filp_simd_level();
+
+    num = _filp_operand_size(a, b);
+
+    if (_filp_operand_kind(a) == FILP_VEC_INT && _filp_operand_kind(b) == FILP_VEC_INT)
+        kind = FILP_VEC_INT;
+    else
+        kind = FILP_VEC_REAL;
+
+    x = _filp_operand_data(a, kind, num, &tx);
+    y = _filp_operand_data(b, kind, num, &ty);
+
+    r = filp_new_vector(op >= FILP_VOP_LT ? FILP_VEC_INT : kind, NULL, num);
+
+    if (r != NULL && x != NULL && y != NULL) {
+        d = filp_vector_data(r, NULL, NULL);
+
+        if (kind == FILP_VEC_REAL) {
+            switch (op) {
+            case FILP_VOP_ADD: _filp_k.add_r(d, x, y, num); break;
+            case FILP_VOP_SUB: _filp_k.sub_r(d, x, y, num); break;
+            case FILP_VOP_MUL: _filp_k.mul_r(d, x, y, num); break;
+            case FILP_VOP_DIV: _filp_k.div_r(d, x, y, num); break;
+            default: _filp_k.cmp_r(d, x, y, num, op); break;
+            }
+        }
+        else {
+            switch (op) {
+            case FILP_VOP_ADD: _filp_k.add_i(d, x, y, num); break;
+            case FILP_VOP_SUB: _filp_k.sub_i(d, x, y, num); break;
+            case FILP_VOP_MUL: _filp_mul_i(d, x, y, num); break;
+            case FILP_VOP_DIV: _filp_div_i(d, x, y, num); break;
+            default: _filp_cmp_i(d, x, y, num, op); break;
+            }
+        }
+    }
+
+    free(tx);
+    free(ty);
+
+    return r;
+}
+
+
+/**
+ * filp_vector_dot - Returns the dot product of two numeric vectors.
+ * @a: first vector
+ * @b: second vector
+ *
+ * Returns the sum of the products of each pair of elements of
+ * the @a and @b vectors, computed as doubles. As in filp_vector_op(),
+ * any of them can be a scalar, and the longest vector is truncated.
+ * Returns 0 if none of the operands is a vector.
+ */
+double filp_vector_dot(struct filp_val *a, struct filp_val *b)
+{
+    void *x, *y, *tx, *ty;
+    double r = 0;
+    int num;
+
+    if (a->type != FILP_VECTOR && b->type != FILP_VECTOR)
+        return 0;
+
+    filp_simd_level();
+
+    num = _filp_operand_size(a, b);
+
+    x = _filp_operand_data(a, FILP_VEC_REAL, num, &tx);
+    y = _filp_operand_data(b, FILP_VEC_REAL, num, &ty);
+
+    if (x != NULL && y != NULL)
+        r = _filp_k.dot_r(x, y, num);
+
+    free(tx);
+    free(ty);
+
+    return r;
+}
+
+
+/**
+ * filp_vector_reduce - Reduces a numeric vector to a single value.
+ * @op: the reduction
+ * @v: the vector
+ *
+ * Returns a new scalar value with the sum (FILP_VRED_SUM), the
+ * minimum (FILP_VRED_MIN), the maximum (FILP_VRED_MAX), the mean
+ * (FILP_VRED_MEAN) or the number (FILP_VRED_COUNT) of the elements
+ * of the @v vector. Sums, minimums and maximums of integer vectors
+ * are integers; the rest are reals. NaN elements are skipped by
+ * the minimum and the maximum. The kernels use SIMD instructions
+ * if available (see filp_simd_level()), with the same results.
+ * Returns a NULL value if the vector is empty (except for
+ * FILP_VRED_COUNT), or NULL if @v is not a vector.
+ */
+struct filp_val *filp_vector_reduce(int op, struct filp_val *v)
+{
+    void *data;
+    filp_int64 i = 0;
+    double d = 0;
+    int kind, num;
+
+    if ((data = filp_vector_data(v, &kind, &num)) == NULL)
+        return NULL;
+
+    if (op == FILP_VRED_COUNT)
+        return filp_new_int_value(num);
+
+    if (num == 0)
+        return _filp_null_value;
+
+    filp_simd_level();
+
+    if (kind == FILP_VEC_INT) {
+        switch (op) {
+        case FILP_VRED_SUM: i = _filp_k.sum_i(data, num); break;
+        case FILP_VRED_MIN: i = _filp_min_i(data, num); break;
+        case FILP_VRED_MAX: i = _filp_max_i(data, num); break;
+        case FILP_VRED_MEAN:
+            return filp_new_real_value((double) _filp_k.sum_i(data, num) / num);
+        }
+
+        return filp_new_int64_value(i);
+    }
+
+    switch (op) {
+    case FILP_VRED_SUM: d = _filp_k.sum_r(data, num); break;
+    case FILP_VRED_MIN: d = _filp_k.min_r(data, num); break;
+    case FILP_VRED_MAX: d = _filp_k.max_r(data, num); break;
+    case FILP_VRED_MEAN: d = _filp_k.sum_r(data, num) / num; break;
+    }
+
+    return filp_new_real_value(d);
+}
+
+
+/* strings */
+
+/**
+ * filp_memmem - Finds a string inside another.
+ * @h: the string to be searched into
+ * @hl: length of @h
+ * @n: the string to be searched
+ * @nl: length of @n
+ *
+ * Returns a pointer to the first occurrence of the @nl bytes
+ * of @n inside the @hl bytes of @h, or NULL if there is none.
+ * Both can contain null bytes. The search uses SIMD instructions
+ * if available (see filp_simd_level()).
+ */
+char *filp_memmem(char *h, int hl, char *n, int nl)
+{
+    filp_simd_level();
+
+    return _filp_k.memmem(h, hl, n, nl);
+}
+
+
+/**
+ * filp_memcspn - Scans a string for a set of chars.
+ * @s: the string
+ * @l: length of @s
+ * @set: the set of chars
+ * @nset: number of chars in @set
+ *
+ * Returns the number of bytes at the beginning of @s that are
+ * not in @set, as strcspn() but bounded by the length instead
+ * of by a null byte. Uses SIMD instructions if available.
+ */
+int filp_memcspn(char *s, int l, char *set, int nset)
+{
+    filp_simd_level();
+
+    return _filp_k.memscan(s, l, set, nset, 1);
+}
+
+
+/**
+ * filp_memspn - Skips the chars of a string from a set.
+ * @s: the string
+ * @l: length of @s
+ * @set: the set of chars
+ * @nset: number of chars in @set
+ *
+ * Returns the number of bytes at the beginning of @s that are
+ * in @set, as strspn() but bounded by the length instead of by
+ * a null byte. Uses SIMD instructions if available.
+ */
+int filp_memspn(char *s, int l, char *set, int nset)
+{
+    filp_simd_level();
+
+    return _filp_k.memscan(s, l, set, nset, 0);
+}
@@ -115,8 +115,13 @@ static char *_filp_readline_match(const char *text, int state)
     v = filp_pop();
 
     if (v->type != FILP_NULL) {
-        char *ptr = v->value;
-        v->value = NULL;
+        /* readline frees it: give it a copy, as the
+           value may share its bytes (e.g. interned names) */
+        char *ptr = (char *) malloc(strlen(v->value) + 1);
+
+        if (ptr != NULL)
+            strcpy(ptr, v->value);
+
         return ptr;
     }
 
@@ -286,7 +291,7 @@ char *filp_readline(char *prompt)
             else if (history > 1)
                 history--;
 
-            filp_execf("/filp_command_history %d @", history);
+            filp_callv("@", "si", "filp_command_history", history);
             v = filp_pop();
 
             if (v->type == FILP_NULL) {
@@ -382,6 +387,7 @@ static int _filpf_putenv(void)
 /** @envvar @value putenv */
 {
     struct filp_val *v;
+    char *ptr;
 
     filp_exec("# '=' . # .");
 
@@ -389,8 +395,14 @@ static int _filpf_putenv(void)
 
     ASSERT_ISOLATE();
 
-    putenv(v->value);
-    v->value = NULL;
+    /* the environment keeps the string: give it a copy */
+    if ((ptr = (char *) malloc(strlen(v->value) + 1)) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    strcpy(ptr, v->value);
+    putenv(ptr);
 
     return FILP_OK;
 }
@@ -411,7 +423,8 @@ static int _filpf_print(void)
     struct filp_val *v;
 
     v = filp_pop();
-    printf("%s\n", v->value);
+    fwrite(v->value, 1, filp_val_len(v), stdout);
+    putchar('\n');
 
     return FILP_OK;
 }
@@ -432,7 +445,7 @@ static int _filpf_printwn(void)
     struct filp_val *v;
 
     v = filp_pop();
-    printf("%s", v->value);
+    fwrite(v->value, 1, filp_val_len(v), stdout);
 
     return FILP_OK;
 }
@@ -577,6 +590,7 @@ static int _filpf_open(void)
     FILE *f;
     char *name;
     char *mode;
+    char *tmp = NULL;
     int pipe = 0;
 
     nv = filp_pop();
@@ -618,7 +632,11 @@ static int _filpf_open(void)
         mode = "w";
     }
     else if (name[strlen(name) - 1] == '|') {
-        name[strlen(name) - 1] = '\0';
+        /* work on a copy: the value may be a shared literal */
+        tmp = (char *) malloc(strlen(name) + 1);
+        strcpy(tmp, name);
+        tmp[strlen(tmp) - 1] = '\0';
+        name = tmp;
         pipe = 1;
         mode = "r";
     }
@@ -630,6 +648,9 @@ static int _filpf_open(void)
     else
         f = filp_fopen(name, mode);
 
+    if (tmp != NULL)
+        free(tmp);
+
     if (f == NULL)
         filp_null_push();
     else {
@@ -673,6 +694,38 @@ static int _filpf_close(void)
 }
 
 
+static int _filp_getline(char **ptr, int *size, FILE *f)
+/* reads a line (with its newline) into a growable buffer;
+   returns its length, or -1 on EOF */
+{
+#ifdef CONFOPT_GETLINE
+    size_t n = *size;
+    ssize_t l;
+
+    /* getline() reads by blocks, not char by char */
+    l = getline(ptr, &n, f);
+    *size = n;
+
+    return l;
+#else
+    int c, l = 0;
+
+    while ((c = getc(f)) != EOF) {
+        *ptr = filp_poke(*ptr, size, l++, c);
+        if (c == '\n')
+            break;
+    }
+
+    if (l == 0)
+        return -1;
+
+    *ptr = filp_poke(*ptr, size, l, '\0');
+
+    return l;
+#endif
+}
+
+
 /**
  * read - Reads a line from a file.
  * @fdes: file descriptor
@@ -686,9 +739,8 @@ static int _filpf_read(void)
 {
     struct filp_val *v;
     char *ptr = NULL;
-    FILE *f;
-    int c, size, offset;
-    int ret;
+    int size = 0;
+    int l, ret;
 
     v = filp_pop();
 
@@ -699,21 +751,16 @@ static int _filpf_read(void)
         ret = FILP_ERROR;
     }
     else {
-        f = (FILE *) v->value;
-        size = offset = 0;
-
-        while ((c = getc(f)) != EOF) {
-            ptr = filp_poke(ptr, &size, offset++, c);
-            if (c == '\n')
-                break;
-        }
-
-        if (ptr == NULL && c == EOF)
+        if ((l = _filp_getline(&ptr, &size, (FILE *) v->value)) == -1) {
+            free(ptr);
             filp_null_push();
+        }
         else {
-            ptr = filp_poke(ptr, &size, offset, '\0');
-            filp_scalar_push(ptr);
-            free(ptr);
+            /* the line (that may contain nulls) is given to the value */
+            v = filp_new_value(FILP_SCALAR, NULL, 0);
+            v->value = ptr;
+            v->size = l + 1;
+            filp_push(v);
         }
 
         ret = FILP_OK;
@@ -723,6 +770,283 @@ static int _filpf_read(void)
 }
 
 
+/**
+ * scanlines - Scans all the lines of a file.
+ * @fdes: file descriptor
+ * @format_string: the format string
+ *
+ * Reads the file up to its end and scans each line (without
+ * its newline) with @format_string, as sscanf does. Returns
+ * an array with, for each line, an array of the extracted
+ * values, in the same order as in the format.
+ * [File and directory commands]
+ * [String manipulation commands]
+ */
+static int _filpf_scanlines(void)
+/** @fdes @format_string scanlines %array */
+{
+    struct filp_val *v;
+    struct filp_val *fmt;
+    struct filp_val *a;
+    struct filp_val *r;
+    char *ptr = NULL;
+    int size = 0;
+    int l, n;
+
+    fmt = filp_pop();
+    v = filp_pop();
+
+    ASSERT_ISOLATE();
+
+    if (v->type != FILP_FILE) {
+        _filp_error = FILPERR_FILE_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    a = filp_new_value(FILP_ARRAY, NULL, 0);
+
+    /* the line buffer is reused */
+    while ((l = _filp_getline(&ptr, &size, (FILE *) v->value)) != -1) {
+        if (l && ptr[l - 1] == '\n')
+            l--;
+        if (l && ptr[l - 1] == '\r')
+            l--;
+
+        ptr[l] = '\0';
+
+        if ((n = filp_sscanf(fmt, ptr, l)) == -1) {
+            free(ptr);
+            _filp_error = FILPERR_OUT_OF_MEMORY;
+            return FILP_ERROR;
+        }
+
+        /* the first field is on top */
+        r = filp_new_value(FILP_ARRAY, NULL, n);
+
+        for (l = 1; l <= n; l++)
+            filp_array_set(r, filp_pop(), l);
+
+        filp_array_ins(a, r, 0);
+    }
+
+    free(ptr);
+
+    filp_push(a);
+
+    return FILP_OK;
+}
+
+
+static struct filp_val *_filp_csv_field(char **ptr, char *e, char sep)
+/* takes a (maybe quoted) field from a record */
+{
+    struct filp_val *v;
+    char *p = *ptr;
+    char *q;
+    int n;
+
+    if (p == e || *p != '"') {
+        /* plain field: up to the separator */
+        n = filp_memcspn(p, e - p, &sep, 1);
+        *ptr = p + n;
+
+        return filp_new_scalar_len(p, n);
+    }
+
+    /* quoted field: doubled quotes are quotes */
+    v = filp_new_builder();
+
+    for (p++; p < e;) {
+        if ((q = memchr(p, '"', e - p)) == NULL) {
+            filp_builder_append(v, p, e - p);
+            p = e;
+            break;
+        }
+
+        filp_builder_append(v, p, q - p);
+        p = q + 1;
+
+        if (p < e && *p == '"')
+            filp_builder_append(v, p++, 1);
+        else
+            break;
+    }
+
+    /* anything up to the separator is also taken */
+    n = filp_memcspn(p, e - p, &sep, 1);
+    filp_builder_append(v, p, n);
+    *ptr = p + n;
+
+    v->type = FILP_SCALAR;
+
+    return v;
+}
+
+
+/**
+ * csvread - Reads a record from a CSV file.
+ * @fdes: file descriptor
+ * @separator: the field separator
+ *
+ * Reads a record from a file of separated values (CSV, or TSV
+ * if @separator is a tab) and returns it as an array of fields.
+ * Fields can be enclosed in double quotes, and then contain
+ * separators, newlines or doubled quotes. Empty fields are kept,
+ * and an empty line is an empty array. Returns NULL on EOF.
+ * [File and directory commands]
+ */
+static int _filpf_csvread(void)
+/** @fdes @separator csvread %record */
+{
+    struct filp_val *sv;
+    struct filp_val *fv;
+    struct filp_val *a;
+    char *rec = NULL;
+    char *line = NULL;
+    char *p, *e;
+    int rsize = 0, lsize = 0;
+    int l, n, q;
+    char sep;
+
+    sv = filp_pop();
+    fv = filp_pop();
+
+    ASSERT_ISOLATE();
+
+    if (fv->type != FILP_FILE) {
+        _filp_error = FILPERR_FILE_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    sep = *sv->value ? *sv->value : ',';
+
+    /* read lines until the quotes are balanced */
+    for (l = q = 0; (n = _filp_getline(&line, &lsize, (FILE *) fv->value)) != -1;) {
+        rec = filp_append(rec, &rsize, &l, line, n);
+
+        for (p = line, e = line + n; (p = memchr(p, '"', e - p)) != NULL; p++)
+            q++;
+
+        if ((q & 1) == 0)
+            break;
+    }
+
+    free(line);
+
+    if (rec == NULL) {
+        filp_null_push();
+        return FILP_OK;
+    }
+
+    /* strip the newline */
+    if (l && rec[l - 1] == '\n')
+        l--;
+    if (l && rec[l - 1] == '\r')
+        l--;
+
+    a = filp_new_value(FILP_ARRAY, NULL, 0);
+
+    for (p = rec, e = rec + l; l;) {
+        filp_array_ins(a, _filp_csv_field(&p, e, sep), 0);
+
+        if (p == e)
+            break;
+
+        /* skip the separator */
+        p++;
+    }
+
+    free(rec);
+
+    filp_push(a);
+
+    return FILP_OK;
+}
+
+
+/**
+ * csvwrite - Writes a record to a CSV file.
+ * @record: array of fields
+ * @fdes: file descriptor
+ * @separator: the field separator
+ *
+ * Writes the fields of @record as a line of separated values,
+ * in the format read by csvread. Fields containing separators,
+ * quotes or newlines are enclosed in double quotes. The line
+ * is built in memory and written at once.
+ * [File and directory commands]
+ */
+static int _filpf_csvwrite(void)
+/** @record @fdes @separator csvwrite */
+{
+    struct filp_val *sv;
+    struct filp_val *fv;
+    struct filp_val *a;
+    struct filp_val *v;
+    char *buf = NULL;
+    char set[4];
+    char *p, *e, *q;
+    int size = 0, l = 0;
+    int n, i;
+
+    sv = filp_pop();
+    fv = filp_pop();
+    a = filp_pop();
+
+    ASSERT_ISOLATE();
+
+    if (fv->type != FILP_FILE) {
+        _filp_error = FILPERR_FILE_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    if (a->type != FILP_ARRAY) {
+        _filp_error = FILPERR_ARRAY_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    set[0] = *sv->value ? *sv->value : ',';
+    set[1] = '"';
+    set[2] = '\n';
+    set[3] = '\r';
+
+    for (i = 1, n = filp_array_size(a); i <= n; i++) {
+        v = filp_array_get(a, i);
+
+        if (i > 1)
+            buf = filp_append(buf, &size, &l, set, 1);
+
+        if (v == NULL)
+            continue;
+
+        p = v->value;
+        e = p + filp_val_len(v);
+
+        if (filp_memcspn(p, e - p, set, 4) == e - p)
+            buf = filp_append(buf, &size, &l, p, e - p);
+        else {
+            /* quote it, doubling the quotes */
+            buf = filp_append(buf, &size, &l, "\"", 1);
+
+            for (; (q = memchr(p, '"', e - p)) != NULL; p = q + 1) {
+                buf = filp_append(buf, &size, &l, p, q - p + 1);
+                buf = filp_append(buf, &size, &l, "\"", 1);
+            }
+
+            buf = filp_append(buf, &size, &l, p, e - p);
+            buf = filp_append(buf, &size, &l, "\"", 1);
+        }
+    }
+
+    buf = filp_append(buf, &size, &l, "\n", 1);
+
+    fwrite(buf, 1, l, (FILE *) fv->value);
+    free(buf);
+
+    return FILP_OK;
+}
+
+
 /**
  * write - Writes a string to a file.
  * @string: string to be written to the file
@@ -750,7 +1074,7 @@ static int _filpf_write(void)
     }
     else {
         f = (FILE *) fv->value;
-        fprintf(f, "%s", lv->value);
+        fwrite(lv->value, 1, filp_val_len(lv), f);
         ret = FILP_OK;
     }
 
@@ -795,7 +1119,11 @@ static int _filpf_bread(void)
         ptr[size] = '\0';
 
         if (size) {
-            v = filp_new_value(FILP_SCALAR, ptr, size);
+            /* the block is given to the value, with its size,
+               so it can contain null bytes */
+            v = filp_new_value(FILP_SCALAR, NULL, 0);
+            v->value = ptr;
+            v->size = size + 1;
 
             filp_int_push(size);
             filp_push(v);
@@ -966,6 +1294,9 @@ void filp_slib_startup(void)
     filp_bin_code("open", _filpf_open);
     filp_bin_code("close", _filpf_close);
     filp_bin_code("read", _filpf_read);
+    filp_bin_code("scanlines", _filpf_scanlines);
+    filp_bin_code("csvread", _filpf_csvread);
+    filp_bin_code("csvwrite", _filpf_csvwrite);
     filp_bin_code("write", _filpf_write);
     filp_bin_code("bread", _filpf_bread);
     filp_bin_code("bwrite", _filpf_bwrite);
@@ -1076,6 +1407,15 @@ void filp_slib_startup(void)
 #ifdef CONFOPT_GLOB_H
     filp_scalar_push("CONFOPT_GLOB_H");
 #endif
+#ifdef CONFOPT_PTHREADS
+    filp_scalar_push("CONFOPT_PTHREADS");
+#endif
+#ifdef CONFOPT_UCONTEXT
+    filp_scalar_push("CONFOPT_UCONTEXT");
+#endif
+#ifdef CONFOPT_X86_SIMD
+    filp_scalar_push("CONFOPT_X86_SIMD");
+#endif
 #ifdef FILP_SHARED
     filp_scalar_push("FILP_SHARED");
 #endif
@@ -1101,6 +1441,7 @@ void filp_slib_startup(void)
     {
         short s;
         char *ptr;
+        struct filp_sym *sym;
 
         s = GetSystemDefaultLangID() & 0x00ff;
 
@@ -1179,7 +1520,9 @@ void filp_slib_startup(void)
             break;
         }
 
-        filp_execf("$filp_lang { /filp_lang '%s' = } unless", ptr);
+        if ((sym = filp_find_symbol("filp_lang")) == NULL ||
+            !filp_is_true(filp_get_symbol(sym)))
+            filp_bind_string("filp_lang", ptr);
     }
 #else
     /* if no language definition, default to english */
@@ -0,0 +1,2057 @@
+/*
+
+    filp - Embeddable, Reverse Polish Notation Programming Language
+
+    Angel Ortega <angel@triptico.com>
+
+    This software is released into the public domain.
+    NO WARRANTY. See file LICENSE for details.
+
+    Filp function library.
+    Level III (threads and coroutines).
+
+    A pool of worker threads, each one running its own interpreter,
+    and the commands that distribute work among them. Values never
+    cross between interpreters; they are always copied using
+    filp_marshal() and filp_unmarshal(). If threads are not
+    available, all commands here run serially.
+
+    Also generators, coroutines running inside an interpreter
+    with their own C and value stacks.
+
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef CONFOPT_PTHREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef CONFOPT_UCONTEXT
+#include <ucontext.h>
+#endif
+
+#include "filp.h"
+
+/* without thread-local storage, all interpreters would share
+   their state, so everything here runs serially */
+#ifdef FILP_NO_TLS
+#undef CONFOPT_PTHREADS
+#endif
+
+
+/*******************
+    Data
+********************/
+
+/**
+ * _filp_threads - Number of worker threads.
+ *
+ * The number of worker threads used by the parallel commands.
+ * If it's 0 when filp starts, it's set to the number of
+ * available processors. It has no effect if the compiler has
+ * no thread-local storage.
+ */
+int _filp_threads = 0;
+
+/**
+ * _filp_chunk_size - Number of elements per parallel job.
+ *
+ * The number of array elements each worker takes at once
+ * in parallel commands. If it's 0, it's calculated from the
+ * size of the array and the number of worker threads.
+ */
+int _filp_chunk_size = 0;
+
+/* index of this interpreter's worker, or -1 if it's not a worker */
+static FILP_TLS int _filp_worker_id = -1;
+
+
+#ifdef CONFOPT_PTHREADS
+
+#define FILP_MAX_WORKERS 64
+
+struct filp_job {
+    void (*func) (void *);      /* function to run */
+    void *arg;                  /* its argument */
+    struct filp_job *prev;      /* older job */
+    struct filp_job *next;      /* newer job */
+};
+
+struct filp_deque {
+    pthread_mutex_t mutex;
+    struct filp_job *top;       /* oldest job (stolen from here) */
+    struct filp_job *bottom;    /* newest job (owner takes from here) */
+};
+
+static struct filp_deque _filp_deques[FILP_MAX_WORKERS];
+static pthread_mutex_t _filp_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _filp_pool_cond = PTHREAD_COND_INITIALIZER;
+static int _filp_workers = 0;
+static int _filp_pending = 0;
+static int _filp_next_deque = 0;
+
+#endif              /* CONFOPT_PTHREADS */
+
+
+/*******************
+    Code
+********************/
+
+#ifdef CONFOPT_PTHREADS
+
+static struct filp_job *_filp_deque_take(struct filp_deque *d, int steal)
+/* takes a job from the bottom of a deque, or from the top if stealing */
+{
+    struct filp_job *j;
+
+    pthread_mutex_lock(&d->mutex);
+
+    if ((j = steal ? d->top : d->bottom) != NULL) {
+        if (j->prev != NULL)
+            j->prev->next = j->next;
+        else
+            d->top = j->next;
+
+        if (j->next != NULL)
+            j->next->prev = j->prev;
+        else
+            d->bottom = j->prev;
+    }
+
+    pthread_mutex_unlock(&d->mutex);
+
+    return j;
+}
+
+
+static struct filp_job *_filp_take_job(int id)
+/* takes a job for worker id: its own newest one, or the oldest of other */
+{
+    struct filp_job *j;
+    int n, w;
+
+    pthread_mutex_lock(&_filp_pool_mutex);
+    w = _filp_workers;
+    pthread_mutex_unlock(&_filp_pool_mutex);
+
+    j = _filp_deque_take(&_filp_deques[id], 0);
+
+    for (n = 1; j == NULL && n < w; n++)
+        j = _filp_deque_take(&_filp_deques[(id + n) % w], 1);
+
+    if (j != NULL) {
+        pthread_mutex_lock(&_filp_pool_mutex);
+        _filp_pending--;
+        pthread_mutex_unlock(&_filp_pool_mutex);
+    }
+
+    return j;
+}
+
+
+static void *_filp_worker(void *arg)
+{
+    struct filp_job *j;
+
+    /* each worker has its own interpreter */
+    filp_startup();
+    _filp_worker_id = (struct filp_deque *) arg - _filp_deques;
+
+    for (;;) {
+        if ((j = _filp_take_job(_filp_worker_id)) == NULL) {
+            /* nothing to do: wait for new jobs */
+            pthread_mutex_lock(&_filp_pool_mutex);
+
+            while (_filp_pending <= 0)
+                pthread_cond_wait(&_filp_pool_cond, &_filp_pool_mutex);
+
+            pthread_mutex_unlock(&_filp_pool_mutex);
+
+            continue;
+        }
+
+        j->func(j->arg);
+        free(j);
+
+        /* drop anything the job left behind */
+        while (_filp_stack_elems)
+            filp_pop();
+
+        filp_sweeper(1);
+    }
+
+    return NULL;
+}
+
+#endif              /* CONFOPT_PTHREADS */
+
+
+/**
+ * filp_pool_start - Starts the pool of worker threads.
+ * @num: number of worker threads wanted
+ *
+ * Ensures there are at least @num worker threads running, each
+ * one with its own interpreter and its own queue of jobs. Workers
+ * are never stopped. Returns the number of running workers, that
+ * will be 0 if filp was built without thread support or the
+ * compiler has no thread-local storage.
+ */
+int filp_pool_start(int num)
+{
+#ifdef CONFOPT_PTHREADS
+    struct filp_deque *d;
+    pthread_t t;
+
+    if (num > FILP_MAX_WORKERS)
+        num = FILP_MAX_WORKERS;
+
+    pthread_mutex_lock(&_filp_pool_mutex);
+
+    while (_filp_workers < num) {
+        d = &_filp_deques[_filp_workers];
+
+        pthread_mutex_init(&d->mutex, NULL);
+        d->top = d->bottom = NULL;
+
+        if (pthread_create(&t, NULL, _filp_worker, d) != 0)
+            break;
+
+        pthread_detach(t);
+        _filp_workers++;
+    }
+
+    num = _filp_workers;
+
+    pthread_mutex_unlock(&_filp_pool_mutex);
+
+    return num;
+#else
+    return 0;
+#endif
+}
+
+
+/**
+ * filp_pool_submit - Queues a job for the worker threads.
+ * @func: the function to be run
+ * @arg: its argument
+ *
+ * Queues @func to be called with @arg by a worker thread, so it
+ * runs inside that worker's interpreter. Jobs submitted from a
+ * worker go to its own queue, where they are taken newest first;
+ * idle workers steal the oldest jobs from the queues of the busy
+ * ones. Jobs from other threads are distributed among all queues.
+ * Returns 0 if the job could not be queued (no memory, no workers
+ * or no thread support).
+ */
+int filp_pool_submit(void (*func) (void *), void *arg)
+{
+#ifdef CONFOPT_PTHREADS
+    struct filp_deque *d;
+    struct filp_job *j;
+    int i;
+
+    pthread_mutex_lock(&_filp_pool_mutex);
+
+    if ((i = _filp_worker_id) == -1 && _filp_workers)
+        i = _filp_next_deque++ % _filp_workers;
+
+    pthread_mutex_unlock(&_filp_pool_mutex);
+
+    if (i == -1)
+        return 0;
+
+    if ((j = (struct filp_job *) malloc(sizeof(struct filp_job))) == NULL)
+        return 0;
+
+    j->func = func;
+    j->arg = arg;
+    j->next = NULL;
+
+    /* push into the bottom of the deque */
+    d = &_filp_deques[i];
+    pthread_mutex_lock(&d->mutex);
+
+    if ((j->prev = d->bottom) != NULL)
+        d->bottom->next = j;
+    else
+        d->top = j;
+
+    d->bottom = j;
+
+    pthread_mutex_unlock(&d->mutex);
+
+    pthread_mutex_lock(&_filp_pool_mutex);
+    _filp_pending++;
+    pthread_cond_signal(&_filp_pool_cond);
+    pthread_mutex_unlock(&_filp_pool_mutex);
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/**
+ * filp_pool_workers - Returns the number of usable worker threads.
+ *
+ * Starts the pool of worker threads, if needed, and returns how
+ * many of them can be used from the running interpreter. It's 0
+ * from inside a worker (as nested parallel work runs serially)
+ * or if filp was built without thread support.
+ */
+int filp_pool_workers(void)
+{
+    if (_filp_worker_id != -1)
+        return 0;
+
+    return filp_pool_start(_filp_threads);
+}
+
+
+#ifdef CONFOPT_PTHREADS
+
+struct _filp_prun {
+    void (*func) (void *, int); /* function to run */
+    void *arg;                  /* its argument */
+    int num;                    /* number of calls */
+    int next;                   /* next call to be done */
+    int running;                /* workers still running */
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+};
+
+
+static void _filp_prun_run(void *arg)
+{
+    struct _filp_prun *r = (struct _filp_prun *) arg;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&r->mutex);
+        i = r->next < r->num ? r->next++ : -1;
+        pthread_mutex_unlock(&r->mutex);
+
+        if (i == -1)
+            break;
+
+        r->func(r->arg, i);
+    }
+
+    pthread_mutex_lock(&r->mutex);
+
+    if (--r->running == 0)
+        pthread_cond_signal(&r->done);
+
+    pthread_mutex_unlock(&r->mutex);
+}
+
+#endif              /* CONFOPT_PTHREADS */
+
+
+/**
+ * filp_pool_run - Runs a C function in parallel.
+ * @func: the function
+ * @arg: its first argument
+ * @num: number of calls
+ *
+ * Calls @func(@arg, i) for each i from 0 to @num - 1, spreading
+ * the calls among the worker threads, and waits for all of them
+ * to finish. As the calls run outside the caller's interpreter,
+ * @func must only touch plain C data. Returns 0, having called
+ * nothing, if there are no worker threads to use (see
+ * filp_pool_workers()); the caller must then do the work itself.
+ */
+int filp_pool_run(void (*func) (void *, int), void *arg, int num)
+{
+#ifdef CONFOPT_PTHREADS
+    struct _filp_prun r;
+    int n, w;
+
+    if ((w = filp_pool_workers()) == 0)
+        return 0;
+
+    r.func = func;
+    r.arg = arg;
+    r.num = num;
+    r.next = 0;
+    r.running = 0;
+
+    pthread_mutex_init(&r.mutex, NULL);
+    pthread_cond_init(&r.done, NULL);
+
+    if (w > num)
+        w = num;
+
+    pthread_mutex_lock(&r.mutex);
+
+    for (n = 0; n < w; n++) {
+        if (filp_pool_submit(_filp_prun_run, &r))
+            r.running++;
+    }
+
+    if (r.running == 0) {
+        /* no job could be queued: do it here */
+        r.running = 1;
+        pthread_mutex_unlock(&r.mutex);
+        _filp_prun_run(&r);
+        pthread_mutex_lock(&r.mutex);
+    }
+
+    while (r.running)
+        pthread_cond_wait(&r.done, &r.mutex);
+
+    pthread_mutex_unlock(&r.mutex);
+
+    pthread_cond_destroy(&r.done);
+    pthread_mutex_destroy(&r.mutex);
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/**
+ * filp_dict_snapshot - Serializes the dictionary.
+ * @size: pointer to store the size of the snapshot
+ *
+ * Serializes (see filp_marshal()) the name and value of every
+ * symbol holding a scalar, code, an array, binary code, a file,
+ * a channel or a numeric vector.
+ * External variables are not included. The returned block must
+ * be freed with filp_marshal_free() when no longer needed.
+ */
+char *filp_dict_snapshot(int *size)
+{
+    struct filp_val *v;
+    struct filp_sym *s;
+    char *ptr = NULL;
+    int offset = 0;
+
+    *size = 0;
+    filp_push_dict("");
+
+    for (;;) {
+        v = filp_pop();
+        if (v->type == FILP_NULL)
+            break;
+
+        if ((s = filp_find_symbol(v->value)) == NULL || s->value == NULL)
+            continue;
+
+        if (s->type == FILP_SCALAR || s->type == FILP_CODE ||
+            s->type == FILP_ARRAY || s->type == FILP_BIN_CODE ||
+            s->type == FILP_FILE || s->type == FILP_CHANNEL ||
+            s->type == FILP_VECTOR || s->type == FILP_OMAP ||
+            s->type == FILP_BUILDER) {
+            ptr = filp_marshal(v, ptr, size, &offset);
+            ptr = filp_marshal(s->value, ptr, size, &offset);
+        }
+    }
+
+    *size = offset;
+
+    return ptr;
+}
+
+
+/**
+ * filp_dict_install - Installs a dictionary snapshot.
+ * @ptr: the snapshot
+ * @size: size of the snapshot
+ *
+ * Sets all symbols stored in a snapshot created by
+ * filp_dict_snapshot() (possibly from another interpreter).
+ * External variables of this interpreter are left untouched.
+ */
+void filp_dict_install(char *ptr, int size)
+{
+    struct filp_val *k;
+    struct filp_val *v;
+    struct filp_sym *s;
+    int offset = 0;
+
+    while (offset >= 0 && offset < size) {
+        k = filp_unmarshal(ptr, size, &offset);
+        v = filp_unmarshal(ptr, size, &offset);
+
+        if (offset == -1 || k == NULL || v == NULL)
+            break;
+
+        if ((s = filp_find_symbol(k->value)) == NULL)
+            s = filp_new_symbol(v->type, k->value);
+        else if (s->type == FILP_EXT_INT || s->type == FILP_EXT_REAL ||
+                 s->type == FILP_EXT_STRING)
+            continue;
+        else if (s->type == FILP_BIN_CODE && v->type == FILP_BIN_CODE &&
+                 s->value != NULL && s->value->value == v->value)
+            continue;
+
+        filp_set_symbol(s, v);
+    }
+}
+
+
+/* parallel forall / map */
+
+struct _filp_pjob {
+    char *dict;                 /* caller's dictionary snapshot */
+    int dict_size;
+    char *code;                 /* serialized code block */
+    int code_size;
+    char *elems;                /* serialized elements */
+    int elems_size;
+    int *offsets;               /* offset of each element in elems */
+    int num;                    /* number of elements */
+    int chunk;                  /* elements per chunk */
+    int chunks;                 /* number of chunks */
+    char **res;                 /* serialized results, per chunk */
+    int *res_size;
+    int reassign;               /* 1 if map, 0 if forall */
+    int real;                   /* caller's interpreter flags */
+    int bareword;
+    int isolate;
+    int stack_size;
+    int next;                   /* next chunk to be processed */
+    int running;                /* workers still running */
+    int error;                  /* first error found */
+    char error_info[80];
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+#endif
+};
+
+
+#ifdef CONFOPT_PTHREADS
+
+static void _filp_pjob_run(void *arg)
+{
+    struct _filp_pjob *j = (struct _filp_pjob *) arg;
+    struct filp_val *code;
+    struct filp_val *v;
+    int c, n, i, o, ret;
+    char *ptr;
+    int size, offset;
+
+    _filp_real = j->real;
+    _filp_bareword = j->bareword;
+    _filp_isolate = j->isolate;
+    _filp_stack_size = j->stack_size;
+    _filp_error = FILPERR_NONE;
+
+    filp_dict_install(j->dict, j->dict_size);
+
+    o = 0;
+    code = filp_unmarshal(j->code, j->code_size, &o);
+    filp_ref_value(code);
+
+    for (ret = FILP_OK; ret >= 0;) {
+        /* take the next chunk */
+        pthread_mutex_lock(&j->mutex);
+        c = (j->next < j->chunks && !j->error) ? j->next++ : -1;
+        pthread_mutex_unlock(&j->mutex);
+
+        if (c == -1)
+            break;
+
+        ptr = NULL;
+        size = offset = 0;
+
+        for (n = c * j->chunk; n < (c + 1) * j->chunk && n < j->num; n++) {
+            o = j->offsets[n];
+
+            if ((v = filp_unmarshal(j->elems, j->elems_size, &o)) == NULL) {
+                /* empty element: leave untouched */
+                if (j->reassign)
+                    ptr = filp_marshal(NULL, ptr, &size, &offset);
+                else
+                    ptr = filp_marshal(filp_new_int_value(0), ptr, &size, &offset);
+
+                continue;
+            }
+
+            filp_push(v);
+
+            if ((ret = filp_execv(code)) < 0)
+                break;
+
+            if (j->reassign) {
+                /* the value in the top of stack is the new element */
+                v = _filp_stack_elems ? filp_stack_value(1) : _filp_null_value;
+                ptr = filp_marshal(v, ptr, &size, &offset);
+            }
+            else {
+                /* the values left by the code, in stack order */
+                ptr = filp_marshal(filp_new_int_value(_filp_stack_elems),
+                           ptr, &size, &offset);
+
+                for (i = _filp_stack_elems; i > 0; i--)
+                    ptr = filp_marshal(filp_stack_value(i), ptr, &size, &offset);
+            }
+
+            while (_filp_stack_elems)
+                filp_pop();
+        }
+
+        j->res[c] = ptr;
+        j->res_size[c] = offset;
+
+        if (ret < 0) {
+            pthread_mutex_lock(&j->mutex);
+
+            if (!j->error) {
+                j->error = _filp_error ? _filp_error : FILPERR_INTERNAL_ERROR;
+                strncpy(j->error_info, _filp_error_info, sizeof(j->error_info));
+            }
+
+            pthread_mutex_unlock(&j->mutex);
+        }
+    }
+
+    filp_unref_value(code);
+
+    pthread_mutex_lock(&j->mutex);
+
+    if (--j->running == 0)
+        pthread_cond_signal(&j->done);
+
+    pthread_mutex_unlock(&j->mutex);
+}
+
+#endif              /* CONFOPT_PTHREADS */
+
+
+static int _filp_forall_map_serial(struct filp_val *a, struct filp_val *c,
+                   int reassign, int imm)
+{
+    struct filp_val *v;
+    int n, ret = FILP_OK;
+
+    filp_ref_value(c);
+    filp_ref_value(a);
+
+    for (n = 1; n <= filp_array_size(a) && ret >= 0; n++) {
+        if ((v = filp_array_get(a, n)) != NULL) {
+            filp_push(v);
+
+            if ((ret = filp_execv(c)) >= 0 && reassign)
+                filp_array_set(a, filp_pop(), n);
+        }
+    }
+
+    filp_unref_value(a);
+    filp_unref_value(c);
+
+    if (ret < 0)
+        return FILP_ERROR;
+
+    if (reassign && imm)
+        filp_push(a);
+
+    return FILP_OK;
+}
+
+
+static int _filp_forall_map_parallel(int reassign)
+{
+    struct filp_val *a;
+    struct filp_val *c;
+    struct filp_sym *s;
+    int imm, w;
+
+    /* numeric vectors are processed serially */
+    a = filp_stack_value(2);
+
+    if (a->type == FILP_VECTOR || (a->type == FILP_SCALAR &&
+        (s = filp_find_symbol(a->value)) != NULL && s->type == FILP_VECTOR))
+        return filp_callv(reassign ? "map" : "forall", NULL);
+
+    c = filp_pop();
+    if ((a = filp_array_pop(&imm, 0)) == NULL)
+        return FILP_ERROR;
+
+    /* nested parallel commands run serially inside the worker */
+    w = filp_pool_workers();
+
+    if (w < 2 || filp_array_size(a) < 2)
+        return _filp_forall_map_serial(a, c, reassign, imm);
+
+#ifdef CONFOPT_PTHREADS
+    {
+        struct _filp_pjob j;
+        struct filp_val *v;
+        int n, m, i, o, k, ret;
+
+        memset(&j, '\0', sizeof(j));
+
+        filp_ref_value(a);
+
+        j.num = filp_array_size(a);
+        j.reassign = reassign;
+        j.real = _filp_real;
+        j.bareword = _filp_bareword;
+        j.isolate = _filp_isolate;
+        j.stack_size = _filp_stack_size;
+
+        if ((j.chunk = _filp_chunk_size) <= 0)
+            j.chunk = j.num / (w * 4);
+        if (j.chunk <= 0)
+            j.chunk = 1;
+
+        j.chunks = (j.num + j.chunk - 1) / j.chunk;
+
+        j.offsets = (int *) malloc(j.num * sizeof(int));
+        j.res = (char **) calloc(j.chunks, sizeof(char *));
+        j.res_size = (int *) calloc(j.chunks, sizeof(int));
+
+        pthread_mutex_init(&j.mutex, NULL);
+        pthread_cond_init(&j.done, NULL);
+
+        if (j.offsets != NULL && j.res != NULL && j.res_size != NULL) {
+            /* serialize everything the workers need */
+            j.dict = filp_dict_snapshot(&j.dict_size);
+
+            n = 0;
+            j.code = filp_marshal(c, NULL, &n, &j.code_size);
+
+            for (n = m = 0; n < j.num; n++) {
+                j.offsets[n] = j.elems_size;
+                j.elems = filp_marshal(filp_array_get(a, n + 1), j.elems, &m, &j.elems_size);
+            }
+
+            if (w > j.chunks)
+                w = j.chunks;
+
+            pthread_mutex_lock(&j.mutex);
+
+            for (n = 0; n < w; n++) {
+                if (filp_pool_submit(_filp_pjob_run, &j))
+                    j.running++;
+            }
+
+            /* if none was queued, nothing was done */
+            if (j.running == 0)
+                j.chunks = 0;
+
+            while (j.running)
+                pthread_cond_wait(&j.done, &j.mutex);
+
+            pthread_mutex_unlock(&j.mutex);
+        }
+        else
+            j.chunks = 0;
+
+        /* gather the results, in order */
+        for (n = m = 0; n < j.chunks && !j.error; n++) {
+            for (o = 0; o >= 0 && o < j.res_size[n]; m++) {
+                if (reassign) {
+                    v = filp_unmarshal(j.res[n], j.res_size[n], &o);
+
+                    if (v != NULL)
+                        filp_array_set(a, v, m + 1);
+                }
+                else {
+                    k = filp_val_to_int(filp_unmarshal(j.res[n], j.res_size[n], &o));
+
+                    for (i = 0; i < k && o >= 0; i++)
+                        filp_push(filp_unmarshal(j.res[n], j.res_size[n], &o));
+                }
+            }
+        }
+
+        for (n = 0; n < j.chunks; n++)
+            filp_marshal_free(j.res[n], j.res_size[n]);
+
+        free(j.res);
+        free(j.res_size);
+        free(j.offsets);
+        filp_marshal_free(j.elems, j.elems_size);
+        filp_marshal_free(j.code, j.code_size);
+        filp_marshal_free(j.dict, j.dict_size);
+
+        pthread_cond_destroy(&j.done);
+        pthread_mutex_destroy(&j.mutex);
+
+        if (j.chunks == 0) {
+            /* no job could be queued (or out of memory): do it here */
+            ret = _filp_forall_map_serial(a, c, reassign, imm);
+            filp_unref_value(a);
+
+            return ret;
+        }
+
+        filp_unref_value(a);
+
+        if (j.error) {
+            _filp_error = j.error;
+            strncpy(_filp_error_info, j.error_info, sizeof(_filp_error_info));
+            return FILP_ERROR;
+        }
+
+        if (reassign && imm)
+            filp_push(a);
+    }
+#endif              /* CONFOPT_PTHREADS */
+
+    return FILP_OK;
+}
+
+
+/**
+ * pforall - Executes a block of code for all elements of an array, in parallel
+ * @array: the array
+ * @code: the code to be executed
+ *
+ * Like forall, but the elements are distributed in chunks among the
+ * worker threads. Each worker is an independent interpreter holding
+ * a snapshot of the caller's symbols, so the block can use any variable
+ * or command defined so far, but changes made to them will not be seen
+ * by the caller. All values left on the stack by each execution of the
+ * block are copied back to the caller's stack, in the same order as
+ * forall would do. The number of threads and the size of the chunks
+ * are taken from filp_threads and filp_chunk_size. Numeric vectors
+ * are processed serially, as forall does.
+ * [Control structures]
+ * [Array commands]
+ */
+static int _filpf_pforall(void)
+/** @array { @code } pforall */
+{
+    return _filp_forall_map_parallel(0);
+}
+
+
+/**
+ * pmap - Executes a block of code for all elements of an array, in parallel
+ * @array: the array or array symbol
+ * @code: the code to be executed
+ *
+ * Like map, but the elements are distributed in chunks among the
+ * worker threads, as in pforall. At the end of each execution of
+ * the block, the value in the top of stack will be assigned to the
+ * element. If @array is an immediate value (i.e. not a symbol), the
+ * modified array is left on the stack.
+ * [Control structures]
+ * [Array commands]
+ */
+static int _filpf_pmap(void)
+/** @array_symbol { @code } pmap */
+/** @array { @code } pmap %modified_array */
+{
+    return _filp_forall_map_parallel(1);
+}
+
+
+/* tasks */
+
+#define FILP_TASK_QUEUED    0
+#define FILP_TASK_RUNNING   1
+#define FILP_TASK_DONE      2
+
+struct filp_task {
+    char *dict;                 /* spawner's dictionary snapshot */
+    int dict_size;
+    char *code;                 /* serialized code block */
+    int code_size;
+    char *arg;                  /* serialized argument */
+    int arg_size;
+    char *res;                  /* serialized result */
+    int res_size;
+    int real;                   /* spawner's interpreter flags */
+    int bareword;
+    int isolate;
+    int stack_size;
+    int state;                  /* FILP_TASK_* */
+    int error;                  /* error, if the code failed */
+    char error_info[80];
+    int refs;                   /* references (value and queue) */
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+#endif
+};
+
+
+/**
+ * filp_task_unref - Releases a reference to a task.
+ * @task: the task
+ *
+ * Releases a reference to a task, destroying it when neither
+ * its value nor the worker running it need it anymore. It's
+ * called by the garbage collector when a FILP_TASK value
+ * is destroyed.
+ */
+void filp_task_unref(void *task)
+{
+    struct filp_task *t = (struct filp_task *) task;
+    int refs;
+
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_lock(&t->mutex);
+    refs = --t->refs;
+    pthread_mutex_unlock(&t->mutex);
+#else
+    refs = --t->refs;
+#endif
+
+    if (refs == 0) {
+        filp_marshal_free(t->dict, t->dict_size);
+        filp_marshal_free(t->code, t->code_size);
+        filp_marshal_free(t->arg, t->arg_size);
+        filp_marshal_free(t->res, t->res_size);
+
+#ifdef CONFOPT_PTHREADS
+        pthread_cond_destroy(&t->done);
+        pthread_mutex_destroy(&t->mutex);
+#endif
+
+        free(t);
+    }
+}
+
+
+static void _filp_task_exec(struct filp_task *t)
+/* runs a task in the current interpreter */
+{
+    struct filp_val *code;
+    struct filp_val *v;
+    int o, d, size = 0;
+
+    o = 0;
+    code = filp_unmarshal(t->code, t->code_size, &o);
+    filp_ref_value(code);
+
+    d = _filp_stack_elems;
+
+    o = 0;
+    if ((v = filp_unmarshal(t->arg, t->arg_size, &o)) != NULL)
+        filp_push(v);
+
+    if (filp_execv(code) == FILP_ERROR) {
+        t->error = _filp_error ? _filp_error : FILPERR_INTERNAL_ERROR;
+        strncpy(t->error_info, _filp_error_info, sizeof(t->error_info));
+
+        /* the error belongs to the task, not to this interpreter */
+        _filp_error = FILPERR_NONE;
+    }
+    else {
+        /* the value in the top of stack is the result */
+        v = _filp_stack_elems > d ? filp_stack_value(1) : _filp_null_value;
+        t->res = filp_marshal(v, NULL, &size, &t->res_size);
+    }
+
+    while (_filp_stack_elems > d)
+        filp_pop();
+
+    filp_unref_value(code);
+}
+
+
+static void _filp_task_setup(struct filp_task *t)
+/* makes the current interpreter look like the spawner's */
+{
+    _filp_real = t->real;
+    _filp_bareword = t->bareword;
+    _filp_isolate = t->isolate;
+    _filp_stack_size = t->stack_size;
+    _filp_error = FILPERR_NONE;
+
+    filp_dict_install(t->dict, t->dict_size);
+}
+
+
+#define _filp_sym_ext(s) ((s)->type == FILP_EXT_INT || \
+    (s)->type == FILP_EXT_REAL || (s)->type == FILP_EXT_STRING)
+
+static void _filp_task_inline(struct filp_task *t)
+/* runs a task here, as if it were in its own interpreter */
+{
+    struct filp_val *h;
+    struct filp_val *v;
+    struct filp_sym *s;
+    char *dict;
+    int dict_size, n;
+    int real = _filp_real;
+    int bareword = _filp_bareword;
+    int isolate = _filp_isolate;
+    int stack_size = _filp_stack_size;
+
+    /* the snapshot keeps copies of the values that can be changed
+       in place, and the hash the values of all existing symbols */
+    dict = filp_dict_snapshot(&dict_size);
+
+    n = filp_push_dict("");
+    h = filp_new_hash(n / 16 + 1);
+    filp_ref_value(h);
+
+    while ((v = filp_pop())->type != FILP_NULL) {
+        if ((s = filp_find_symbol(v->value)) != NULL && !_filp_sym_ext(s))
+            filp_hash_set(h, v->value, s->value ? s->value : _filp_null_value);
+    }
+
+    _filp_task_setup(t);
+    _filp_task_exec(t);
+
+    /* put them back; symbols created by the task are emptied */
+    filp_push_dict("");
+
+    while ((v = filp_pop())->type != FILP_NULL) {
+        if ((s = filp_find_symbol(v->value)) != NULL && !_filp_sym_ext(s)) {
+            if ((v = filp_hash_get(h, v->value)) == NULL)
+                v = _filp_null_value;
+
+            filp_set_symbol(s, v);
+        }
+    }
+
+    filp_dict_install(dict, dict_size);
+
+    filp_marshal_free(dict, dict_size);
+    filp_unref_value(h);
+
+    _filp_real = real;
+    _filp_bareword = bareword;
+    _filp_isolate = isolate;
+    _filp_stack_size = stack_size;
+}
+
+
+#ifdef CONFOPT_PTHREADS
+
+static void _filp_task_done(struct filp_task *t)
+{
+    pthread_mutex_lock(&t->mutex);
+    t->state = FILP_TASK_DONE;
+    pthread_cond_broadcast(&t->done);
+    pthread_mutex_unlock(&t->mutex);
+}
+
+
+static void _filp_task_run(void *arg)
+{
+    struct filp_task *t = (struct filp_task *) arg;
+    int run;
+
+    /* the task could have been already run by a joining worker */
+    pthread_mutex_lock(&t->mutex);
+
+    if ((run = (t->state == FILP_TASK_QUEUED)))
+        t->state = FILP_TASK_RUNNING;
+
+    pthread_mutex_unlock(&t->mutex);
+
+    if (run) {
+        _filp_task_setup(t);
+        _filp_task_exec(t);
+        _filp_task_done(t);
+    }
+
+    filp_task_unref(t);
+}
+
+#endif              /* CONFOPT_PTHREADS */
+
+
+/**
+ * spawn - Runs a block of code as an independent task.
+ * @value: the argument to the task
+ * @code: the code to be executed
+ *
+ * Runs @code in a worker thread, with @value in the top of its
+ * stack, and returns immediately a task value that can later be
+ * given to join to get the result. As in pmap, the task runs in
+ * a separate interpreter holding a snapshot of the caller's symbols
+ * and all values are copied between them. Tasks spawned from another
+ * task are queued to the same worker and stolen by idle ones. If
+ * filp was built without thread support, the task runs immediately.
+ * [Control structures]
+ * [Thread commands]
+ */
+static int _filpf_spawn(void)
+/** @value { @code } spawn %task */
+{
+    struct filp_task *t;
+    struct filp_val *c;
+    struct filp_val *a;
+    int n, queued = 0;
+
+    c = filp_pop();
+    a = filp_pop();
+
+    if ((t = (struct filp_task *) calloc(1, sizeof(struct filp_task))) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    t->refs = 1;
+    t->real = _filp_real;
+    t->bareword = _filp_bareword;
+    t->isolate = _filp_isolate;
+    t->stack_size = _filp_stack_size;
+
+    n = 0;
+    t->code = filp_marshal(c, NULL, &n, &t->code_size);
+    n = 0;
+    t->arg = filp_marshal(a, NULL, &n, &t->arg_size);
+
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_init(&t->mutex, NULL);
+    pthread_cond_init(&t->done, NULL);
+
+    if (filp_pool_start(_filp_threads) > 0) {
+        t->dict = filp_dict_snapshot(&t->dict_size);
+
+        /* the queue holds a reference */
+        t->refs++;
+
+        if ((queued = filp_pool_submit(_filp_task_run, t)) == 0)
+            t->refs--;
+    }
+#endif
+
+    if (!queued) {
+        t->state = FILP_TASK_RUNNING;
+        _filp_task_inline(t);
+        t->state = FILP_TASK_DONE;
+    }
+
+    filp_push(filp_new_value(FILP_TASK, t, 0));
+
+    return FILP_OK;
+}
+
+
+/**
+ * filp_task_join - Waits for a task to finish.
+ * @c: the task value
+ *
+ * Waits until the task finishes and pushes the value left in
+ * the top of its stack (NULL if it left none). If the task failed,
+ * its error is set. If a task that has not started yet is joined
+ * from inside another task, it's run immediately by the joining
+ * one instead of waiting, with the symbols of its spawner; the
+ * joining task gets its own symbols back afterwards.
+ * Returns FILP_OK or FILP_ERROR.
+ */
+int filp_task_join(struct filp_val *c)
+{
+    struct filp_task *t;
+    struct filp_val *v;
+    int o = 0, ret = FILP_OK;
+
+    /* keep the task alive while it's run here or waited for */
+    filp_ref_value(c);
+    t = (struct filp_task *) c->value;
+
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_lock(&t->mutex);
+
+    /* a blocking worker could starve the pool: run it here */
+    if (t->state == FILP_TASK_QUEUED && _filp_worker_id != -1) {
+        t->state = FILP_TASK_RUNNING;
+        pthread_mutex_unlock(&t->mutex);
+
+        _filp_task_inline(t);
+        _filp_task_done(t);
+
+        pthread_mutex_lock(&t->mutex);
+    }
+
+    while (t->state != FILP_TASK_DONE)
+        pthread_cond_wait(&t->done, &t->mutex);
+
+    pthread_mutex_unlock(&t->mutex);
+#endif
+
+    if (t->error) {
+        _filp_error = t->error;
+        strncpy(_filp_error_info, t->error_info, sizeof(_filp_error_info));
+        ret = FILP_ERROR;
+    }
+    else {
+        if (t->res == NULL ||
+            (v = filp_unmarshal(t->res, t->res_size, &o)) == NULL)
+            v = _filp_null_value;
+
+        filp_push(v);
+    }
+
+    filp_unref_value(c);
+
+    return ret;
+}
+
+
+/* channels */
+
+#ifdef CONFOPT_ATOMIC_BUILTINS
+
+#define _filp_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _filp_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define _filp_atomic_cas(p, o, n) \
+    __atomic_compare_exchange_n((p), (o), (n), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define _filp_atomic_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define _filp_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#else               /* CONFOPT_ATOMIC_BUILTINS */
+
+/* no atomic operations: emulate them with a lock */
+
+#ifdef CONFOPT_PTHREADS
+static pthread_mutex_t _filp_atomic_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define _filp_atomic_lock() pthread_mutex_lock(&_filp_atomic_mutex)
+#define _filp_atomic_unlock() pthread_mutex_unlock(&_filp_atomic_mutex)
+#else
+#define _filp_atomic_lock()
+#define _filp_atomic_unlock()
+#endif
+
+static unsigned long _filp_atomic_load(unsigned long *p)
+{
+    unsigned long v;
+
+    _filp_atomic_lock();
+    v = *p;
+    _filp_atomic_unlock();
+
+    return v;
+}
+
+static void _filp_atomic_store(unsigned long *p, unsigned long v)
+{
+    _filp_atomic_lock();
+    *p = v;
+    _filp_atomic_unlock();
+}
+
+static int _filp_atomic_cas(unsigned long *p, unsigned long *o, unsigned long n)
+{
+    int ret;
+
+    _filp_atomic_lock();
+
+    if ((ret = (*p == *o)))
+        *p = n;
+    else
+        *o = *p;
+
+    _filp_atomic_unlock();
+
+    return ret;
+}
+
+static unsigned long _filp_atomic_add(unsigned long *p, unsigned long v)
+{
+    _filp_atomic_lock();
+    v = (*p += v);
+    _filp_atomic_unlock();
+
+    return v;
+}
+
+static void _filp_atomic_fence(void)
+{
+    _filp_atomic_lock();
+    _filp_atomic_unlock();
+}
+
+#endif              /* CONFOPT_ATOMIC_BUILTINS */
+
+struct filp_channel_cell {
+    unsigned long seq;          /* sequence number */
+    char *data;                 /* serialized value */
+    int size;
+};
+
+struct filp_channel {
+    unsigned long refs;         /* references */
+    unsigned long mask;         /* capacity - 1 */
+    struct filp_channel_cell *cells;
+    char pad1[64];              /* keep positions in separate cache lines */
+    unsigned long enqueue_pos;
+    char pad2[64];
+    unsigned long dequeue_pos;
+    char pad3[64];
+    unsigned long waiters;      /* threads parked waiting for it */
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_t mutex;      /* to park and wake them */
+    pthread_cond_t cond;
+#endif
+};
+
+
+/**
+ * filp_channel_new - Creates a new channel.
+ * @capacity: maximum number of queued values
+ *
+ * Creates a bounded channel, that can be shared among
+ * interpreters running in different threads to send
+ * values (see filp_channel_send() and filp_channel_recv()).
+ * The capacity is rounded up to a power of 2. The channel
+ * is returned with a reference count of 1, and is destroyed
+ * when the count drops to 0 (see filp_channel_unref()).
+ */
+void *filp_channel_new(int capacity)
+{
+    struct filp_channel *c;
+    unsigned long n, i;
+
+    for (n = 2; n < (unsigned long) capacity; n <<= 1);
+
+    if ((c = (struct filp_channel *) calloc(1, sizeof(struct filp_channel))) == NULL)
+        return NULL;
+
+    if ((c->cells = (struct filp_channel_cell *)
+         calloc(n, sizeof(struct filp_channel_cell))) == NULL) {
+        free(c);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++)
+        c->cells[i].seq = i;
+
+    c->mask = n - 1;
+    c->refs = 1;
+
+#ifdef CONFOPT_PTHREADS
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->cond, NULL);
+#endif
+
+    return c;
+}
+
+
+/**
+ * filp_channel_ref - Adds a reference to a channel.
+ * @channel: the channel
+ *
+ * Adds a reference to a channel. Can be called from any thread.
+ */
+void filp_channel_ref(void *channel)
+{
+    struct filp_channel *c = (struct filp_channel *) channel;
+
+    _filp_atomic_add(&c->refs, 1);
+}
+
+
+/**
+ * filp_channel_unref - Releases a reference to a channel.
+ * @channel: the channel
+ *
+ * Releases a reference to a channel, destroying it (and all
+ * values still queued) when no one references it anymore.
+ * Can be called from any thread.
+ */
+void filp_channel_unref(void *channel)
+{
+    struct filp_channel *c = (struct filp_channel *) channel;
+    unsigned long n;
+
+    if (_filp_atomic_add(&c->refs, (unsigned long) -1) == 0) {
+        for (n = 0; n <= c->mask; n++)
+            filp_marshal_free(c->cells[n].data, c->cells[n].size);
+
+#ifdef CONFOPT_PTHREADS
+        pthread_cond_destroy(&c->cond);
+        pthread_mutex_destroy(&c->mutex);
+#endif
+
+        free(c->cells);
+        free(c);
+    }
+}
+
+
+static void _filp_channel_wake(struct filp_channel *c)
+/* wakes up the threads parked waiting for the channel, if any */
+{
+#ifdef CONFOPT_PTHREADS
+    /* pairs with the one in _filp_channel_wait() */
+    _filp_atomic_fence();
+
+    if (_filp_atomic_load(&c->waiters)) {
+        pthread_mutex_lock(&c->mutex);
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->mutex);
+    }
+#endif
+}
+
+
+/**
+ * filp_channel_send - Sends serialized data through a channel.
+ * @channel: the channel
+ * @data: the data (serialized by filp_marshal())
+ * @size: size of the data
+ *
+ * Queues @data into the channel, that takes ownership of it.
+ * It never blocks; if the channel is full, returns 0 and
+ * the data is left untouched. Returns 1 otherwise, waking up
+ * the threads waiting to receive, if any.
+ */
+int filp_channel_send(void *channel, char *data, int size)
+{
+    struct filp_channel *c = (struct filp_channel *) channel;
+    struct filp_channel_cell *cell;
+    unsigned long pos, seq;
+    long dif;
+
+    pos = _filp_atomic_load(&c->enqueue_pos);
+
+    for (;;) {
+        cell = &c->cells[pos & c->mask];
+        seq = _filp_atomic_load(&cell->seq);
+        dif = (long) seq - (long) pos;
+
+        if (dif == 0) {
+            /* cell is free: try to claim it */
+            if (_filp_atomic_cas(&c->enqueue_pos, &pos, pos + 1))
+                break;
+        }
+        else if (dif < 0)
+            return 0;
+        else
+            pos = _filp_atomic_load(&c->enqueue_pos);
+    }
+
+    cell->data = data;
+    cell->size = size;
+    _filp_atomic_store(&cell->seq, pos + 1);
+
+    _filp_channel_wake(c);
+
+    return 1;
+}
+
+
+/**
+ * filp_channel_recv - Receives serialized data from a channel.
+ * @channel: the channel
+ * @size: pointer to store the size of the data
+ *
+ * Takes the oldest data queued into the channel. It never
+ * blocks; if the channel is empty, returns NULL. Otherwise,
+ * the threads waiting to send, if any, are woken up. The caller
+ * owns the data, that must be freed with filp_marshal_free().
+ */
+char *filp_channel_recv(void *channel, int *size)
+{
+    struct filp_channel *c = (struct filp_channel *) channel;
+    struct filp_channel_cell *cell;
+    unsigned long pos, seq;
+    char *data;
+    long dif;
+
+    pos = _filp_atomic_load(&c->dequeue_pos);
+
+    for (;;) {
+        cell = &c->cells[pos & c->mask];
+        seq = _filp_atomic_load(&cell->seq);
+        dif = (long) seq - (long) (pos + 1);
+
+        if (dif == 0) {
+            /* cell is full: try to claim it */
+            if (_filp_atomic_cas(&c->dequeue_pos, &pos, pos + 1))
+                break;
+        }
+        else if (dif < 0)
+            return NULL;
+        else
+            pos = _filp_atomic_load(&c->dequeue_pos);
+    }
+
+    data = cell->data;
+    *size = cell->size;
+    cell->data = NULL;
+    _filp_atomic_store(&cell->seq, pos + c->mask + 1);
+
+    _filp_channel_wake(c);
+
+    return data;
+}
+
+
+#ifdef CONFOPT_PTHREADS
+
+static int _filp_channel_ready(struct filp_channel *c, int send)
+/* tests if sending or receiving could be retried */
+{
+    unsigned long pos;
+
+    if (send) {
+        pos = _filp_atomic_load(&c->enqueue_pos);
+        return (long) _filp_atomic_load(&c->cells[pos & c->mask].seq) - (long) pos >= 0;
+    }
+
+    pos = _filp_atomic_load(&c->dequeue_pos);
+    return (long) _filp_atomic_load(&c->cells[pos & c->mask].seq) - (long) (pos + 1) >= 0;
+}
+
+#endif              /* CONFOPT_PTHREADS */
+
+
+static void _filp_channel_wait(struct filp_channel *c, int send, int *spins)
+/* backs off while waiting for a channel: spins, yields and parks */
+{
+#ifdef CONFOPT_PTHREADS
+    if (++(*spins) <= 100)
+        return;
+
+    if (*spins <= 200) {
+        sched_yield();
+        return;
+    }
+
+    /* tell the other side, and check again before sleeping,
+       so its wake up can't be missed */
+    _filp_atomic_add(&c->waiters, 1);
+    _filp_atomic_fence();
+
+    pthread_mutex_lock(&c->mutex);
+
+    if (!_filp_channel_ready(c, send))
+        pthread_cond_wait(&c->cond, &c->mutex);
+
+    pthread_mutex_unlock(&c->mutex);
+
+    _filp_atomic_add(&c->waiters, (unsigned long) -1);
+#endif
+}
+
+
+static struct filp_channel *_filp_channel_pop(void)
+{
+    struct filp_val *v;
+
+    v = filp_pop();
+
+    if (v->type != FILP_CHANNEL) {
+        _filp_error = FILPERR_CHANNEL_EXPECTED;
+        return NULL;
+    }
+
+    return (struct filp_channel *) v->value;
+}
+
+
+/**
+ * chan - Creates a channel.
+ * @capacity: maximum number of queued values
+ *
+ * Creates a channel, a bounded queue to send values between
+ * tasks (see spawn) or parallel commands. Channels can be
+ * stored in variables or given as arguments, and are shared
+ * (never copied) among all interpreters that use them. The
+ * values sent are copied, so arrays and hashes can be freely
+ * modified after sending them. Sending and receiving do not
+ * take any lock; a task that has to wait for a channel sleeps
+ * after a while, until the other side sends or receives.
+ * The capacity is rounded up to a power of 2.
+ * [Thread commands]
+ */
+static int _filpf_chan(void)
+/** @capacity chan %channel */
+{
+    void *c;
+
+    if ((c = filp_channel_new(filp_int_pop())) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    filp_push(filp_new_value(FILP_CHANNEL, c, 0));
+
+    return FILP_OK;
+}
+
+
+/**
+ * send - Sends a value through a channel.
+ * @channel: the channel
+ * @value: the value
+ *
+ * Sends a copy of @value through the channel. If the channel
+ * is full, waits until there is room in it; if filp was built
+ * without thread support, a full channel is an error instead.
+ * [Thread commands]
+ */
+static int _filpf_send(void)
+/** @channel @value send */
+{
+    struct filp_channel *c;
+    struct filp_val *v;
+    char *ptr;
+    int size = 0, offset = 0, spins = 0;
+
+    v = filp_pop();
+
+    if ((c = _filp_channel_pop()) == NULL)
+        return FILP_ERROR;
+
+    ptr = filp_marshal(v, NULL, &size, &offset);
+
+    while (!filp_channel_send(c, ptr, offset)) {
+#ifndef CONFOPT_PTHREADS
+        filp_marshal_free(ptr, offset);
+        strcpy(_filp_error_info, "channel full");
+        _filp_error = FILPERR_INTERNAL_ERROR;
+        return FILP_ERROR;
+#endif
+        _filp_channel_wait(c, 1, &spins);
+    }
+
+    return FILP_OK;
+}
+
+
+/**
+ * recv - Receives a value from a channel.
+ * @channel: the channel
+ *
+ * Takes the oldest value sent through the channel. If the
+ * channel is empty, waits until a value is sent; if filp
+ * was built without thread support, an empty channel is an
+ * error instead.
+ * [Thread commands]
+ */
+static int _filpf_recv(void)
+/** @channel recv %value */
+{
+    struct filp_channel *c;
+    char *ptr;
+    int size, offset = 0, spins = 0;
+
+    if ((c = _filp_channel_pop()) == NULL)
+        return FILP_ERROR;
+
+    while ((ptr = filp_channel_recv(c, &size)) == NULL) {
+#ifndef CONFOPT_PTHREADS
+        strcpy(_filp_error_info, "channel empty");
+        _filp_error = FILPERR_INTERNAL_ERROR;
+        return FILP_ERROR;
+#endif
+        _filp_channel_wait(c, 0, &spins);
+    }
+
+    filp_push(filp_unmarshal(ptr, size, &offset));
+    filp_marshal_free(ptr, size);
+
+    return FILP_OK;
+}
+
+
+/**
+ * tryrecv - Receives a value from a channel, if there is one.
+ * @channel: the channel
+ *
+ * Takes the oldest value sent through the channel, if any,
+ * and returns it and a true value. If the channel is empty,
+ * returns NULL and 0. It never waits.
+ * [Thread commands]
+ */
+static int _filpf_tryrecv(void)
+/** @channel tryrecv %value %received */
+{
+    struct filp_channel *c;
+    char *ptr;
+    int size, offset = 0;
+
+    if ((c = _filp_channel_pop()) == NULL)
+        return FILP_ERROR;
+
+    if ((ptr = filp_channel_recv(c, &size)) == NULL) {
+        filp_null_push();
+        filp_int_push(0);
+    }
+    else {
+        filp_push(filp_unmarshal(ptr, size, &offset));
+        filp_marshal_free(ptr, size);
+        filp_int_push(1);
+    }
+
+    return FILP_OK;
+}
+
+
+/* generators */
+
+#define FILP_GEN_STACK_SIZE (512 * 1024)
+
+/* C stack kept free for the commands run by the deepest code */
+#define FILP_GEN_STACK_MARGIN (64 * 1024)
+
+#define FILP_GEN_NEW        0
+#define FILP_GEN_RUNNING    1
+#define FILP_GEN_SUSPENDED  2
+#define FILP_GEN_DONE       3
+
+struct filp_gen {
+#ifdef CONFOPT_UCONTEXT
+    ucontext_t ctx;             /* the generator's context */
+    ucontext_t caller;          /* context of who resumed it */
+    char *cstack;               /* the generator's C stack */
+#endif
+    struct filp_val *code;      /* the code */
+    struct filp_val *values;    /* array of yielded values */
+    int taken;                  /* values already taken */
+    struct filp_stack stack;    /* the generator's value stack */
+    int state;                  /* FILP_GEN_* */
+    int ret;                    /* the code's return value */
+    int cancel;                 /* 1 if being destroyed */
+};
+
+/* the generator being run */
+static FILP_TLS struct filp_gen *_filp_gen_current = NULL;
+
+#ifdef CONFOPT_UCONTEXT
+
+static void _filp_gen_entry(void)
+{
+    struct filp_gen *g = _filp_gen_current;
+
+    g->ret = filp_execv(g->code);
+    g->state = FILP_GEN_DONE;
+
+    /* returns to g->caller */
+}
+
+#endif              /* CONFOPT_UCONTEXT */
+
+
+static void _filp_gen_resume(struct filp_gen *g)
+/* runs the generator until it yields or finishes */
+{
+    struct filp_gen *prev = _filp_gen_current;
+#ifdef CONFOPT_UCONTEXT
+    char *limit = _filp_cstack_limit;
+#endif
+
+    _filp_gen_current = g;
+    filp_exchange_stack(&g->stack);
+
+#ifdef CONFOPT_UCONTEXT
+    if (g->state == FILP_GEN_NEW) {
+        if ((g->cstack = (char *) malloc(FILP_GEN_STACK_SIZE)) == NULL) {
+            _filp_error = FILPERR_OUT_OF_MEMORY;
+            g->ret = FILP_ERROR;
+            g->state = FILP_GEN_DONE;
+        }
+        else {
+            getcontext(&g->ctx);
+            g->ctx.uc_stack.ss_sp = g->cstack;
+            g->ctx.uc_stack.ss_size = FILP_GEN_STACK_SIZE;
+            g->ctx.uc_link = &g->caller;
+            makecontext(&g->ctx, _filp_gen_entry, 0);
+        }
+    }
+
+    if (g->state != FILP_GEN_DONE) {
+        g->state = FILP_GEN_RUNNING;
+
+        /* deep recursion fails instead of overflowing the C stack */
+        _filp_cstack_limit = g->cstack + FILP_GEN_STACK_MARGIN;
+        swapcontext(&g->caller, &g->ctx);
+        _filp_cstack_limit = limit;
+    }
+
+    if (g->state == FILP_GEN_DONE && g->cstack != NULL) {
+        free(g->cstack);
+        g->cstack = NULL;
+    }
+#else
+    /* no coroutines: run it until the end */
+    g->state = FILP_GEN_RUNNING;
+    g->ret = filp_execv(g->code);
+    g->state = FILP_GEN_DONE;
+#endif
+
+    filp_exchange_stack(&g->stack);
+    _filp_gen_current = prev;
+}
+
+
+/**
+ * filp_gen_destroy - Destroys a generator.
+ * @gen: the generator
+ *
+ * Destroys a generator. If it was suspended, it's resumed
+ * one last time, making yield return as if end were called,
+ * so it can release all it holds. It's called by the garbage
+ * collector when a FILP_GENERATOR value is destroyed.
+ */
+void filp_gen_destroy(void *gen)
+{
+    struct filp_gen *g = (struct filp_gen *) gen;
+
+    if (g->state == FILP_GEN_SUSPENDED) {
+        g->cancel = 1;
+        _filp_gen_resume(g);
+    }
+
+    /* drop its stack */
+    filp_exchange_stack(&g->stack);
+
+    while (_filp_stack_elems)
+        filp_pop();
+
+    filp_exchange_stack(&g->stack);
+
+    free(g->stack.values);
+    free(g->stack.marks);
+
+    filp_unref_value(g->code);
+    filp_unref_value(g->values);
+
+#ifdef CONFOPT_UCONTEXT
+    free(g->cstack);
+#endif
+
+    free(g);
+}
+
+
+/**
+ * filp_gen_next - Takes the next value from a generator.
+ * @v: the generator value
+ *
+ * Resumes the generator until it yields a value, that is pushed
+ * into the stack. Returns 1 if a value was pushed, 0 if the
+ * generator has finished, or FILP_ERROR if its code failed or
+ * it's already running (i.e. its own code asked it for a value).
+ */
+int filp_gen_next(struct filp_val *v)
+{
+    struct filp_gen *g = (struct filp_gen *) v->value;
+    int n;
+
+    /* it can't be resumed from inside itself */
+    if (g->state == FILP_GEN_RUNNING) {
+        strcpy(_filp_error_info, "generator already running");
+        _filp_error = FILPERR_GENERATOR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    /* all yielded values taken? run it again */
+    if (g->taken == filp_array_size(g->values) && g->state != FILP_GEN_DONE) {
+        filp_unref_value(g->values);
+        g->values = filp_new_value(FILP_ARRAY, NULL, 0);
+        filp_ref_value(g->values);
+        g->taken = 0;
+
+        filp_ref_value(v);
+        _filp_gen_resume(g);
+        filp_unref_value(v);
+    }
+
+    if (g->taken < (n = filp_array_size(g->values))) {
+        /* take it from the array and push it */
+        v = filp_array_set(g->values, NULL, ++g->taken);
+        filp_push(v);
+
+        return 1;
+    }
+
+    return g->ret == FILP_ERROR ? FILP_ERROR : 0;
+}
+
+
+/**
+ * gen - Creates a generator.
+ * @value: the initial value of the generator's stack
+ * @code: the generator's code
+ *
+ * Creates a generator, a block of code that produces a sequence
+ * of values with yield and that is consumed with next or foreach.
+ * The code is not run until the first value is asked for, and is
+ * suspended on each yield until the next one is; so, a generator
+ * can produce arbitrarily long (or endless) sequences using
+ * constant memory. The code runs with its own stack, holding
+ * @value at start, and on a C stack of limited size, so too deep
+ * recursion inside it fails with an error. If filp was built
+ * without coroutine support, the code is run until the end on
+ * creation and the yielded values are stored, so it must not
+ * be endless.
+ * [Control structures]
+ */
+static int _filpf_gen(void)
+/** @value { @code } gen %generator */
+{
+    struct filp_gen *g;
+    struct filp_val *c;
+    struct filp_val *a;
+    struct filp_val *v;
+
+    c = filp_pop();
+    a = filp_pop();
+
+    if ((g = (struct filp_gen *) calloc(1, sizeof(struct filp_gen))) == NULL) {
+        _filp_error = FILPERR_OUT_OF_MEMORY;
+        return FILP_ERROR;
+    }
+
+    g->code = c;
+    filp_ref_value(c);
+
+    g->values = filp_new_value(FILP_ARRAY, NULL, 0);
+    filp_ref_value(g->values);
+
+    /* the initial stack */
+    filp_exchange_stack(&g->stack);
+    filp_push(a);
+    filp_exchange_stack(&g->stack);
+
+    v = filp_new_value(FILP_GENERATOR, g, 0);
+
+#ifndef CONFOPT_UCONTEXT
+    filp_ref_value(v);
+    _filp_gen_resume(g);
+    filp_unref_value(v);
+#endif
+
+    filp_push(v);
+
+    return FILP_OK;
+}
+
+
+/**
+ * yield - Produces a value from a generator.
+ * @value: the value
+ *
+ * Hands @value to the consumer of the generator whose code is
+ * running, and suspends it until another value is asked for.
+ * [Control structures]
+ */
+static int _filpf_yield(void)
+/** @value yield */
+{
+    struct filp_gen *g = _filp_gen_current;
+    struct filp_val *v;
+
+    v = filp_pop();
+
+    if (g == NULL) {
+        strcpy(_filp_error_info, "yield");
+        _filp_error = FILPERR_GENERATOR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    filp_array_ins(g->values, v, 0);
+
+#ifdef CONFOPT_UCONTEXT
+    g->state = FILP_GEN_SUSPENDED;
+    swapcontext(&g->ctx, &g->caller);
+
+    /* resumed to be destroyed: unwind */
+    if (g->cancel)
+        return FILP_END;
+#endif
+
+    return FILP_OK;
+}
+
+
+/**
+ * next - Takes the next value from a generator.
+ * @generator: the generator
+ *
+ * Runs the generator until it yields a value, and returns it
+ * and a true value. If the generator has finished, returns NULL
+ * and 0.
+ * [Control structures]
+ */
+static int _filpf_next(void)
+/** @generator next %value %more */
+{
+    struct filp_val *v;
+    int n;
+
+    v = filp_pop();
+
+    if (v->type != FILP_GENERATOR) {
+        _filp_error = FILPERR_GENERATOR_EXPECTED;
+        return FILP_ERROR;
+    }
+
+    if ((n = filp_gen_next(v)) < 0)
+        return FILP_ERROR;
+
+    if (n == 0)
+        filp_null_push();
+
+    filp_int_push(n);
+
+    return FILP_OK;
+}
+
+
+void filp_thread_startup(void)
+{
+#ifdef CONFOPT_PTHREADS
+#ifdef _SC_NPROCESSORS_ONLN
+    if (_filp_threads == 0)
+        _filp_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+#endif
+
+    if (_filp_threads <= 0)
+        _filp_threads = 1;
+
+    filp_bin_code("pforall", _filpf_pforall);
+    filp_bin_code("pmap", _filpf_pmap);
+    filp_bin_code("spawn", _filpf_spawn);
+    filp_bin_code("chan", _filpf_chan);
+    filp_bin_code("send", _filpf_send);
+    filp_bin_code("recv", _filpf_recv);
+    filp_bin_code("tryrecv", _filpf_tryrecv);
+    filp_bin_code("gen", _filpf_gen);
+    filp_bin_code("yield", _filpf_yield);
+    filp_bin_code("next", _filpf_next);
+
+    /**
+     * lines - Reads the lines of a file lazily.
+     * @fdes: file descriptor
+     *
+     * Returns a generator that reads a line from @fdes each
+     * time a value is asked for, until EOF.
+     * [File and directory commands]
+     */
+    /** @fdes lines %generator */
+    filp_exec("/lines { { { dup read } { yield } while } gen } set");
+
+    /**
+     * filp_threads - Number of worker threads.
+     *
+     * The number of worker threads used by the parallel commands
+     * (as pmap or pforall). By default, the number of processors.
+     * If filp was compiled without thread support, parallel
+     * commands always run serially.
+     * [Special variables]
+     */
+    /** filp_threads */
+    filp_ext_int("filp_threads", &_filp_threads);
+
+    /**
+     * filp_chunk_size - Number of elements per parallel job.
+     *
+     * The number of array elements each worker thread takes at
+     * once in parallel commands. If it's 0 (the default), it's
+     * calculated from the array size and the number of threads.
+     * [Special variables]
+     */
+    /** filp_chunk_size */
+    filp_ext_int("filp_chunk_size", &_filp_chunk_size);
+}
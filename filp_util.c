@@ -23,6 +23,63 @@
     Code
 *******************/
 
+/**
+ * filp_new_scalar_len - Creates a new scalar from a block of bytes.
+ * @str: the bytes
+ * @len: number of bytes in @str
+ *
+ * Creates a new scalar with a copy of the @len bytes of @str,
+ * that need not be null-terminated (e.g. a piece of a bigger
+ * string). Returns the new value.
+ */
+struct filp_val *filp_new_scalar_len(char *str, int len)
+{
+    struct filp_val *v;
+
+    if ((v = filp_new_value(FILP_SCALAR, NULL, 0)) == NULL)
+        return NULL;
+
+    if ((v->value = (char *) malloc(len + 1)) == NULL)
+        return NULL;
+
+    memcpy(v->value, str, len);
+    v->value[len] = '\0';
+    v->size = len + 1;
+
+    return v;
+}
+
+
+/**
+ * filp_itoa - Formats an integer.
+ * @buf: the buffer (at least 12 bytes long)
+ * @value: the integer
+ *
+ * Writes the decimal representation of @value into @buf,
+ * as "%d" would do, but faster. @buf is not null-terminated.
+ * Returns the number of chars written.
+ */
+int filp_itoa(char *buf, int value)
+{
+    char tmp[16];
+    unsigned int u = value < 0 ? -(unsigned int) value : (unsigned int) value;
+    int n = 0, l = 0;
+
+    do {
+        tmp[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (value < 0)
+        buf[l++] = '-';
+
+    while (n)
+        buf[l++] = tmp[--n];
+
+    return l;
+}
+
+
 /**
  * filp_new_int_value - Creates a new scalar from an int.
  * @value: the integer to be used as the value
@@ -31,10 +88,25 @@
  * Returns the new value.
  */
 struct filp_val *filp_new_int_value(int value)
+{
+    char tmp[16];
+
+    return filp_new_scalar_len(tmp, filp_itoa(tmp, value));
+}
+
+
+/**
+ * filp_new_int64_value - Creates a new scalar from a 64 bit integer.
+ * @value: the integer to be used as the value
+ *
+ * Creates a new scalar from the 64 bit integer @value.
+ * Returns the new value.
+ */
+struct filp_val *filp_new_int64_value(filp_int64 value)
 {
     char tmp[64];
 
-    sprintf(tmp, "%i", value);
+    sprintf(tmp, "%lld", (long long) value);
     return filp_new_value(FILP_SCALAR, tmp, -1);
 }
 
@@ -322,11 +394,82 @@ int filp_ext_file(char *name, FILE * f)
         return 0;
 
     s->value = filp_new_value(FILP_FILE, (void *) f, 0);
+    filp_ref_value(s->value);
+
+    return 1;
+}
+
+
+/**
+ * filp_bind_value - Binds a value to a symbol.
+ * @name: name of the symbol
+ * @v: the value
+ *
+ * Sets the symbol @name to the value @v, creating the symbol
+ * if it does not exist. It's the same as executing
+ * "/name value set", but without building and parsing
+ * filp code, so it's suitable for setting the arguments
+ * of programs compiled with filp_compile() before running them.
+ */
+int filp_bind_value(char *name, struct filp_val *v)
+{
+    struct filp_sym *s;
+
+    if (v == NULL)
+        return 0;
+
+    if ((s = filp_find_symbol(name)) == NULL &&
+        (s = filp_new_symbol(v->type, name)) == NULL)
+        return 0;
+
+    filp_set_symbol(s, v);
 
     return 1;
 }
 
 
+/**
+ * filp_bind_int - Binds an integer to a symbol.
+ * @name: name of the symbol
+ * @value: the integer
+ *
+ * Sets the symbol @name to the integer @value.
+ * See filp_bind_value().
+ */
+int filp_bind_int(char *name, int value)
+{
+    return filp_bind_value(name, filp_new_int_value(value));
+}
+
+
+/**
+ * filp_bind_real - Binds a real number to a symbol.
+ * @name: name of the symbol
+ * @value: the real number
+ *
+ * Sets the symbol @name to the real number @value.
+ * See filp_bind_value().
+ */
+int filp_bind_real(char *name, double value)
+{
+    return filp_bind_value(name, filp_new_real_value(value));
+}
+
+
+/**
+ * filp_bind_string - Binds a string to a symbol.
+ * @name: name of the symbol
+ * @value: the string
+ *
+ * Sets the symbol @name to a copy of the string @value.
+ * See filp_bind_value().
+ */
+int filp_bind_string(char *name, char *value)
+{
+    return filp_bind_value(name, filp_new_value(FILP_SCALAR, value, -1));
+}
+
+
 FILE *(*filp_external_fopen) (char *filename, char *mode) = NULL;
 
 FILE *filp_fopen(char *filename, char *mode)
@@ -374,12 +517,41 @@ char *filp_load_file(char *filename)
 }
 
 
-#define FILP_DUMPCHAR(c) ptr=filp_poke(ptr, size, (*offset)++, (c))
+static char *_filp_dumpchar(char *ptr, int *size, int *offset, char c)
+{
+    return filp_append(ptr, size, offset, &c, 1);
+}
+
+#define FILP_DUMPCHAR(c) ptr=_filp_dumpchar(ptr, size, offset, (c))
+
+static char *_filp_dumper(struct filp_val *v, int lvl, int max,
+              char *ptr, int *size, int *offset);
+
+struct _filp_dumper_dst {
+    char *ptr;
+    int *size;
+    int *offset;
+    int lvl;
+    int max;
+};
+
+static int _filp_dumper_pair(struct filp_val *k, struct filp_val *v, void *arg)
+/* dumps a pair of an ordered map */
+{
+    struct _filp_dumper_dst *d = (struct _filp_dumper_dst *) arg;
+
+    d->ptr = _filp_dumper(k, d->lvl, d->max, d->ptr, d->size, d->offset);
+    d->ptr = _filp_dumper(v, d->lvl, d->max, d->ptr, d->size, d->offset);
+
+    return 0;
+}
+
 
 static char *_filp_dumper(struct filp_val *v, int lvl, int max,
               char *ptr, int *size, int *offset)
 {
     int n = 0;
+    int l = -1;
     char *pre = "";
     char *val = "";
     char *post = " ";
@@ -393,6 +565,7 @@ static char *_filp_dumper(struct filp_val *v, int lvl, int max,
     case FILP_SCALAR:
 
         val = v->value;
+        l = filp_val_len(v);
 
         pre = "'";
         post = "' ";
@@ -408,6 +581,7 @@ static char *_filp_dumper(struct filp_val *v, int lvl, int max,
     case FILP_CODE:
 
         val = v->value;
+        l = filp_val_len(v);
 
         if (strchr(v->value, '\n') == NULL) {
             pre = "{ ";
@@ -462,6 +636,80 @@ static char *_filp_dumper(struct filp_val *v, int lvl, int max,
         post = "' ";
         break;
 
+    case FILP_TASK:
+
+        pre = "'";
+        val = "[TASK]";
+        post = "' ";
+        break;
+
+    case FILP_CHANNEL:
+
+        pre = "'";
+        val = "[CHANNEL]";
+        post = "' ";
+        break;
+
+    case FILP_GENERATOR:
+
+        pre = "'";
+        val = "[GENERATOR]";
+        post = "' ";
+        break;
+
+    case FILP_VECTOR:
+
+        pre = "'";
+        val = "[VECTOR]";
+        post = "' ";
+        break;
+
+    case FILP_OMAP:
+
+        {
+            struct _filp_dumper_dst d;
+
+            /* as the list of pairs given to omap */
+            pre = "";
+            val = "";
+            post = "omap ";
+
+            FILP_DUMPCHAR('[');
+            FILP_DUMPCHAR(' ');
+
+            lvl++;
+            if (lvl < max)
+                FILP_DUMPCHAR('\n');
+
+            d.ptr = ptr;
+            d.size = size;
+            d.offset = offset;
+            d.lvl = lvl;
+            d.max = max;
+
+            filp_omap_range(v, NULL, NULL, _filp_dumper_pair, &d);
+            ptr = d.ptr;
+
+            lvl--;
+
+            if (lvl + 1 < max) {
+                for (n = 0; n < lvl; n++)
+                    FILP_DUMPCHAR('\t');
+            }
+
+            FILP_DUMPCHAR(']');
+            FILP_DUMPCHAR(' ');
+        }
+
+        break;
+
+    case FILP_BUILDER:
+
+        pre = "'";
+        val = "[BUILDER]";
+        post = "' ";
+        break;
+
     case FILP_ARRAY:
 
         pre = "";
@@ -491,12 +739,12 @@ static char *_filp_dumper(struct filp_val *v, int lvl, int max,
         break;
     }
 
-    while (*pre)
-        FILP_DUMPCHAR(*pre++);
-    while (*val)
-        FILP_DUMPCHAR(*val++);
-    while (*post)
-        FILP_DUMPCHAR(*post++);
+    ptr = filp_append(ptr, size, offset, pre, strlen(pre));
+    /* scalars can contain null bytes */
+    if (l == -1)
+        l = strlen(val);
+    ptr = filp_append(ptr, size, offset, val, l);
+    ptr = filp_append(ptr, size, offset, post, strlen(post));
 
     if (lvl < max)
         FILP_DUMPCHAR('\n');
@@ -516,10 +764,1267 @@ char *filp_dumper(struct filp_val *v, int max)
 }
 
 
-int filp_array_to_doubles(struct filp_val *v, double *d, int max)
-/* converts a filp_array to an array of doubles */
+/* marshalling tags */
+#define FILP_M_HOLE     'X'     /* empty array element */
+#define FILP_M_NULL     'N'
+#define FILP_M_SCALAR   'S'
+#define FILP_M_CODE     'C'
+#define FILP_M_ARRAY    'A'
+#define FILP_M_BIN_CODE 'B'
+#define FILP_M_FILE     'F'
+#define FILP_M_CHANNEL  'H'
+#define FILP_M_VECTOR   'V'
+#define FILP_M_OMAP     'O'
+#define FILP_M_BUILDER  'U'
+#define FILP_M_HASH     'K'     /* an array that is a hash */
+#define FILP_M_BIN_NAME 'b'     /* binary code, by name (frozen) */
+
+/* frozen values start with this */
+#define FILP_FREEZE_MAGIC "FLPz"
+#define FILP_FREEZE_DEPTH 512   /* maximum nesting when thawing */
+
+static char *_filp_marshal_tag(char *ptr, int *size, int *offset, int tag)
 {
-    int n;
+    char c = tag;
+
+    return filp_append(ptr, size, offset, &c, 1);
+}
+
+
+static char *_filp_marshal_hdr(char *ptr, int *size, int *offset,
+                   int tag, unsigned int i)
+/* appends a tag and a length at once */
+{
+    unsigned char b[5];
+
+    b[0] = tag;
+    b[1] = i & 0xff;
+    b[2] = (i >> 8) & 0xff;
+    b[3] = (i >> 16) & 0xff;
+    b[4] = (i >> 24) & 0xff;
+
+    return filp_append(ptr, size, offset, b, 5);
+}
+
+
+static char *_filp_marshal(struct filp_val *v, char *ptr, int *size,
+               int *offset, int frz);
+
+struct _filp_marshal_dst {
+    char *ptr;
+    int *size;
+    int *offset;
+    int frz;
+};
+
+static int _filp_marshal_pair(struct filp_val *k, struct filp_val *v, void *arg)
+/* appends a pair of an ordered map */
+{
+    struct _filp_marshal_dst *d = (struct _filp_marshal_dst *) arg;
+
+    d->ptr = _filp_marshal(k, d->ptr, d->size, d->offset, d->frz);
+    d->ptr = _filp_marshal(v, d->ptr, d->size, d->offset, d->frz);
+
+    return 0;
+}
+
+
+static char *_filp_marshal(struct filp_val *v, char *ptr, int *size,
+               int *offset, int frz)
+/* serializes a value; if frz is set, without pointers */
+{
+    struct filp_sym *s;
+    void *data;
+    int n, kind;
+
+    if (v == NULL)
+        return _filp_marshal_tag(ptr, size, offset, FILP_M_HOLE);
+
+    switch (v->type) {
+    case FILP_SCALAR:
+    case FILP_CODE:
+    case FILP_BUILDER:
+
+        n = filp_val_len(v);
+
+        ptr = _filp_marshal_hdr(ptr, size, offset,
+                    v->type == FILP_SCALAR ? FILP_M_SCALAR :
+                    v->type == FILP_CODE ? FILP_M_CODE : FILP_M_BUILDER, n);
+        ptr = filp_append(ptr, size, offset, v->value, n);
+
+        break;
+
+    case FILP_ARRAY:
+
+        ptr = _filp_marshal_hdr(ptr, size, offset,
+                    v->hash ? FILP_M_HASH : FILP_M_ARRAY, filp_array_size(v));
+
+        for (n = 1; n <= filp_array_size(v); n++)
+            ptr = _filp_marshal(filp_array_get(v, n), ptr, size, offset, frz);
+
+        break;
+
+    case FILP_BIN_CODE:
+
+        if (!frz) {
+            ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_BIN_CODE);
+            ptr = filp_append(ptr, size, offset, &v->value, sizeof(v->value));
+        }
+        else
+        if ((s = filp_find_bin_code(v)) != NULL) {
+            n = strlen(s->name);
+
+            ptr = _filp_marshal_hdr(ptr, size, offset, FILP_M_BIN_NAME, n);
+            ptr = filp_append(ptr, size, offset, s->name, n);
+        }
+        else
+            ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_NULL);
+
+        break;
+
+    case FILP_FILE:
+
+        if (frz) {
+            ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_NULL);
+            break;
+        }
+
+        ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_FILE);
+        ptr = filp_append(ptr, size, offset, &v->value, sizeof(v->value));
+        ptr = _filp_marshal_tag(ptr, size, offset, v->pipe ? 1 : 0);
+
+        break;
+
+    case FILP_CHANNEL:
+
+        if (frz) {
+            ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_NULL);
+            break;
+        }
+
+        filp_channel_ref(v->value);
+
+        ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_CHANNEL);
+        ptr = filp_append(ptr, size, offset, &v->value, sizeof(v->value));
+
+        break;
+
+    case FILP_VECTOR:
+
+        data = filp_vector_data(v, &kind, &n);
+
+        ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_VECTOR);
+        ptr = _filp_marshal_hdr(ptr, size, offset, kind, n);
+        ptr = filp_append(ptr, size, offset, data, n * sizeof(double));
+
+        break;
+
+    case FILP_OMAP:
+
+        {
+            struct _filp_marshal_dst d;
+
+            ptr = _filp_marshal_hdr(ptr, size, offset, FILP_M_OMAP, filp_omap_size(v));
+
+            d.ptr = ptr;
+            d.size = size;
+            d.offset = offset;
+            d.frz = frz;
+
+            filp_omap_range(v, NULL, NULL, _filp_marshal_pair, &d);
+            ptr = d.ptr;
+        }
+
+        break;
+
+    default:
+
+        ptr = _filp_marshal_tag(ptr, size, offset, FILP_M_NULL);
+        break;
+    }
+
+    return ptr;
+}
+
+
+/**
+ * filp_marshal - Serializes a value into a compact binary form.
+ * @v: the value (can be NULL, meaning an empty array element)
+ * @ptr: the dynamic string to store it into
+ * @size: size of the dynamic string
+ * @offset: pointer to the offset in the dynamic string
+ *
+ * Appends a compact, length-prefixed binary representation of
+ * the @v value to the dynamic string @ptr (see filp_append()).
+ * Arrays (and, so, hashes) and ordered maps are serialized
+ * recursively and the elements of numeric vectors are copied. Binary
+ * code, files and channels are stored as pointers, so the result
+ * is only meaningful inside the same process; it's used to move
+ * values between interpreters running in different threads.
+ * As serialized channels hold a reference, the string must be
+ * freed with filp_marshal_free().
+ * Returns a pointer to the new string.
+ */
+char *filp_marshal(struct filp_val *v, char *ptr, int *size, int *offset)
+{
+    return _filp_marshal(v, ptr, size, offset, 0);
+}
+
+
+static int _filp_unmarshal_u32(char *ptr, int size, int *offset, int *i)
+{
+    unsigned char *b = (unsigned char *) ptr + *offset;
+    unsigned int u;
+
+    if (*offset + 4 > size)
+        return 0;
+
+    u = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int) b[3] << 24);
+    *offset += 4;
+
+    /* lengths and counts never exceed an int */
+    if (u > 0x7fffffff)
+        return 0;
+
+    *i = u;
+
+    return 1;
+}
+
+
+static struct filp_val *_filp_unmarshal(char *ptr, int size, int *offset, int frz, int depth);
+
+static struct filp_val *_filp_unmarshal_bucket(char *ptr, int size, int *offset, int frz, int depth)
+/* rebuilds a bucket of a hash, interning its keys again */
+{
+    struct filp_val *v;
+    struct filp_val *e;
+    char buf[64];
+    char *key;
+    int n, i, l;
+
+    if (*offset >= size || ptr[*offset] != FILP_M_ARRAY)
+        return _filp_unmarshal(ptr, size, offset, frz, depth);
+
+    (*offset)++;
+
+    /* every element takes at least one byte */
+    if (!_filp_unmarshal_u32(ptr, size, offset, &n) || n > size - *offset) {
+        *offset = -1;
+        return NULL;
+    }
+
+    v = filp_new_value(FILP_ARRAY, NULL, n);
+
+    for (i = 1; i <= n; i++) {
+        /* keys are interned, as in filp_hash_set() */
+        if (i % 2 && *offset + 5 <= size && ptr[*offset] == FILP_M_SCALAR) {
+            (*offset)++;
+
+            if (_filp_unmarshal_u32(ptr, size, offset, &l) &&
+                (unsigned) l <= (unsigned) (size - *offset) &&
+                memchr(ptr + *offset, '\0', l) == NULL) {
+                key = l < (int) sizeof(buf) ? buf : malloc(l + 1);
+
+                memcpy(key, ptr + *offset, l);
+                key[l] = '\0';
+                *offset += l;
+
+                e = filp_new_interned_value(key);
+
+                if (key != buf)
+                    free(key);
+            }
+            else {
+                *offset -= 5;
+                e = _filp_unmarshal(ptr, size, offset, frz, depth + 1);
+            }
+        }
+        else
+            e = _filp_unmarshal(ptr, size, offset, frz, depth + 1);
+
+        if (*offset == -1)
+            return NULL;
+
+        filp_array_set(v, e, i);
+    }
+
+    return v;
+}
+
+
+static struct filp_val *_filp_unmarshal(char *ptr, int size, int *offset, int frz, int depth)
+/* rebuilds a value; if frz is set, pointers are not accepted
+   and nesting is limited */
+{
+    struct filp_val *v = NULL;
+    int n, i, tag;
+
+    if (*offset < 0 || *offset >= size || (frz && depth > FILP_FREEZE_DEPTH)) {
+        *offset = -1;
+        return NULL;
+    }
+
+    tag = ptr[(*offset)++];
+
+    switch (tag) {
+    case FILP_M_HOLE:
+        break;
+
+    case FILP_M_NULL:
+        v = _filp_null_value;
+        break;
+
+    case FILP_M_SCALAR:
+    case FILP_M_CODE:
+
+        if (!_filp_unmarshal_u32(ptr, size, offset, &n) ||
+            (unsigned) n > (unsigned) (size - *offset))
+            break;
+
+        /* the stored string is not null-terminated */
+        v = filp_new_value(tag == FILP_M_SCALAR ? FILP_SCALAR : FILP_CODE,
+                   NULL, n + 1);
+        v->value = malloc(n + 1);
+        memcpy(v->value, ptr + *offset, n);
+        v->value[n] = '\0';
+        *offset += n;
+
+        return v;
+
+    case FILP_M_BUILDER:
+
+        if (!_filp_unmarshal_u32(ptr, size, offset, &n) ||
+            (unsigned) n > (unsigned) (size - *offset))
+            break;
+
+        v = filp_new_builder();
+        filp_builder_append(v, ptr + *offset, n);
+        *offset += n;
+
+        return v;
+
+    case FILP_M_ARRAY:
+    case FILP_M_HASH:
+
+        /* every element takes at least one byte */
+        if (!_filp_unmarshal_u32(ptr, size, offset, &n) || n > size - *offset)
+            break;
+
+        v = filp_new_value(FILP_ARRAY, NULL, n);
+        v->hash = tag == FILP_M_HASH;
+
+        for (i = 1; i <= n; i++) {
+            struct filp_val *e = tag == FILP_M_HASH ?
+                _filp_unmarshal_bucket(ptr, size, offset, frz, depth + 1) :
+                _filp_unmarshal(ptr, size, offset, frz, depth + 1);
+
+            if (*offset == -1)
+                return NULL;
+
+            filp_array_set(v, e, i);
+        }
+
+        return v;
+
+    case FILP_M_BIN_CODE:
+
+        if (frz || *offset + (int) sizeof(v->value) > size)
+            break;
+
+        v = filp_new_value(FILP_BIN_CODE, NULL, 0);
+        memcpy(&v->value, ptr + *offset, sizeof(v->value));
+        *offset += sizeof(v->value);
+
+        return v;
+
+    case FILP_M_BIN_NAME:
+
+        if (!frz || !_filp_unmarshal_u32(ptr, size, offset, &n) ||
+            (unsigned) n > (unsigned) (size - *offset))
+            break;
+
+        {
+            struct filp_sym *s;
+            char *name;
+
+            name = malloc(n + 1);
+            memcpy(name, ptr + *offset, n);
+            name[n] = '\0';
+            *offset += n;
+
+            s = filp_find_symbol(name);
+            free(name);
+
+            /* the function must exist in this interpreter */
+            if (s == NULL || s->type != FILP_BIN_CODE || s->value == NULL)
+                break;
+
+            v = filp_new_value(FILP_BIN_CODE, s->value->value, 0);
+        }
+
+        return v;
+
+    case FILP_M_FILE:
+
+        if (frz || *offset + (int) sizeof(v->value) + 1 > size)
+            break;
+
+        v = filp_new_value(FILP_FILE, NULL, 0);
+        memcpy(&v->value, ptr + *offset, sizeof(v->value));
+        *offset += sizeof(v->value);
+        v->pipe = ptr[(*offset)++];
+
+        return v;
+
+    case FILP_M_CHANNEL:
+
+        if (frz || *offset + (int) sizeof(v->value) > size)
+            break;
+
+        v = filp_new_value(FILP_CHANNEL, NULL, 0);
+        memcpy(&v->value, ptr + *offset, sizeof(v->value));
+        *offset += sizeof(v->value);
+
+        /* the new value holds its own reference */
+        filp_channel_ref(v->value);
+
+        return v;
+
+    case FILP_M_VECTOR:
+
+        if (*offset + 1 > size)
+            break;
+
+        i = ptr[(*offset)++];
+
+        if ((i != FILP_VEC_INT && i != FILP_VEC_REAL) ||
+            !_filp_unmarshal_u32(ptr, size, offset, &n) ||
+            n > (size - *offset) / (int) sizeof(double))
+            break;
+
+        /* the copy belongs to the new vector */
+        v = filp_new_vector(i, NULL, n);
+        memcpy(filp_vector_data(v, NULL, NULL), ptr + *offset, n * sizeof(double));
+        *offset += n * sizeof(double);
+
+        return v;
+
+    case FILP_M_OMAP:
+
+        /* every pair takes at least two bytes */
+        if (!_filp_unmarshal_u32(ptr, size, offset, &n) || n > (size - *offset) / 2)
+            break;
+
+        v = filp_new_omap();
+
+        for (i = 0; i < n; i++) {
+            struct filp_val *k = _filp_unmarshal(ptr, size, offset, frz, depth + 1);
+            struct filp_val *e = _filp_unmarshal(ptr, size, offset, frz, depth + 1);
+
+            if (*offset == -1 || k == NULL || e == NULL) {
+                *offset = -1;
+                return NULL;
+            }
+
+            filp_omap_set(v, k->value, e);
+        }
+
+        return v;
+    }
+
+    if (tag != FILP_M_HOLE && tag != FILP_M_NULL)
+        *offset = -1;
+
+    return v;
+}
+
+
+
+/**
+ * filp_unmarshal - Rebuilds a value serialized by filp_marshal().
+ * @ptr: the serialized data
+ * @size: size of the serialized data
+ * @offset: pointer to the offset in @ptr where the value starts
+ *
+ * Creates a new value from its binary representation stored
+ * at @offset, that is moved past it. The new value belongs to
+ * the value pool of the calling interpreter and is not referenced.
+ * Returns the value, or NULL if it was an empty array element or
+ * the data is malformed (in that case, @offset is set to -1).
+ */
+struct filp_val *filp_unmarshal(char *ptr, int size, int *offset)
+{
+    return _filp_unmarshal(ptr, size, offset, 0, 0);
+}
+
+
+static void _filp_marshal_release(char *ptr, int size, int *offset)
+/* drops the references held by a serialized value */
+{
+    void *p;
+    int n, tag;
+
+    if (*offset < 0 || *offset >= size) {
+        *offset = -1;
+        return;
+    }
+
+    tag = ptr[(*offset)++];
+
+    switch (tag) {
+    case FILP_M_SCALAR:
+    case FILP_M_CODE:
+    case FILP_M_BUILDER:
+
+        if (_filp_unmarshal_u32(ptr, size, offset, &n))
+            *offset += n;
+
+        break;
+
+    case FILP_M_ARRAY:
+    case FILP_M_HASH:
+
+        if (_filp_unmarshal_u32(ptr, size, offset, &n)) {
+            while (n-- && *offset >= 0)
+                _filp_marshal_release(ptr, size, offset);
+        }
+
+        break;
+
+    case FILP_M_BIN_CODE:
+
+        *offset += sizeof(void *);
+        break;
+
+    case FILP_M_FILE:
+
+        *offset += sizeof(void *) + 1;
+        break;
+
+    case FILP_M_OMAP:
+
+        if (_filp_unmarshal_u32(ptr, size, offset, &n)) {
+            n *= 2;
+
+            while (n-- && *offset >= 0)
+                _filp_marshal_release(ptr, size, offset);
+        }
+
+        break;
+
+    case FILP_M_VECTOR:
+
+        (*offset)++;
+
+        if (_filp_unmarshal_u32(ptr, size, offset, &n))
+            *offset += n * sizeof(double);
+
+        break;
+
+    case FILP_M_CHANNEL:
+
+        if (*offset + (int) sizeof(void *) <= size) {
+            memcpy(&p, ptr + *offset, sizeof(void *));
+            filp_channel_unref(p);
+        }
+
+        *offset += sizeof(void *);
+        break;
+    }
+}
+
+
+/**
+ * filp_marshal_free - Frees serialized values.
+ * @ptr: the serialized data
+ * @size: size of the serialized data
+ *
+ * Frees a string created by filp_marshal(), releasing the
+ * channels stored inside. @ptr can be NULL.
+ */
+void filp_marshal_free(char *ptr, int size)
+{
+    int offset = 0;
+
+    if (ptr == NULL)
+        return;
+
+    while (offset >= 0 && offset < size)
+        _filp_marshal_release(ptr, size, &offset);
+
+    free(ptr);
+}
+
+
+/**
+ * filp_freeze - Serializes a value for storage.
+ * @v: the value
+ * @len: pointer to store the length of the result
+ *
+ * Serializes the @v value into a compact, length-prefixed binary
+ * form that can be stored and later rebuilt with filp_thaw(),
+ * even by another process. It's the same encoding as filp_marshal(),
+ * but binary code is stored by name and files and channels, that
+ * cannot outlive the process, are stored as NULL. Numeric vectors
+ * are stored in native byte order.
+ * The returned string is null-terminated (the null is not counted
+ * in @len) and must be freed with free().
+ */
+char *filp_freeze(struct filp_val *v, int *len)
+{
+    char *ptr = NULL;
+    int size = 0;
+    int offset = 0;
+
+    ptr = filp_append(ptr, &size, &offset, FILP_FREEZE_MAGIC, 4);
+    ptr = _filp_marshal(v, ptr, &size, &offset, 1);
+    ptr = filp_poke(ptr, &size, offset, '\0');
+
+    *len = offset;
+
+    return ptr;
+}
+
+
+/**
+ * filp_thaw - Rebuilds a value stored by filp_freeze().
+ * @ptr: the frozen data
+ * @len: length of the frozen data
+ *
+ * Creates a new value from the result of filp_freeze(). Binary
+ * code is looked up by name in the current dictionary. The new
+ * value is not referenced.
+ * Returns the value, or NULL if the data is malformed or nested
+ * too deep.
+ */
+struct filp_val *filp_thaw(char *ptr, int len)
+{
+    struct filp_val *v;
+    int offset = 4;
+
+    if (len < 4 || memcmp(ptr, FILP_FREEZE_MAGIC, 4) != 0)
+        return NULL;
+
+    v = _filp_unmarshal(ptr, len, &offset, 1, 0);
+
+    /* trailing data is not accepted */
+    if (offset != len)
+        v = NULL;
+
+    return v;
+}
+
+
+/* JSON */
+
+#define FILP_JSON_DEPTH 512     /* maximum nesting */
+
+struct _filp_json_out {
+    char *ptr;                  /* the dynamic string */
+    int size;                   /* its size */
+    int len;                    /* its length */
+    int depth;                  /* nesting level */
+};
+
+struct _filp_json_in {
+    char *s;                    /* the document */
+    char *p;                    /* current position */
+    char *e;                    /* its end */
+    char *buf;                  /* buffer for escaped strings */
+    int bsize;                  /* its size */
+    struct filp_val **vals;     /* pending elements and pairs */
+    int nvals;                  /* their number */
+    int avals;                  /* allocated ones */
+};
+
+#define FILP_JSON_PUT(o, s, l) (o)->ptr = filp_append((o)->ptr, &(o)->size, &(o)->len, s, l)
+#define FILP_JSON_DIGITS(p, i, l) while (i < l && p[i] >= '0' && p[i] <= '9') i++
+
+static int _filp_json_isnum(char *p, int l)
+/* tests if a string is a JSON number */
+{
+    int i = 0, d;
+
+    if (i < l && p[i] == '-')
+        i++;
+
+    d = i;
+    FILP_JSON_DIGITS(p, i, l);
+
+    /* at least a digit, and no leading zeros */
+    if (i == d || (p[d] == '0' && i > d + 1))
+        return 0;
+
+    if (i < l && p[i] == '.') {
+        d = ++i;
+        FILP_JSON_DIGITS(p, i, l);
+
+        if (i == d)
+            return 0;
+    }
+
+    if (i < l && (p[i] == 'e' || p[i] == 'E')) {
+        i++;
+
+        if (i < l && (p[i] == '+' || p[i] == '-'))
+            i++;
+
+        d = i;
+        FILP_JSON_DIGITS(p, i, l);
+
+        if (i == d)
+            return 0;
+    }
+
+    return i == l;
+}
+
+
+static void _filp_json_str(struct _filp_json_out *o, char *p, int l)
+/* appends a quoted string */
+{
+    char *e = p + l;
+    char tmp[8];
+    int n;
+
+    FILP_JSON_PUT(o, "\"", 1);
+
+    while (p < e) {
+        /* the run of chars that need no escaping */
+        for (n = 0; p + n < e && (unsigned char) p[n] >= ' ' &&
+             p[n] != '"' && p[n] != '\\'; n++);
+
+        FILP_JSON_PUT(o, p, n);
+        p += n;
+
+        if (p == e)
+            break;
+
+        switch (*p) {
+        case '"':
+            FILP_JSON_PUT(o, "\\\"", 2);
+            break;
+        case '\\':
+            FILP_JSON_PUT(o, "\\\\", 2);
+            break;
+        case '\n':
+            FILP_JSON_PUT(o, "\\n", 2);
+            break;
+        case '\r':
+            FILP_JSON_PUT(o, "\\r", 2);
+            break;
+        case '\t':
+            FILP_JSON_PUT(o, "\\t", 2);
+            break;
+        default:
+            sprintf(tmp, "\\u%04x", (unsigned char) *p);
+            FILP_JSON_PUT(o, tmp, 6);
+            break;
+        }
+
+        p++;
+    }
+
+    FILP_JSON_PUT(o, "\"", 1);
+}
+
+
+static int _filp_json_encode(struct _filp_json_out *o, struct filp_val *v);
+
+static int _filp_json_pair(struct filp_val *k, struct filp_val *v, void *arg)
+/* appends a pair of an object */
+{
+    struct _filp_json_out *o = (struct _filp_json_out *) arg;
+
+    if (o->ptr[o->len - 1] != '{')
+        FILP_JSON_PUT(o, ",", 1);
+
+    _filp_json_str(o, k->value, filp_val_len(k));
+    FILP_JSON_PUT(o, ":", 1);
+
+    return _filp_json_encode(o, v);
+}
+
+
+static int _filp_json_encode(struct _filp_json_out *o, struct filp_val *v)
+/* appends a value; returns non-zero if nested too deep */
+{
+    struct filp_val *b;
+    int n, i, ret = 0;
+
+    if (v == NULL || v->type == FILP_NULL) {
+        FILP_JSON_PUT(o, "null", 4);
+        return 0;
+    }
+
+    if (v->type == FILP_SCALAR || v->type == FILP_BUILDER || v->type == FILP_CODE) {
+        n = filp_val_len(v);
+
+        /* scalars that look like numbers are numbers */
+        if (v->type != FILP_CODE && _filp_json_isnum(v->value, n))
+            FILP_JSON_PUT(o, v->value, n);
+        else
+            _filp_json_str(o, v->value, n);
+
+        return 0;
+    }
+
+    if (++o->depth > FILP_JSON_DEPTH)
+        return 1;
+
+    if (v->type == FILP_ARRAY && v->hash) {
+        FILP_JSON_PUT(o, "{", 1);
+
+        /* the buckets hold keys and values in turn */
+        for (n = 1; !ret && n <= filp_array_size(v); n++) {
+            if ((b = filp_array_get(v, n)) == NULL)
+                continue;
+
+            for (i = 1; !ret && i < filp_array_size(b); i += 2)
+                ret = _filp_json_pair(filp_array_get(b, i), filp_array_get(b, i + 1), o);
+        }
+
+        FILP_JSON_PUT(o, "}", 1);
+    }
+    else
+    if (v->type == FILP_ARRAY) {
+        FILP_JSON_PUT(o, "[", 1);
+
+        for (n = 1; !ret && n <= filp_array_size(v); n++) {
+            if (n > 1)
+                FILP_JSON_PUT(o, ",", 1);
+
+            ret = _filp_json_encode(o, filp_array_get(v, n));
+        }
+
+        FILP_JSON_PUT(o, "]", 1);
+    }
+    else
+    if (v->type == FILP_VECTOR) {
+        FILP_JSON_PUT(o, "[", 1);
+
+        for (n = 1; n <= filp_vector_size(v); n++) {
+            if (n > 1)
+                FILP_JSON_PUT(o, ",", 1);
+
+            b = filp_vector_get(v, n);
+            FILP_JSON_PUT(o, b->value, filp_val_len(b));
+        }
+
+        FILP_JSON_PUT(o, "]", 1);
+    }
+    else
+    if (v->type == FILP_OMAP) {
+        FILP_JSON_PUT(o, "{", 1);
+        filp_omap_range(v, NULL, NULL, _filp_json_pair, o);
+        FILP_JSON_PUT(o, "}", 1);
+
+        /* the walk stops on error */
+        ret = o->depth > FILP_JSON_DEPTH;
+    }
+    else
+        FILP_JSON_PUT(o, "null", 4);
+
+    o->depth--;
+
+    return ret;
+}
+
+
+/**
+ * filp_json_encode - Serializes a value as JSON.
+ * @v: the value
+ * @len: pointer to store the length of the result
+ *
+ * Returns a newly allocated, null-terminated string with the
+ * JSON representation of @v. Hashes and ordered maps are
+ * objects, arrays and vectors are arrays, scalars that look
+ * like numbers are numbers, other scalars are strings and
+ * NULL is null. Returns NULL if @v is nested too deep.
+ */
+char *filp_json_encode(struct filp_val *v, int *len)
+{
+    struct _filp_json_out o;
+
+    memset(&o, '\0', sizeof(o));
+
+    if (_filp_json_encode(&o, v)) {
+        free(o.ptr);
+        return NULL;
+    }
+
+    FILP_JSON_PUT(&o, "", 1);
+    *len = o.len - 1;
+
+    return o.ptr;
+}
+
+
+static void _filp_json_keep(struct _filp_json_in *j, struct filp_val *v)
+/* stores a pending element */
+{
+    if (j->nvals == j->avals) {
+        j->avals = j->avals ? j->avals * 2 : 64;
+        j->vals = (struct filp_val **) realloc(j->vals,
+                                j->avals * sizeof(struct filp_val *));
+    }
+
+    j->vals[j->nvals++] = v;
+}
+
+
+static void _filp_json_ws(struct _filp_json_in *j)
+/* skips whitespace */
+{
+    while (j->p < j->e && (*j->p == ' ' || *j->p == '\n' ||
+                           *j->p == '\r' || *j->p == '\t'))
+        j->p++;
+}
+
+
+static int _filp_json_hex(char *p, char *e, unsigned int *c)
+/* parses the 4 hex digits of a \u escape */
+{
+    int n;
+
+    if (e - p < 4)
+        return 0;
+
+    for (*c = 0, n = 0; n < 4; n++) {
+        int d = p[n];
+
+        if (d >= '0' && d <= '9')
+            d -= '0';
+        else
+        if (d >= 'a' && d <= 'f')
+            d -= 'a' - 10;
+        else
+        if (d >= 'A' && d <= 'F')
+            d -= 'A' - 10;
+        else
+            return 0;
+
+        *c = *c * 16 + d;
+    }
+
+    return 1;
+}
+
+
+static struct filp_val *_filp_json_string(struct _filp_json_in *j, int key)
+/* parses a string, with j->p on its opening quote; keys are
+   returned as interned values */
+{
+    char *p = j->p + 1;
+    char *e = j->e;
+    char tmp[4];
+    unsigned int c, c2;
+    int n, l = 0;
+
+    n = filp_memcspn(p, e - p, "\"\\", 2);
+
+    /* no escapes: taken as is */
+    if (!key && p + n < e && p[n] == '"') {
+        j->p = p + n + 1;
+        return filp_new_scalar_len(p, n);
+    }
+
+    for (;;) {
+        /* the string can start with an escape */
+        if (n)
+            j->buf = filp_append(j->buf, &j->bsize, &l, p, n);
+
+        p += n;
+
+        if (p == e)
+            return NULL;
+
+        if (*p == '"')
+            break;
+
+        /* a backslash */
+        if (++p == e)
+            return NULL;
+
+        switch (*p++) {
+        case 'b':
+            tmp[0] = '\b';
+            n = 1;
+            break;
+        case 'f':
+            tmp[0] = '\f';
+            n = 1;
+            break;
+        case 'n':
+            tmp[0] = '\n';
+            n = 1;
+            break;
+        case 'r':
+            tmp[0] = '\r';
+            n = 1;
+            break;
+        case 't':
+            tmp[0] = '\t';
+            n = 1;
+            break;
+        case 'u':
+            if (!_filp_json_hex(p, e, &c))
+                return NULL;
+
+            p += 4;
+
+            /* surrogate pair */
+            if (c >= 0xd800 && c < 0xdc00 && e - p >= 6 && p[0] == '\\' &&
+                p[1] == 'u' && _filp_json_hex(p + 2, e, &c2) &&
+                c2 >= 0xdc00 && c2 < 0xe000) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+                p += 6;
+            }
+
+            /* as UTF-8 */
+            if (c < 0x80) {
+                tmp[0] = c;
+                n = 1;
+            }
+            else
+            if (c < 0x800) {
+                tmp[0] = 0xc0 | (c >> 6);
+                tmp[1] = 0x80 | (c & 0x3f);
+                n = 2;
+            }
+            else
+            if (c < 0x10000) {
+                tmp[0] = 0xe0 | (c >> 12);
+                tmp[1] = 0x80 | ((c >> 6) & 0x3f);
+                tmp[2] = 0x80 | (c & 0x3f);
+                n = 3;
+            }
+            else {
+                tmp[0] = 0xf0 | (c >> 18);
+                tmp[1] = 0x80 | ((c >> 12) & 0x3f);
+                tmp[2] = 0x80 | ((c >> 6) & 0x3f);
+                tmp[3] = 0x80 | (c & 0x3f);
+                n = 4;
+            }
+
+            break;
+        default:
+            /* \" \\ \/ and others are the char itself */
+            tmp[0] = p[-1];
+            n = 1;
+            break;
+        }
+
+        j->buf = filp_append(j->buf, &j->bsize, &l, tmp, n);
+
+        n = filp_memcspn(p, e - p, "\"\\", 2);
+    }
+
+    j->p = p + 1;
+
+    if (key) {
+        j->buf = filp_append(j->buf, &j->bsize, &l, "", 1);
+        return filp_new_interned_value(j->buf);
+    }
+
+    return filp_new_scalar_len(j->buf, l);
+}
+
+
+static struct filp_val *_filp_json_value(struct _filp_json_in *j, int depth)
+/* parses a value; returns NULL on error */
+{
+    struct filp_val *v;
+    struct filp_val *k;
+    int base = j->nvals;
+    int n;
+
+    _filp_json_ws(j);
+
+    if (j->p == j->e || depth > FILP_JSON_DEPTH)
+        return NULL;
+
+    switch (*j->p) {
+    case '"':
+        return _filp_json_string(j, 0);
+
+    case '[':
+        j->p++;
+        _filp_json_ws(j);
+
+        if (j->p < j->e && *j->p == ']')
+            j->p++;
+        else {
+            for (;;) {
+                if ((v = _filp_json_value(j, depth + 1)) == NULL)
+                    return NULL;
+
+                _filp_json_keep(j, v);
+                _filp_json_ws(j);
+
+                if (j->p == j->e)
+                    return NULL;
+
+                if (*j->p++ == ']')
+                    break;
+
+                if (j->p[-1] != ',')
+                    return NULL;
+            }
+        }
+
+        v = filp_new_value(FILP_ARRAY, NULL, j->nvals - base);
+
+        for (n = base; n < j->nvals; n++)
+            filp_array_set(v, j->vals[n], n - base + 1);
+
+        j->nvals = base;
+
+        return v;
+
+    case '{':
+        j->p++;
+        _filp_json_ws(j);
+
+        if (j->p < j->e && *j->p == '}')
+            j->p++;
+        else {
+            for (;;) {
+                _filp_json_ws(j);
+
+                if (j->p == j->e || *j->p != '"' || (k = _filp_json_string(j, 1)) == NULL)
+                    return NULL;
+
+                _filp_json_ws(j);
+
+                if (j->p == j->e || *j->p++ != ':')
+                    return NULL;
+
+                if ((v = _filp_json_value(j, depth + 1)) == NULL)
+                    return NULL;
+
+                _filp_json_keep(j, k);
+                _filp_json_keep(j, v);
+                _filp_json_ws(j);
+
+                if (j->p == j->e)
+                    return NULL;
+
+                if (*j->p++ == '}')
+                    break;
+
+                if (j->p[-1] != ',')
+                    return NULL;
+            }
+        }
+
+        /* about 8 pairs per bucket */
+        v = filp_new_hash((j->nvals - base) / 16 + 1);
+
+        for (n = base; n < j->nvals; n += 2)
+            filp_hash_set_value(v, j->vals[n], NULL, j->vals[n + 1]);
+
+        j->nvals = base;
+
+        return v;
+
+    case 't':
+        if (j->e - j->p >= 4 && memcmp(j->p, "true", 4) == 0) {
+            j->p += 4;
+            return _filp_true_value;
+        }
+
+        return NULL;
+
+    case 'f':
+        if (j->e - j->p >= 5 && memcmp(j->p, "false", 5) == 0) {
+            j->p += 5;
+            return filp_new_scalar_len("0", 1);
+        }
+
+        return NULL;
+
+    case 'n':
+        if (j->e - j->p >= 4 && memcmp(j->p, "null", 4) == 0) {
+            j->p += 4;
+            return _filp_null_value;
+        }
+
+        return NULL;
+    }
+
+    /* a number */
+    for (n = 0; j->p + n < j->e && strchr("+-.eE0123456789", j->p[n]) && j->p[n]; n++);
+
+    if (!_filp_json_isnum(j->p, n))
+        return NULL;
+
+    v = filp_new_scalar_len(j->p, n);
+    j->p += n;
+
+    return v;
+}
+
+
+/**
+ * filp_json_decode - Parses a JSON document.
+ * @str: the document
+ * @len: its length
+ * @err: pointer to store the offset of an error
+ *
+ * Parses the @len bytes of @str as JSON in a single pass and
+ * returns the equivalent value: objects are hashes, arrays are
+ * arrays, strings and numbers are scalars, true and false are
+ * 1 and 0 and null is NULL. On error, returns NULL and stores
+ * into @err the offset where the parsing failed.
+ */
+struct filp_val *filp_json_decode(char *str, int len, int *err)
+{
+    struct _filp_json_in j;
+    struct filp_val *v;
+
+    memset(&j, '\0', sizeof(j));
+    j.s = j.p = str;
+    j.e = str + len;
+
+    if ((v = _filp_json_value(&j, 0)) != NULL) {
+        /* only whitespace can follow */
+        _filp_json_ws(&j);
+
+        if (j.p != j.e)
+            v = NULL;
+    }
+
+    if (v == NULL)
+        *err = j.p - j.s;
+
+    free(j.buf);
+    free(j.vals);
+
+    return v;
+}
+
+
+int filp_array_to_doubles(struct filp_val *v, double *d, int max)
+/* converts a filp_array (or vector) to an array of doubles */
+{
+    void *data;
+    int n, kind, num;
+
+    if ((data = filp_vector_data(v, &kind, &num)) != NULL) {
+        if (num > max)
+            num = max;
+
+        if (kind == FILP_VEC_REAL)
+            memcpy(d, data, num * sizeof(double));
+        else {
+            for (n = 0; n < num; n++)
+                d[n] = (double) ((filp_int64 *) data)[n];
+        }
+
+        return num;
+    }
 
     for (n = 0; n < filp_array_size(v) && n < max; n++)
         d[n] = filp_val_to_real(filp_array_get(v, n + 1));
@@ -529,7 +2034,8 @@ int filp_array_to_doubles(struct filp_val *v, double *d, int max)
 
 
 struct filp_val *filp_doubles_to_array(double *d, int num)
-/* converts an array of doubles to a filp_array */
+/* converts an array of doubles to a filp_array (copying them;
+   see filp_new_vector() to wrap them instead) */
 {
     struct filp_val *v;
     int n;
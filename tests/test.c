@@ -4,11 +4,77 @@
 
 */
 
+#include <stdio.h>
+#include <string.h>
+
 #include "filp.h"
 
 int i_test=1;
 char color[256];
 
+int errors=0;
+
+void check(char *name, int ok)
+{
+	printf("Testing %s... %s\n", name, ok ? "OK!" : "Error!");
+
+	if(!ok)
+		errors++;
+}
+
+
+int pop_int(void)
+{
+	return(filp_val_to_int(filp_pop()));
+}
+
+
+void test_c_api(void)
+{
+	struct filp_prog *p;
+	int n, ok, elems;
+
+	/* compiled once, run with different bound values */
+	p=filp_compile("/r $a $b + =");
+	check("filp_compile", p != NULL);
+
+	ok=1;
+	for(n=0;n < 10;n++) {
+		filp_bind_int("a", n);
+		filp_bind_value("b", filp_new_int_value(100));
+
+		if(filp_run(p) != FILP_OK ||
+		   filp_callv("r", NULL) != FILP_OK || pop_int() != n + 100)
+			ok=0;
+	}
+	check("filp_run and filp_bind_int", ok);
+
+	filp_prog_unref(p);
+
+	filp_bind_real("x", 2.5);
+	filp_callv("x", NULL);
+	check("filp_bind_real", filp_val_to_real(filp_pop()) == 2.5);
+
+	filp_bind_string("s", "hello");
+	filp_callv("s", NULL);
+	check("filp_bind_string", strcmp(filp_pop()->value, "hello") == 0);
+
+	check("filp_callv with ints", filp_callv("+", "ii", 2, 3) == FILP_OK &&
+		pop_int() == 5);
+	check("filp_callv with a string", filp_callv("length", "s", "four") == FILP_OK &&
+		pop_int() == 4);
+	check("filp_callv with a value",
+		filp_callv("+", "vi", filp_new_int_value(40), 2) == FILP_OK &&
+		pop_int() == 42);
+
+	/* nothing is left in the stack if the word does not exist */
+	elems=_filp_stack_elems;
+	check("filp_callv on an unknown word",
+		filp_callv("no_such_word", "ii", 1, 2) == FILP_ERROR &&
+		_filp_stack_elems == elems);
+}
+
+
 int main(void)
 {
 	filp_startup();
@@ -28,7 +94,9 @@ int main(void)
 	filp_exec("qq 0 set { qq $qq 1 add set $qq print $qq 10 == { exit } if } loop");
 	filp_exec("10 { qq $qq 1 sub set $qq print } repeat");
 
+	test_c_api();
+
 	filp_shutdown();
 
-	return(0);
+	return(errors ? 1 : 0);
 }